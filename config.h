@@ -67,6 +67,9 @@
 /* Define to 1 if you have the 'socket' library (-lsocket). */
 /* #undef HAVE_LIBSOCKET */
 
+/* Define to 1 if you have the <locale.h> header file. */
+#define HAVE_LOCALE_H 1
+
 /* Define to 1 if you have the 'localtime' function. */
 #define HAVE_LOCALTIME 1
 
@@ -88,6 +91,15 @@
 /* Define to 1 if you have the <netinet/in.h> header file. */
 #define HAVE_NETINET_IN_H 1
 
+/* Define to 1 if you have the 'posix_fadvise' function. */
+#define HAVE_POSIX_FADVISE 1
+
+/* Define to 1 if you have the 'pread' function. */
+#define HAVE_PREAD 1
+
+/* Define if you have POSIX threads. */
+#define HAVE_PTHREAD 1
+
 /* Define if you have the recode library. */
 /* #undef HAVE_RECODE */
 
@@ -40,6 +40,11 @@ typedef SSIZE_T ssize_t;
 #define PXLIB_API
 #endif
 
+/* Bcd numbers with more than 18 digits fit into 128 bit integers */
+#if defined(__SIZEOF_INT128__)
+#define PX_HAVE_INT128 1
+#endif
+
 #define px_true 1
 #define px_false 0
 
@@ -53,6 +58,11 @@ typedef SSIZE_T ssize_t;
 #define pxfIOFile 1
 /* pxfIOGsf is defined as 2 in paradox-gsf.h */
 #define pxfIOStream 3
+#define pxfIOMmap 4
+
+/* Choice of the data block for a new record */
+#define pxfInsertFirstFit 0   /* first block with a free slot */
+#define pxfInsertLastBlock 1  /* last block, or a new one if it is full */
 
 /* Field types */
 #define pxfAlpha        0x01
@@ -89,6 +99,11 @@ typedef SSIZE_T ssize_t;
 #define pxfFileRead   0x1
 #define pxfFileWrite  0x2
 
+/* Quoting of values by PX_export_csv() */
+#define PX_EXPORT_QUOTE_NEEDED  0 /* Values containing special characters */
+#define PX_EXPORT_QUOTE_STRINGS 1 /* All values except numbers */
+#define PX_EXPORT_QUOTE_ALL     2 /* All values */
+
 struct px_field {
 	char *px_fname;
 	char px_ftype;
@@ -147,11 +162,24 @@ typedef struct px_pindex pxpindex_t;
 typedef struct px_stream pxstream_t;
 typedef struct px_val pxval_t;
 typedef struct mb_head mbhead_t;
+typedef struct px_blockdir pxblockdir_t;
+typedef struct px_cursor pxcursor_t;
+typedef struct px_record pxrecord_t;
+typedef struct px_column pxcolumn_t;
+typedef struct px_columns pxcolumns_t;
+typedef struct px_cacheblock pxcacheblock_t;
+typedef struct px_prefetch pxprefetch_t;
+typedef struct px_bulkload pxbulkload_t;
+typedef struct px_decodestep pxdecodestep_t;
+typedef struct px_dateformatitem pxdateformatitem_t;
+typedef struct px_dateformat pxdateformat_t;
+typedef struct px_exportoptions pxexportoptions_t;
 
 struct px_stream {
-	int type;        /* set to pxfIOFile | pxfIOGsf | pxfIOStream*/
+	int type;        /* set to pxfIOFile | pxfIOGsf | pxfIOStream | pxfIOMmap */
 	int mode;        /* set to pxfFileRead | pxfFileWrite */
 	int close;       /* set to true if stream must be closed */
+	int dirty;       /* set if data was written but not flushed yet */
 	union {
 		FILE *fp;
 		void *stream;
@@ -164,6 +192,12 @@ struct px_stream {
 	int (*seek)(pxdoc_t *p, pxstream_t *stream, long offset, int whence);
 	long (*tell)(pxdoc_t *p, pxstream_t *stream);
 	ssize_t (*write)(pxdoc_t *p, pxstream_t *stream, size_t numbytes, void *buffer);
+	/* reads at the given offset without using the current position, may be NULL */
+	ssize_t (*pread)(pxdoc_t *p, pxstream_t *stream, long offset, size_t numbytes, void *buffer);
+	/* memory mapped file, only used by pxfIOMmap */
+	unsigned char *mapdata; /* start of mapped file */
+	size_t mapsize;         /* size of mapped file */
+	long mappos;            /* current position in mapped file */
 };
 
 struct px_doc {
@@ -180,6 +214,8 @@ struct px_doc {
 	int px_datalen;    /* length of data field in number of units */
 	void *px_indexdata;/* Pointer to index data */
 	int px_indexdatalen; /* number of index data records */
+	int px_indexdatasize; /* allocated index data records, 0 if px_indexdata
+	                       * belongs to the index file */
 
 	/* primary index file */
 	pxdoc_t *px_pindex;
@@ -212,9 +248,13 @@ struct px_doc {
 	int (*seek)(pxdoc_t *p, pxstream_t *stream, long offset, int whence);
 	long (*tell)(pxdoc_t *p, pxstream_t *stream);
 	ssize_t (*write)(pxdoc_t *p, pxstream_t *stream, size_t numbytes, void *buffer);
+	ssize_t (*pread)(pxdoc_t *p, pxstream_t *stream, long offset, size_t numbytes, void *buffer);
+	ssize_t (*extend)(pxdoc_t *p, pxstream_t *stream, size_t numbytes);
 
 	char *targetencoding;
 	char *inputencoding;
+	const unsigned short *px_cptable; /* Converts the codepage of the file into
+	                                  * Unicode if the target encoding is UTF-8 */
 #if PX_USE_RECODE
 	RECODE_OUTER recode_outer;
 	RECODE_REQUEST out_recode_request; /* Encoding of written data */
@@ -226,9 +266,46 @@ struct px_doc {
 #endif
 #endif
 
-	long curblocknr;      /* Number of current block in cache (0-n) */
-	int curblockdirty;    /* Set to px_true if the block needs to be written */
-	unsigned char *curblock;       /* Data of block in read cache */
+	/* cache for data blocks */
+	pxcacheblock_t *px_cache;    /* Blocks in cache */
+	int px_cachesize;            /* Maximum number of blocks in cache */
+	int px_cachelast;            /* Index of block accessed last */
+	unsigned long px_cacheclock; /* Incremented on each access of the cache */
+	int px_cachedirty;           /* Number of modified blocks in cache */
+	int px_cachepinned;          /* Number of pinned blocks in cache */
+	pxprefetch_t *px_prefetch;   /* Thread reading blocks ahead, NULL if not running */
+	int px_prefetchsize;         /* Number of blocks to read ahead, 0 to disable */
+
+	/* directory of data blocks in the order of the block chain */
+	pxblockdir_t *px_blockdir;
+	int px_blockdirlen;   /* Number of blocks in directory */
+	int px_blockdirsize;  /* Number of allocated entries in directory */
+	int *px_blockdirmap;  /* Maps block number-1 to index in directory */
+	unsigned int *px_freemap; /* Bit for block number-1 is set if the
+	                           * block has room for another record */
+	int px_freeblocks;    /* Number of bits set in px_freemap */
+	int px_freehint;      /* Words of px_freemap before this one are 0 */
+	int px_insertpolicy;  /* pxfInsertFirstFit or pxfInsertLastBlock */
+	pxblockdir_t *px_indexdir; /* Record numbers and block links of the
+	                            * entries in px_indexdata */
+
+	/* decoding of records */
+	int *px_fieldoffsets; /* Offset of each field within a record */
+	char *px_projection;  /* Set for each field which is decoded when
+	                       * retrieving records, NULL for all fields */
+	pxdecodestep_t *px_plan; /* Steps decoding the fields of a record */
+	int px_plansteps;        /* Number of steps in px_plan */
+
+	/* bulk loading of records */
+	pxbulkload_t *px_bulkload; /* State of PX_bulk_append(), NULL if no
+	                            * bulk load is running */
+
+	/* deferred writing of the header */
+	int px_headdirty;  /* Number of modifications of the header which
+	                    * have not been written yet */
+	int px_headbatch;  /* Write the header after this number of
+	                    * modifications, 0 to write it only by
+	                    * PX_flush() and PX_close() */
 };
 
 struct px_blockcache {
@@ -238,6 +315,14 @@ struct px_blockcache {
 };
 typedef struct px_blockcache pxblockcache_t;
 
+struct px_cacheblock {
+	long blocknr;          /* Number of block in cache (1-n) */
+	int dirty;             /* Set to px_true if the block needs to be written */
+	int pinned;            /* Number of pointers into the block in use */
+	unsigned long lastuse; /* Value of px_cacheclock when last accessed */
+	unsigned char *data;   /* Unencrypted data of block */
+};
+
 struct px_mbblockinfo {
 	int number;
 	char type;
@@ -262,6 +347,8 @@ struct px_blob {
 	int (*seek)(pxblob_t *p, pxstream_t *stream, long offset, int whence);
 	long (*tell)(pxblob_t *p, pxstream_t *stream);
 	ssize_t (*write)(pxblob_t *p, pxstream_t *stream, size_t numbytes, void *buffer);
+	ssize_t (*pread)(pxblob_t *p, pxstream_t *stream, long offset, size_t numbytes, void *buffer);
+	ssize_t (*extend)(pxblob_t *p, pxstream_t *stream, size_t numbytes);
 	/* Cache for the last read block */
 	pxblockcache_t blockcache;
 	/* Index of all blocks in the blob file */
@@ -294,6 +381,106 @@ struct px_pindex {
 						* data block in the database file. */
 };
 
+struct px_blockdir {
+	int blocknumber;   /* Number of the data block (first block is 1) */
+	int numrecords;    /* the number of records in the block */
+	int recno;         /* the recno of the first record in the block */
+	int prev;          /* the number of the previous block */
+	int next;          /* the number of the next block */
+};
+
+struct px_cursor {
+	pxdoc_t *pxdoc;
+	int deleted;       /* Set if deleted records are returned as well */
+	int blocknumber;   /* Number of the current data block */
+	int next;          /* Number of the data block read next */
+	int blockcount;    /* Number of data blocks read so far */
+	int numrecords;    /* Number of records to return from current block */
+	int validrecords;  /* Number of valid records in current block */
+	int recno;         /* Number of the next record in current block */
+	char *buffer;      /* Memory for the current block */
+	char *block;       /* Data of current block, either buffer or mapped file */
+	char *record;      /* Record returned last */
+	int error;         /* Set if a data block could not be read */
+};
+
+struct px_record {
+	pxdoc_t *pxdoc;
+	pxval_t **values;  /* Pointers to the values of all fields */
+	pxval_t *valuemem; /* Memory for the values of all fields */
+	char *arena;       /* Memory for strings and blobs of the current record */
+	size_t arenasize;  /* Allocated size of arena */
+	size_t arenaused;  /* Bytes of arena used by the current record */
+};
+
+struct px_column {
+	int field;            /* Number of the field in the record */
+	int type;             /* Type of the field */
+	int offset;           /* Offset of the field within the record */
+	int len;              /* Length of the field within the record */
+	unsigned char *valid; /* Bit i%8 of valid[i/8] is set if value i is not null */
+	int *lvals;           /* Values of pxfLong, pxfDate, pxfTime, pxfAutoInc */
+	short int *svals;     /* Values of pxfShort and pxfLogical */
+	double *dvals;        /* Values of pxfNumber, pxfCurrency, pxfTimestamp */
+	int *offsets;         /* Value i of pxfAlpha, pxfBCD and pxfBytes fields
+	                       * starts at data+offsets[i] and ends before
+	                       * data+offsets[i+1] */
+	char *data;           /* Bytes of pxfAlpha, pxfBCD and pxfBytes fields */
+	size_t datasize;      /* Allocated size of data */
+};
+
+struct px_columns {
+	pxdoc_t *pxdoc;
+	int numcolumns;       /* Number of columns */
+	pxcolumn_t *columns;  /* Decoded columns */
+	int count;            /* Number of records decoded last */
+	int size;             /* Number of records the columns have room for */
+	char *buffer;         /* Raw data of the records */
+};
+
+struct px_dateformatitem {
+	char conversion;      /* Character of the format or 0 for literal text */
+	int offset;           /* Offset of literal text in text of the format */
+	int len;              /* Length of literal text */
+};
+
+struct px_dateformat {
+	pxdoc_t *pxdoc;
+	pxdateformatitem_t *items; /* Parsed format */
+	int numitems;         /* Number of items */
+	char *text;           /* Literal text of all items */
+	int maxlen;           /* Maximum length of a formatted string without
+	                       * the terminating 0 */
+	int usesdate;         /* Set if the format contains parts of a date */
+	long firstday;        /* Day number of the first day of the month
+	                       * converted last */
+	long lastday;         /* Day number of the last day of that month */
+	int year;             /* Year of that month */
+	int month;            /* Month converted last */
+};
+
+struct px_exportoptions {
+	char separator;       /* Character between two values */
+	char quote;           /* Character enclosing values or 0 for none */
+	int quoting;          /* Which values are quoted, PX_EXPORT_QUOTE_* */
+	int header;           /* Set if the first line has the field names */
+	int trim;             /* Set if trailing white space of strings is
+	                       * removed */
+	const char *null;     /* Written verbatim for null values */
+	const char *eol;      /* Written after each line */
+	const char *truestring;  /* Written for true logical values */
+	const char *falsestring; /* Written for false logical values */
+	const char *dateformat;  /* Format of dates as for PX_date2string() */
+	const char *timeformat;  /* Format of times */
+	const char *timestampformat; /* Format of timestamps */
+	int numberdecimals;   /* Digits after the decimal point of numbers or
+	                       * -1 for the fewest digits reading back the
+	                       * same value */
+	int currencydecimals; /* Digits after the decimal point of currencies */
+	int threads;          /* Number of threads formatting records or 0 for
+	                       * one thread per processor */
+};
+
 #define MAKE_PXVAL(pxdoc, pxval) \
 	(pxval) = (pxval_t *) (pxdoc)->malloc((pxdoc), sizeof(pxval_t), "Allocate memory for pxval_t"); \
 	memset((void *) (pxval), 0, sizeof(pxval_t));
@@ -350,6 +537,9 @@ PX_open_fp(pxdoc_t *pxdoc, FILE *fp);
 PXLIB_API int PXLIB_CALL
 PX_open_file(pxdoc_t *pxdoc, const char *filename);
 
+PXLIB_API int PXLIB_CALL
+PX_open_file_mmap(pxdoc_t *pxdoc, const char *filename);
+
 PXLIB_API int PXLIB_CALL
 PX_create_file(pxdoc_t *pxdoc, pxfield_t *pxf, int numfields, const char *filename, int type);
 
@@ -374,6 +564,15 @@ PX_get_record(pxdoc_t *pxdoc, int recno, char *data);
 PXLIB_API char * PXLIB_CALL
 PX_get_record2(pxdoc_t *pxdoc, int recno, char *data, int *deleted, pxdatablockinfo_t *pxdbinfo);
 
+PXLIB_API int PXLIB_CALL
+PX_get_records(pxdoc_t *pxdoc, int first, int count, char *buffer, unsigned char *deleted);
+
+PXLIB_API const char * PXLIB_CALL
+PX_pin_record(pxdoc_t *pxdoc, int recno, int *deleted);
+
+PXLIB_API void PXLIB_CALL
+PX_unpin_record(pxdoc_t *pxdoc, const char *record);
+
 PXLIB_API int PXLIB_CALL
 PX_put_recordn(pxdoc_t *pxdoc, char *data, int recpos);
 
@@ -383,6 +582,15 @@ PX_put_record(pxdoc_t *pxdoc, char *data);
 PXLIB_API int PXLIB_CALL
 PX_insert_record(pxdoc_t *pxdoc, pxval_t **dataptr);
 
+PXLIB_API int PXLIB_CALL
+PX_bulk_begin(pxdoc_t *pxdoc);
+
+PXLIB_API int PXLIB_CALL
+PX_bulk_append(pxdoc_t *pxdoc, pxval_t **dataptr);
+
+PXLIB_API int PXLIB_CALL
+PX_bulk_finish(pxdoc_t *pxdoc);
+
 PXLIB_API int PXLIB_CALL
 PX_update_record(pxdoc_t *pxdoc, pxval_t **dataptr, int recno);
 
@@ -392,6 +600,45 @@ PX_delete_record(pxdoc_t *pxdoc, int recno);
 PXLIB_API pxval_t ** PXLIB_CALL
 PX_retrieve_record(pxdoc_t *pxdoc, int recno);
 
+PXLIB_API int PXLIB_CALL
+PX_set_projection(pxdoc_t *pxdoc, int *fields, int numfields);
+
+PXLIB_API pxcursor_t * PXLIB_CALL
+PX_cursor_open(pxdoc_t *pxdoc, int deleted);
+
+PXLIB_API char * PXLIB_CALL
+PX_cursor_next(pxcursor_t *cursor, int *deleted);
+
+PXLIB_API pxval_t ** PXLIB_CALL
+PX_cursor_retrieve_record(pxcursor_t *cursor);
+
+PXLIB_API void PXLIB_CALL
+PX_cursor_close(pxcursor_t *cursor);
+
+PXLIB_API pxrecord_t * PXLIB_CALL
+PX_record_new(pxdoc_t *pxdoc);
+
+PXLIB_API pxval_t ** PXLIB_CALL
+PX_record_retrieve(pxrecord_t *record, int recno);
+
+PXLIB_API pxval_t ** PXLIB_CALL
+PX_record_decode(pxrecord_t *record, const char *data);
+
+PXLIB_API void PXLIB_CALL
+PX_record_delete(pxrecord_t *record);
+
+PXLIB_API pxcolumns_t * PXLIB_CALL
+PX_columns_new(pxdoc_t *pxdoc, int *fields, int numfields);
+
+PXLIB_API int PXLIB_CALL
+PX_columns_decode(pxcolumns_t *columns, int first, int count);
+
+PXLIB_API void PXLIB_CALL
+PX_columns_delete(pxcolumns_t *columns);
+
+PXLIB_API int PXLIB_CALL
+PX_flush(pxdoc_t *pxdoc);
+
 PXLIB_API void PXLIB_CALL
 PX_close(pxdoc_t *pxdoc);
 
@@ -499,6 +746,17 @@ PX_get_data_byte(pxdoc_t *pxdoc, char *data, int len, char *value);
 PXLIB_API int PXLIB_CALL
 PX_get_data_bcd(pxdoc_t *pxdoc, unsigned char *data, int len, char **value);
 
+PXLIB_API int PXLIB_CALL
+PX_get_data_bcd_int64(pxdoc_t *pxdoc, unsigned char *data, int len, long long *value);
+
+#ifdef PX_HAVE_INT128
+PXLIB_API int PXLIB_CALL
+PX_get_data_bcd_int128(pxdoc_t *pxdoc, unsigned char *data, int len, __int128 *value);
+#endif
+
+PXLIB_API int PXLIB_CALL
+PX_decode_bcd_column(pxdoc_t *pxdoc, const char *data, int stride, int count, int len, long long *values, unsigned char *valid);
+
 PXLIB_API int PXLIB_CALL
 PX_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int *mod, int *blobsize, char **value);
 
@@ -554,6 +812,27 @@ PX_time2string(pxdoc_t *pxdoc, long value, const char *format);
 PXLIB_API char * PXLIB_CALL
 PX_date2string(pxdoc_t *pxdoc, long value, const char *format);
 
+PXLIB_API pxdateformat_t * PXLIB_CALL
+PX_dateformat_new(pxdoc_t *pxdoc, const char *format);
+
+PXLIB_API int PXLIB_CALL
+PX_dateformat_timestamp(pxdateformat_t *dateformat, double value, char *buffer, int len);
+
+PXLIB_API int PXLIB_CALL
+PX_dateformat_time(pxdateformat_t *dateformat, long value, char *buffer, int len);
+
+PXLIB_API int PXLIB_CALL
+PX_dateformat_date(pxdateformat_t *dateformat, long value, char *buffer, int len);
+
+PXLIB_API void PXLIB_CALL
+PX_dateformat_delete(pxdateformat_t *dateformat);
+
+PXLIB_API void PXLIB_CALL
+PX_export_options_init(pxexportoptions_t *options);
+
+PXLIB_API int PXLIB_CALL
+PX_export_csv(pxdoc_t *pxdoc, FILE *fp, const pxexportoptions_t *options);
+
 PXLIB_API char * PXLIB_CALL
 PX_strdup(pxdoc_t *pxdoc, const char *str);
 
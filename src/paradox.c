@@ -26,6 +26,9 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#if HAVE_LOCALE_H
+#include <locale.h>
+#endif
 #if defined(WIN32) || defined(OS2)
 #include <fcntl.h>
 #endif
@@ -46,12 +49,38 @@
 #include "px_misc.h"
 #include "px_encode.h"
 #include "px_crypt.h"
+#include "px_column.h"
+#include "px_codepage.h"
 
 #ifndef WIN32
 #define max(a,b) ((a)>(b) ? (a) : (b))
 #define min(a,b) ((a)<(b) ? (a) : (b))
 #endif
 
+/* Size of the string a bcd number is converted into */
+#define PX_BCD_BUFFER_SIZE (34+3)
+
+static size_t px_alpha_buffer_size(pxdoc_t *pxdoc, int len);
+static int px_get_data_alpha_buffer(pxdoc_t *pxdoc, char *data, int len, char *buffer, size_t bufsize);
+static char px_decimal_point(void);
+static int px_get_data_bcd_buffer(unsigned char *data, int len, char *buffer, char decimalpoint);
+static int _px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod, int *blobsize, char **value, char *buffer);
+static int px_compile_decode_plan(pxdoc_t *pxdoc);
+
+/* Decodes the fields of one step of the plan for decoding records */
+typedef void (*px_decoder_t)(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record);
+
+/* One step of the plan for decoding records. It decodes count adjacent
+ * fields of the same kind, starting with the field numbered field.
+ */
+struct px_decodestep {
+	int field;        /* Number of first field and index of its value */
+	int count;        /* Number of fields decoded by this step */
+	int offset;       /* Offset of the first field within a record */
+	size_t arenasize; /* Memory needed in the arena of a record, except for blobs */
+	px_decoder_t decode;
+};
+
 
 /* PX_get_majorversion() {{{
  */
@@ -198,7 +227,10 @@ PX_new3(void  (*errorhandler)(pxdoc_t *p, int type, const char *msg, void *data)
 	pxdoc->inputencoding = NULL;
 	pxdoc->px_data = NULL;
 	pxdoc->px_datalen = 0;
-	pxdoc->curblocknr = 0;
+	pxdoc->px_cache = NULL;
+	pxdoc->px_cachesize = PX_DEFAULT_BLOCKCACHE;
+	pxdoc->px_prefetch = NULL;
+	pxdoc->px_prefetchsize = 0;
 
 	return pxdoc;
 }
@@ -274,18 +306,421 @@ PX_set_io_stream(pxdoc_t *pxdoc,
 }
 /* }}} */
 
+/* Number of blocks in each word of px_freemap */
+#define PX_FREEMAP_BITS (8*(int)sizeof(unsigned int))
+#define PX_FREEMAP_WORDS(n) (((n)+PX_FREEMAP_BITS-1)/PX_FREEMAP_BITS)
+
+/* px_blockdir_grow() {{{
+ * Makes sure the block directory, the map from block numbers to
+ * directory entries and the map of blocks with free slots have room
+ * for at least size entries.
+ */
+static int px_blockdir_grow(pxdoc_t *pxdoc, int size) {
+	pxblockdir_t *blockdir;
+	int *blockdirmap;
+	unsigned int *freemap;
+	int i, newsize, oldwords;
+
+	if(size <= pxdoc->px_blockdirsize)
+		return 0;
+
+	newsize = pxdoc->px_blockdirsize > 0 ? pxdoc->px_blockdirsize : 16;
+	while(newsize < size)
+		newsize *= 2;
+
+	if(NULL == (blockdir = pxdoc->realloc(pxdoc, pxdoc->px_blockdir, newsize*sizeof(pxblockdir_t), _("Allocate memory for block directory.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for block directory."));
+		return -1;
+	}
+	pxdoc->px_blockdir = blockdir;
+	if(NULL == (blockdirmap = pxdoc->realloc(pxdoc, pxdoc->px_blockdirmap, newsize*sizeof(int), _("Allocate memory for block directory map.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for block directory map."));
+		return -1;
+	}
+	for(i=pxdoc->px_blockdirsize; i<newsize; i++)
+		blockdirmap[i] = -1;
+	pxdoc->px_blockdirmap = blockdirmap;
+	if(NULL == (freemap = pxdoc->realloc(pxdoc, pxdoc->px_freemap, PX_FREEMAP_WORDS(newsize)*sizeof(unsigned int), _("Allocate memory for map of free slots.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for map of free slots."));
+		return -1;
+	}
+	oldwords = PX_FREEMAP_WORDS(pxdoc->px_blockdirsize);
+	memset(freemap+oldwords, 0, (PX_FREEMAP_WORDS(newsize)-oldwords)*sizeof(unsigned int));
+	pxdoc->px_freemap = freemap;
+	pxdoc->px_blockdirsize = newsize;
+	return 0;
+}
+/* }}} */
+
+/* px_blockdir_free() {{{
+ * Frees the block directory.
+ */
+static void px_blockdir_free(pxdoc_t *pxdoc) {
+	if(pxdoc->px_blockdir)
+		pxdoc->free(pxdoc, pxdoc->px_blockdir);
+	if(pxdoc->px_blockdirmap)
+		pxdoc->free(pxdoc, pxdoc->px_blockdirmap);
+	if(pxdoc->px_freemap)
+		pxdoc->free(pxdoc, pxdoc->px_freemap);
+	pxdoc->px_blockdir = NULL;
+	pxdoc->px_blockdirmap = NULL;
+	pxdoc->px_freemap = NULL;
+	pxdoc->px_blockdirlen = 0;
+	pxdoc->px_blockdirsize = 0;
+	pxdoc->px_freeblocks = 0;
+	pxdoc->px_freehint = 0;
+}
+/* }}} */
+
+/* px_freemap_update() {{{
+ * Sets or clears the bit of a block in the map of blocks with free
+ * slots, depending on the number of records in the block.
+ */
+static void px_freemap_update(pxdoc_t *pxdoc, int blocknumber, int numrecords) {
+	pxhead_t *pxh;
+	unsigned int *word, bit;
+	int recsperdatablock;
+
+	if(pxdoc->px_freemap == NULL || blocknumber < 1 || blocknumber > pxdoc->px_blockdirsize)
+		return;
+
+	pxh = pxdoc->px_head;
+	recsperdatablock = (pxh->px_maxtablesize*0x400-(int)sizeof(TDataBlock)) / pxh->px_recordsize;
+	word = &pxdoc->px_freemap[(blocknumber-1)/PX_FREEMAP_BITS];
+	bit = 1U << ((blocknumber-1)%PX_FREEMAP_BITS);
+	if(numrecords < recsperdatablock) {
+		if(!(*word & bit)) {
+			*word |= bit;
+			pxdoc->px_freeblocks++;
+			if((blocknumber-1)/PX_FREEMAP_BITS < pxdoc->px_freehint)
+				pxdoc->px_freehint = (blocknumber-1)/PX_FREEMAP_BITS;
+		}
+	} else if(*word & bit) {
+		*word &= ~bit;
+		pxdoc->px_freeblocks--;
+	}
+}
+/* }}} */
+
+/* px_freemap_find() {{{
+ * Chooses the data block for a new record. With pxfInsertFirstFit
+ * this is the block with the lowest number which has a free slot,
+ * with pxfInsertLastBlock only the last block in the chain is taken.
+ * Returns the block number or 0 if a new block has to be added.
+ */
+static int px_freemap_find(pxdoc_t *pxdoc) {
+	unsigned int *freemap, word;
+	int i, bit, words;
+
+	freemap = pxdoc->px_freemap;
+	if(pxdoc->px_freeblocks == 0)
+		return 0;
+
+	if(pxdoc->px_insertpolicy == pxfInsertLastBlock) {
+		int last;
+		if(pxdoc->px_blockdirlen == 0)
+			return 0;
+		last = pxdoc->px_blockdir[pxdoc->px_blockdirlen-1].blocknumber;
+		if(freemap[(last-1)/PX_FREEMAP_BITS] & (1U << ((last-1)%PX_FREEMAP_BITS)))
+			return last;
+		return 0;
+	}
+
+	words = PX_FREEMAP_WORDS(pxdoc->px_blockdirsize);
+	for(i=pxdoc->px_freehint; i<words; i++) {
+		if(freemap[i] != 0) {
+			pxdoc->px_freehint = i;
+			word = freemap[i];
+			for(bit=0; !(word & 1); bit++)
+				word >>= 1;
+			return i*PX_FREEMAP_BITS+bit+1;
+		}
+	}
+	return 0;
+}
+/* }}} */
+
+/* px_blockdir_add_block() {{{
+ * Adds a new and empty data block to the block directory. The block
+ * is linked into the chain after the block with number 'after'. If
+ * 'after' is 0 the block becomes the first block.
+ */
+static int px_blockdir_add_block(pxdoc_t *pxdoc, int blocknumber, int after) {
+	pxblockdir_t *blockdir;
+	int i, pos;
+
+	if(pxdoc->px_head == NULL)
+		return -1;
+
+	if(px_blockdir_grow(pxdoc, max(pxdoc->px_blockdirlen+1, blocknumber)) < 0)
+		return -1;
+	blockdir = pxdoc->px_blockdir;
+
+	if(after > 0 && after <= pxdoc->px_blockdirsize && pxdoc->px_blockdirmap[after-1] >= 0)
+		pos = pxdoc->px_blockdirmap[after-1]+1;
+	else
+		pos = 0;
+
+	for(i=pxdoc->px_blockdirlen; i>pos; i--) {
+		blockdir[i] = blockdir[i-1];
+		pxdoc->px_blockdirmap[blockdir[i].blocknumber-1] = i;
+	}
+	blockdir[pos].blocknumber = blocknumber;
+	blockdir[pos].numrecords = 0;
+	if(pos > 0) {
+		blockdir[pos].recno = blockdir[pos-1].recno + blockdir[pos-1].numrecords;
+		blockdir[pos].prev = blockdir[pos-1].blocknumber;
+		blockdir[pos-1].next = blocknumber;
+	} else {
+		blockdir[pos].recno = 0;
+		blockdir[pos].prev = 0;
+	}
+	if(pos < pxdoc->px_blockdirlen) {
+		blockdir[pos].next = blockdir[pos+1].blocknumber;
+		blockdir[pos+1].prev = blocknumber;
+	} else {
+		blockdir[pos].next = 0;
+	}
+	pxdoc->px_blockdirmap[blocknumber-1] = pos;
+	pxdoc->px_blockdirlen++;
+	px_freemap_update(pxdoc, blocknumber, 0);
+	return 0;
+}
+/* }}} */
+
+/* px_blockdir_add_records() {{{
+ * Changes the number of records in a block of the block directory by
+ * 'n' and shifts the record numbers of all following blocks accordingly.
+ */
+static void px_blockdir_add_records(pxdoc_t *pxdoc, int blocknumber, int n) {
+	pxblockdir_t *blockdir;
+	int i, pos;
+
+	if(blocknumber < 1 || blocknumber > pxdoc->px_blockdirsize)
+		return;
+	if((pos = pxdoc->px_blockdirmap[blocknumber-1]) < 0)
+		return;
+
+	blockdir = pxdoc->px_blockdir;
+	blockdir[pos].numrecords += n;
+	for(i=pos+1; i<pxdoc->px_blockdirlen; i++)
+		blockdir[i].recno += n;
+	px_freemap_update(pxdoc, blocknumber, blockdir[pos].numrecords);
+}
+/* }}} */
+
+/* px_indexdir_free() {{{
+ * Frees the record numbers and block links kept for the primary index.
+ */
+static void px_indexdir_free(pxdoc_t *pxdoc) {
+	if(pxdoc->px_indexdir)
+		pxdoc->free(pxdoc, pxdoc->px_indexdir);
+	pxdoc->px_indexdir = NULL;
+}
+/* }}} */
+
+/* px_indexdir_build() {{{
+ * Sums up the number of records of the level 1 entries in the primary
+ * index. The number of the first record of each entry is stored in
+ * px_indexdir, which allows to locate a record by a binary search.
+ * The links to the neighbouring blocks are taken from the block
+ * directory. If a block is not in it, its links are read when first
+ * needed.
+ */
+static int px_indexdir_build(pxdoc_t *pxdoc) {
+	pxpindex_t *pindex_data;
+	pxblockdir_t *indexdir;
+	int j, recno;
+
+	px_indexdir_free(pxdoc);
+	pindex_data = pxdoc->px_indexdata;
+	/* Leave room for all allocated entries of px_indexdata, which are
+	 * filled by px_indexdata_grow() */
+	if(NULL == (indexdir = pxdoc->malloc(pxdoc, max(max(pxdoc->px_indexdatalen, pxdoc->px_indexdatasize), 1)*sizeof(pxblockdir_t), _("Allocate memory for record numbers of primary index.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for record numbers of primary index."));
+		return -1;
+	}
+
+	recno = 0;
+	for(j=0; j<pxdoc->px_indexdatalen; j++) {
+		indexdir[j].blocknumber = pindex_data[j].blocknumber;
+		/* We currently just take level 1 index blocks into account. */
+		indexdir[j].numrecords = pindex_data[j].level == 1 ? pindex_data[j].numrecords : 0;
+		indexdir[j].recno = recno;
+		indexdir[j].prev = -1;
+		indexdir[j].next = -1;
+		if(pxdoc->px_blockdir && indexdir[j].blocknumber > 0 && indexdir[j].blocknumber <= pxdoc->px_blockdirsize) {
+			int pos = pxdoc->px_blockdirmap[indexdir[j].blocknumber-1];
+			if(pos >= 0) {
+				indexdir[j].prev = pxdoc->px_blockdir[pos].prev;
+				indexdir[j].next = pxdoc->px_blockdir[pos].next;
+			}
+		}
+		recno += indexdir[j].numrecords;
+	}
+	pxdoc->px_indexdir = indexdir;
+	return 0;
+}
+/* }}} */
+
+/* px_indexdata_grow() {{{
+ * Makes sure the internal primary index and its record numbers have
+ * room for at least size entries. The number of entries is doubled,
+ * therefore appending blocks one by one takes linear time. An index
+ * read from an index file is copied, because it belongs to the index
+ * file.
+ */
+static int px_indexdata_grow(pxdoc_t *pxdoc, int size) {
+	pxpindex_t *pindex;
+	int newsize;
+
+	if(size <= pxdoc->px_indexdatasize)
+		return 0;
+
+	newsize = pxdoc->px_indexdatasize > 0 ? pxdoc->px_indexdatasize : 16;
+	while(newsize < size)
+		newsize *= 2;
+
+	if(pxdoc->px_indexdatasize > 0 || pxdoc->px_indexdata == NULL) {
+		pindex = pxdoc->realloc(pxdoc, pxdoc->px_indexdata, newsize*sizeof(pxpindex_t), _("Allocate memory for self build internal primary index."));
+	} else {
+		pindex = pxdoc->malloc(pxdoc, newsize*sizeof(pxpindex_t), _("Allocate memory for self build internal primary index."));
+		if(pindex != NULL)
+			memcpy(pindex, pxdoc->px_indexdata, pxdoc->px_indexdatalen*sizeof(pxpindex_t));
+	}
+	if(pindex == NULL) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for self build internal index."));
+		return -1;
+	}
+	pxdoc->px_indexdata = pindex;
+	pxdoc->px_indexdatasize = newsize;
+
+	if(pxdoc->px_indexdir) {
+		pxblockdir_t *indexdir;
+		if(NULL == (indexdir = pxdoc->realloc(pxdoc, pxdoc->px_indexdir, newsize*sizeof(pxblockdir_t), _("Allocate memory for record numbers of primary index.")))) {
+			px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for record numbers of primary index."));
+			/* The record numbers are too small for the index now and
+			 * must be calculated again when needed */
+			px_indexdir_free(pxdoc);
+			return -1;
+		}
+		pxdoc->px_indexdir = indexdir;
+	}
+	return 0;
+}
+/* }}} */
+
+/* px_indexdir_add_records() {{{
+ * Changes the number of records of the level 1 entry in the primary
+ * index pointing to block 'blocknumber' by 'n' and shifts the record
+ * numbers of all following entries.
+ */
+static void px_indexdir_add_records(pxdoc_t *pxdoc, int blocknumber, int n) {
+	pxpindex_t *pindex_data;
+	int j;
+
+	pindex_data = pxdoc->px_indexdata;
+	/* A self build index has the entries in the order of the block
+	 * directory */
+	j = -1;
+	if(pxdoc->px_blockdir && blocknumber > 0 && blocknumber <= pxdoc->px_blockdirsize)
+		j = pxdoc->px_blockdirmap[blocknumber-1];
+	if(j < 0 || j >= pxdoc->px_indexdatalen || pindex_data[j].level != 1 || pindex_data[j].blocknumber != blocknumber) {
+		for(j=0; j<pxdoc->px_indexdatalen; j++) {
+			if(pindex_data[j].level == 1 && pindex_data[j].blocknumber == blocknumber)
+				break;
+		}
+		if(j == pxdoc->px_indexdatalen)
+			return;
+	}
+
+	pindex_data[j].numrecords += n;
+	if(pxdoc->px_indexdir) {
+		pxdoc->px_indexdir[j].numrecords += n;
+		for(j++; j<pxdoc->px_indexdatalen; j++)
+			pxdoc->px_indexdir[j].recno += n;
+	}
+}
+/* }}} */
+
+/* build_block_directory() {{{
+ * Walks once through the chain of data blocks and records for each
+ * block its number, its neighbours and the number of records in it.
+ * The records are counted from the first block on, which allows to
+ * locate a record by a binary search in px_get_record_pos().
+ */
+static int build_block_directory(pxdoc_t *pxdoc) {
+	pxhead_t *pxh;
+	pxstream_t *pxs;
+	pxblockdir_t *blockdir;
+	int blocknumber, recno, maxdatasize;
+
+	pxh = pxdoc->px_head;
+	pxs = pxdoc->px_stream;
+
+	px_blockdir_free(pxdoc);
+	if(px_blockdir_grow(pxdoc, pxh->px_fileblocks) < 0)
+		return -1;
+
+	maxdatasize = pxh->px_maxtablesize*0x400-(int)sizeof(TDataBlock)-pxh->px_recordsize;
+	recno = 0;
+	blocknumber = pxh->px_firstblock; /* Will be set to next block number */
+	while((pxdoc->px_blockdirlen < (int)pxh->px_fileblocks) && (blocknumber > 0)) {
+		TDataBlock datablockhead;
+		int datasize;
+
+		if(get_datablock_head(pxdoc, pxs, blocknumber, &datablockhead) < 0) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not get head of data block nr. %d."), blocknumber);
+			px_blockdir_free(pxdoc);
+			return -1;
+		}
+		if(px_blockdir_grow(pxdoc, blocknumber) < 0)
+			return -1;
+		if(pxdoc->px_blockdirmap[blocknumber-1] >= 0) {
+			px_error(pxdoc, PX_Warning, _("Chain of data blocks contains block nr. %d twice."), blocknumber);
+			break;
+		}
+
+		blockdir = &pxdoc->px_blockdir[pxdoc->px_blockdirlen];
+		blockdir->blocknumber = blocknumber;
+		blockdir->prev = get_short_le((const char *) &datablockhead.prevBlock);
+		blockdir->next = get_short_le((const char *) &datablockhead.nextBlock);
+		blockdir->recno = recno;
+		/* An empty block has a negative size. Blocks whose size is larger
+		 * than the space in a block do not contain any valid records.
+		 */
+		datasize = get_short_le((const char *) &datablockhead.addDataSize);
+		if(datasize > maxdatasize)
+			blockdir->numrecords = 0;
+		else
+			blockdir->numrecords = datasize/pxh->px_recordsize+1;
+		recno += blockdir->numrecords;
+		px_freemap_update(pxdoc, blocknumber, blockdir->numrecords);
+
+		pxdoc->px_blockdirmap[blocknumber-1] = pxdoc->px_blockdirlen;
+		pxdoc->px_blockdirlen++;
+		blocknumber = blockdir->next;
+	}
+	return 0;
+}
+/* }}} */
+
 /* build_primary_index() {{{
- * Build a primary index.
+ * Build a primary index from the block directory.
  */
 static int build_primary_index(pxdoc_t *pxdoc) {
 	pxhead_t *pxh;
-	pxstream_t *pxs;
 	pxpindex_t *pindex;
-	int blocknumber, numrecords;
-	unsigned blockcount;
+	pxblockdir_t *blockdir;
+	int i, numrecords;
 
 	pxh = pxdoc->px_head;
-	pxs = pxdoc->px_stream;
+
+	if(pxdoc->px_blockdir == NULL) {
+		if(build_block_directory(pxdoc) < 0) {
+			return -1;
+		}
+	}
 
 	/* The internal list of index entries will only contain level 1
 	 * entries. Whether we need level 2 entries depends on the size
@@ -297,42 +732,36 @@ static int build_primary_index(pxdoc_t *pxdoc) {
 	/* free an existing index before creating a new one */
 	if(pxdoc->px_indexdata) {
 		pxdoc->free(pxdoc, pxdoc->px_indexdata);
+		pxdoc->px_indexdata = NULL;
+		pxdoc->px_indexdatasize = 0;
 	}
+	px_indexdir_free(pxdoc);
 	/* Allocate memory for internal list of index entries */
-//	fprintf(stderr, "fileblocks = %d\n", pxh->px_fileblocks);
-	if(NULL == (pindex = pxdoc->malloc(pxdoc, pxh->px_fileblocks*sizeof(pxpindex_t), _("Allocate memory for self build internal primary index.")))) {
+	if(NULL == (pindex = pxdoc->malloc(pxdoc, max(pxdoc->px_blockdirlen, 1)*sizeof(pxpindex_t), _("Allocate memory for self build internal primary index.")))) {
 		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for self build internal index."));
 		return -1;
 	}
 
 	/* Build Index of Level 1 */
 	pxdoc->px_indexdata = pindex;
-	pxdoc->px_indexdatalen = pxh->px_fileblocks;
-	blockcount = 0; /* Just a block counter */
+	pxdoc->px_indexdatalen = pxdoc->px_blockdirlen;
+	pxdoc->px_indexdatasize = max(pxdoc->px_blockdirlen, 1);
+	blockdir = pxdoc->px_blockdir;
 	numrecords = 0;
-	blocknumber = pxh->px_firstblock; /* Will be set to next block number */
-	while((blockcount < pxh->px_fileblocks) && (blocknumber > 0)) {
-		TDataBlock datablockhead;
-		if(get_datablock_head(pxdoc, pxs, blocknumber, &datablockhead) < 0) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not get head of data block nr. %d."), blocknumber);
-			pxdoc->free(pxdoc, pindex);
-			return -1;
-		}
+	for(i=0; i<pxdoc->px_blockdirlen; i++) {
 		/* The data can be NULL because we don't support searching for field
 		 * data yet. */
-		pindex[blockcount].data = NULL;
-		pindex[blockcount].blocknumber = blocknumber;
-		pindex[blockcount].numrecords = (get_short_le((char *) &datablockhead.addDataSize)/pxh->px_recordsize)+1;
+		pindex[i].data = NULL;
+		pindex[i].blocknumber = blockdir[i].blocknumber;
+		pindex[i].numrecords = blockdir[i].numrecords;
 
-		numrecords += pindex[blockcount].numrecords;
-		if(pindex[blockcount].numrecords == 0) {
-			fprintf(stderr, _("Block with number %d has no records"), blocknumber);
+		numrecords += pindex[i].numrecords;
+		if(pindex[i].numrecords == 0) {
+			fprintf(stderr, _("Block with number %d has no records"), blockdir[i].blocknumber);
 			fprintf(stderr, "\n");
 		}
-		pindex[blockcount].myblocknumber = 0;
-		pindex[blockcount].level = 1;
-		blocknumber = get_short_le((const char *) &datablockhead.nextBlock);
-		blockcount++;
+		pindex[i].myblocknumber = 0;
+		pindex[i].level = 1;
 	}
 	/* Check if the number of records in the blocks sums up to number
 	 * of records in the header
@@ -342,33 +771,37 @@ static int build_primary_index(pxdoc_t *pxdoc) {
 		fprintf(stderr, "\n");
 	}
 
-	/* Read remaining blocks. This should not happen, but I've seen a database
-	 * where it does happen. So better check for it.
-	 */
-	if(blocknumber != 0) {
-		while(blocknumber > 0) {
-			TDataBlock datablockhead;
-//			fprintf(stderr, "next blocknumber after creating primary index: %d\n", blocknumber);
-			if(get_datablock_head(pxdoc, pxs, blocknumber, &datablockhead) < 0) {
-				px_error(pxdoc, PX_RuntimeError, _("Could not get head of data block nr. %d."), blocknumber);
-				pxdoc->free(pxdoc, pindex);
-				return -1;
-			}
-			/* The data can be NULL because we don't support searching for field
-			 * data yet. */
-/*			pindex[blockcount].data = NULL;
-			pindex[blockcount].blocknumber = blocknumber;
-			pindex[blockcount].numrecords = (get_short_le((char *) &datablockhead.addDataSize)/pxh->px_recordsize)+1;
-			pindex[blockcount].myblocknumber = 0;
-			pindex[blockcount].level = 1;
-*/			blocknumber = get_short_le((const char *) &datablockhead.nextBlock);
-			blockcount++;
-		}
-	}
 	return 0;
 }
 /* }}} */
 
+/* px_prepare_decoding() {{{
+ * Calculates the offset of each field within a record once, instead
+ * of summing up the field lengths each time a record is decoded, and
+ * compiles the plan for decoding records.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int
+px_prepare_decoding(pxdoc_t *pxdoc) {
+	pxhead_t *pxh = pxdoc->px_head;
+	int i, offset;
+
+	if(pxdoc->px_fieldoffsets)
+		pxdoc->free(pxdoc, pxdoc->px_fieldoffsets);
+	if(NULL == (pxdoc->px_fieldoffsets = pxdoc->malloc(pxdoc, (pxh->px_numfields+1)*sizeof(int), _("Allocate memory for field offsets.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for field offsets."));
+		return -1;
+	}
+	offset = 0;
+	for(i=0; i<pxh->px_numfields; i++) {
+		pxdoc->px_fieldoffsets[i] = offset;
+		offset += pxh->px_fields[i].px_flen;
+	}
+	pxdoc->px_fieldoffsets[i] = offset;
+	return(px_compile_decode_plan(pxdoc));
+}
+/* }}} */
+
 /* PX_open_stream() {{{
  * Read from a Paradox DB file, which has an already open stream.
  */
@@ -397,6 +830,16 @@ PX_open_stream(pxdoc_t *pxdoc, void *stream) {
 		px_error(pxdoc, PX_RuntimeError, _("Unable to get header."));
 		return -1;
 	}
+	if(px_prepare_decoding(pxdoc) < 0) {
+		return -1;
+	}
+
+	/* Build the directory of data blocks which is used to locate records
+	 * without walking through the chain of blocks.
+	 */
+	if(build_block_directory(pxdoc) < 0) {
+		return -1;
+	}
 
 	/* Build primary index. This index misses all index blocks with a level
 	 * greater than 1. Since they are not used currently this is of no harm.
@@ -440,11 +883,23 @@ PX_open_gsf(pxdoc_t *pxdoc, GsfInput *gsf) {
 	pxdoc->seek = px_seek;
 	pxdoc->tell = px_tell;
 	pxdoc->write = px_write;
+	pxdoc->pread = px_pread;
+	pxdoc->extend = px_extend;
 
 	if((pxdoc->px_head = get_px_head(pxdoc, pxs)) == NULL) {
 		px_error(pxdoc, PX_RuntimeError, _("Unable to get header."));
 		return -1;
 	}
+	if(px_prepare_decoding(pxdoc) < 0) {
+		return -1;
+	}
+
+	/* Build the directory of data blocks which is used to locate records
+	 * without walking through the chain of blocks.
+	 */
+	if(build_block_directory(pxdoc) < 0) {
+		return -1;
+	}
 
 	/* Build primary index. This index misses all index blocks with a level
 	 * greater than 1. Since they are not used currently this is of no harm.
@@ -465,37 +920,39 @@ PX_open_gsf(pxdoc_t *pxdoc, GsfInput *gsf) {
 /* }}} */
 #endif /* HAVE_GSF */
 
-/* PX_open_fp() {{{
- * Read from a Paradox DB file, which has already been opend with fopen.
+/* px_open_read_head() {{{
+ * Reads the header of a file whose stream has been set in pxdoc and
+ * builds the directory of data blocks and the primary index.
  */
-PXLIB_API int PXLIB_CALL
-PX_open_fp(pxdoc_t *pxdoc, FILE *fp) {
+static int px_open_read_head(pxdoc_t *pxdoc) {
 	pxhead_t *pxh;
 	pxstream_t *pxs;
 
-	if(pxdoc == NULL) {
-		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
-		return -1;
-	}
-
-	if(NULL == (pxs = px_stream_new_file(pxdoc, pxfFileRead, px_false, fp))) {
-		px_error(pxdoc, PX_MemoryError, _("Could not create new file io stream."));
-		return -1;
-	}
-
-	pxdoc->px_stream = pxs;
+	pxs = pxdoc->px_stream;
 
 	pxdoc->read = px_read;
 	pxdoc->seek = px_seek;
 	pxdoc->tell = px_tell;
 	pxdoc->write = px_write;
+	pxdoc->pread = px_pread;
+	pxdoc->extend = px_extend;
 
 	if((pxdoc->px_head = get_px_head(pxdoc, pxs)) == NULL) {
 		px_error(pxdoc, PX_RuntimeError, _("Unable to get header."));
 		return -1;
 	}
+	if(px_prepare_decoding(pxdoc) < 0) {
+		return -1;
+	}
 	pxdoc->last_position = pxdoc->px_head->px_numrecords-1;
 
+	/* Build the directory of data blocks which is used to locate records
+	 * without walking through the chain of blocks.
+	 */
+	if(build_block_directory(pxdoc) < 0) {
+		return -1;
+	}
+
 	/* Build primary index. This index misses all index blocks with a level
 	 * greater than 1. Since they are not used currently this is of no harm.
 	 */
@@ -514,6 +971,29 @@ PX_open_fp(pxdoc_t *pxdoc, FILE *fp) {
 }
 /* }}} */
 
+/* PX_open_fp() {{{
+ * Read from a Paradox DB file, which has already been opend with fopen.
+ */
+PXLIB_API int PXLIB_CALL
+PX_open_fp(pxdoc_t *pxdoc, FILE *fp) {
+	pxstream_t *pxs;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
+
+	if(NULL == (pxs = px_stream_new_file(pxdoc, pxfFileRead, px_false, fp))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not create new file io stream."));
+		return -1;
+	}
+
+	pxdoc->px_stream = pxs;
+
+	return(px_open_read_head(pxdoc));
+}
+/* }}} */
+
 /* PX_open_file() {{{
  * Read from a Paradox DB file. Open the file itself. Use PX_open_fp()
  * if the file has been open already with fopen().
@@ -544,20 +1024,67 @@ PX_open_file(pxdoc_t *pxdoc, const char *filename) {
 }
 /* }}} */
 
-/* PX_create_fp() {{{
- * Create a new paradox database.
+/* PX_open_file_mmap() {{{
+ * Read from a Paradox DB file which is mapped into memory. The file
+ * can only be read. If the file cannot be mapped it will be read like
+ * with PX_open_file().
  */
 PXLIB_API int PXLIB_CALL
-PX_create_fp(pxdoc_t *pxdoc, pxfield_t *fields, int numfields, FILE *fp, int type) {
-	pxhead_t *pxh;
-	pxfield_t *pxf;
+PX_open_file_mmap(pxdoc_t *pxdoc, const char *filename) {
+#if HAVE_SYS_MMAN_H
+	FILE *fp;
 	pxstream_t *pxs;
-	int i, c, recordsize = 0;
-	int approxheadersize = 0; /* The name indicates that this size not accurate,
-							   * actually it is very precise. */
 
-	pxf = fields;
-	for(i=0, c=0; i<numfields; i++, pxf++) {
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
+
+	if((fp = fopen(filename, "rb")) == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not open file of paradox database: %s"), strerror(errno));
+		return -1;
+	}
+
+	if(NULL == (pxs = px_stream_new_mmap(pxdoc, pxfFileRead, px_true, fp))) {
+		if(NULL == (pxs = px_stream_new_file(pxdoc, pxfFileRead, px_true, fp))) {
+			px_error(pxdoc, PX_MemoryError, _("Could not create new file io stream."));
+			fclose(fp);
+			return -1;
+		}
+	}
+	pxdoc->px_stream = pxs;
+
+	if(0 > px_open_read_head(pxdoc)) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not open paradox database."));
+		px_stream_unmap(pxdoc, pxs);
+		fclose(fp);
+		pxdoc->free(pxdoc, pxs);
+		pxdoc->px_stream = NULL;
+		return -1;
+	}
+
+	pxdoc->px_name = px_strdup(pxdoc, filename);
+	return 0;
+#else
+	return(PX_open_file(pxdoc, filename));
+#endif
+}
+/* }}} */
+
+/* PX_create_fp() {{{
+ * Create a new paradox database.
+ */
+PXLIB_API int PXLIB_CALL
+PX_create_fp(pxdoc_t *pxdoc, pxfield_t *fields, int numfields, FILE *fp, int type) {
+	pxhead_t *pxh;
+	pxfield_t *pxf;
+	pxstream_t *pxs;
+	int i, c, recordsize = 0;
+	int approxheadersize = 0; /* The name indicates that this size not accurate,
+							   * actually it is very precise. */
+
+	pxf = fields;
+	for(i=0, c=0; i<numfields; i++, pxf++) {
 		if(pxf->px_ftype == pxfAutoInc)
 			c++;
 	}
@@ -670,6 +1197,8 @@ PX_create_fp(pxdoc_t *pxdoc, pxfield_t *fields, int numfields, FILE *fp, int typ
 	pxdoc->seek = px_seek;
 	pxdoc->tell = px_tell;
 	pxdoc->write = px_write;
+	pxdoc->pread = px_pread;
+	pxdoc->extend = px_extend;
 
 	if(put_px_head(pxdoc, pxh, pxs) < 0) {
 		px_error(pxdoc, PX_RuntimeError, _("Unable to put header."));
@@ -677,6 +1206,9 @@ PX_create_fp(pxdoc_t *pxdoc, pxfield_t *fields, int numfields, FILE *fp, int typ
 	}
 
 	pxdoc->px_head = pxh;
+	if(px_prepare_decoding(pxdoc) < 0) {
+		return -1;
+	}
 	return 0;
 }
 /* }}} */
@@ -723,6 +1255,23 @@ PX_set_value(pxdoc_t *pxdoc, const char *name, float value) {
 		return -1;
 	}
 
+	/* The size of the block cache and the number of blocks read ahead
+	 * can be set for files opened read only */
+	if(strcmp(name, "blockcache") == 0) {
+		return(px_cache_resize(pxdoc, (int) value));
+	} else if(strcmp(name, "prefetch") == 0) {
+		return(px_prefetch_resize(pxdoc, (int) value));
+	} else if(strcmp(name, "headerbatch") == 0) {
+		if(value < 0) {
+			px_error(pxdoc, PX_Warning, _("Number of modifications before writing the header must be greater than or equal to 0."));
+			return -1;
+		}
+		pxdoc->px_headbatch = (int) value;
+		if(pxdoc->px_headbatch > 0 && pxdoc->px_headdirty >= pxdoc->px_headbatch)
+			return(px_head_flush(pxdoc));
+		return(0);
+	}
+
 	if(!(pxdoc->px_stream->mode & pxfFileWrite)) {
 		px_error(pxdoc, PX_Warning, _("File is not writable. Setting '%s' has no effect."), name);
 		return -1;
@@ -742,7 +1291,7 @@ PX_set_value(pxdoc_t *pxdoc, const char *name, float value) {
 		} else {
 			pxdoc->px_head->px_filetype = pxfFileTypIndexDB;
 		}
-		if(put_px_head(pxdoc, pxdoc->px_head, pxdoc->px_stream) < 0) {
+		if(px_head_modified(pxdoc) < 0) {
 			return -1;
 		}
 	} else if(strcmp(name, "codepage") == 0) {
@@ -751,7 +1300,7 @@ PX_set_value(pxdoc_t *pxdoc, const char *name, float value) {
 			return -1;
 		}
 		pxdoc->px_head->px_doscodepage = (int) value;
-		if(put_px_head(pxdoc, pxdoc->px_head, pxdoc->px_stream) < 0) {
+		if(px_head_modified(pxdoc) < 0) {
 			return -1;
 		}
 	} else {
@@ -826,6 +1375,15 @@ PX_get_value(pxdoc_t *pxdoc, const char *name, float *value) {
 	} else if(strcmp(name, "encryption") == 0) {
 		*value = (float) pxdoc->px_head->px_encryption;
 		return(0);
+	} else if(strcmp(name, "blockcache") == 0) {
+		*value = (float) pxdoc->px_cachesize;
+		return(0);
+	} else if(strcmp(name, "prefetch") == 0) {
+		*value = (float) pxdoc->px_prefetchsize;
+		return(0);
+	} else if(strcmp(name, "headerbatch") == 0) {
+		*value = (float) pxdoc->px_headbatch;
+		return(0);
 	}
 	px_error(pxdoc, PX_Warning, _("No such value name."));
 	return(-2);
@@ -853,7 +1411,7 @@ PX_set_parameter(pxdoc_t *pxdoc, const char *name, const char *value) {
 
 		pxdoc->px_head->px_tablename = px_strdup(pxdoc, value);
 		if(pxdoc->px_stream->mode & pxfFileWrite) {
-			if(put_px_head(pxdoc, pxdoc->px_head, pxdoc->px_stream) < 0) {
+			if(px_head_modified(pxdoc) < 0) {
 				return -1;
 			}
 		} else {
@@ -863,7 +1421,7 @@ PX_set_parameter(pxdoc_t *pxdoc, const char *name, const char *value) {
 	} else if(strcmp(name, "password") == 0) {
 		pxdoc->px_head->px_encryption = px_passwd_checksum(value);
 		if(pxdoc->px_stream->mode & pxfFileWrite) {
-			if(put_px_head(pxdoc, pxdoc->px_head, pxdoc->px_stream) < 0) {
+			if(px_head_modified(pxdoc) < 0) {
 				return -1;
 			}
 		} else {
@@ -872,19 +1430,23 @@ PX_set_parameter(pxdoc_t *pxdoc, const char *name, const char *value) {
 		}
 	} else if(strcmp(name, "targetencoding") == 0) {
 		int codepage;
-#if PX_USE_RECODE || PX_USE_ICONV
 		if(pxdoc->targetencoding)
 			pxdoc->free(pxdoc, pxdoc->targetencoding);
 		pxdoc->targetencoding = px_strdup(pxdoc, value);
 		if(0 > px_set_targetencoding(pxdoc)) {
 			pxdoc->free(pxdoc, pxdoc->targetencoding);
 			pxdoc->targetencoding = NULL;
+#if PX_USE_RECODE || PX_USE_ICONV
 			px_error(pxdoc, PX_RuntimeError, _("Target encoding could not be set."));
 			return -1;
-		}
 #else
-		px_error(pxdoc, PX_RuntimeError, _("Library has not been compiled with support for reencoding."));
+			px_error(pxdoc, PX_RuntimeError, _("Library has not been compiled with support for reencoding."));
+			return -2;
 #endif
+		}
+		/* Converted strings need more memory in a record */
+		if(px_compile_decode_plan(pxdoc) < 0)
+			return -1;
 		if(sscanf(value, "CP%d", &codepage)) {
 			PX_set_value(pxdoc, "codepage", (float)codepage);
 		}
@@ -908,6 +1470,15 @@ PX_set_parameter(pxdoc_t *pxdoc, const char *name, const char *value) {
 		} else {
 			pxdoc->warnings = px_false;
 	    }
+	} else if(strcmp(name, "insertpolicy") == 0) {
+		if(strcmp(value, "firstfit") == 0) {
+			pxdoc->px_insertpolicy = pxfInsertFirstFit;
+		} else if(strcmp(value, "lastblock") == 0) {
+			pxdoc->px_insertpolicy = pxfInsertLastBlock;
+		} else {
+			px_error(pxdoc, PX_Warning, _("Insert policy must be 'firstfit' or 'lastblock'."));
+			return -1;
+		}
 	}
 	return 0;
 }
@@ -937,6 +1508,9 @@ PX_get_parameter(pxdoc_t *pxdoc, const char *name, char **value) {
 	} else if(strcmp(name, "inputencoding") == 0) {
 		*value = pxdoc->inputencoding;
 		return(0);
+	} else if(strcmp(name, "insertpolicy") == 0) {
+		*value = pxdoc->px_insertpolicy == pxfInsertLastBlock ? "lastblock" : "firstfit";
+		return(0);
 	}
 	px_error(pxdoc, PX_Warning, _("No such parameter name."));
 	return(-2);
@@ -1028,11 +1602,20 @@ PX_add_primary_index(pxdoc_t *pxdoc, pxdoc_t *pindex) {
 	if(pxdoc->px_pindex) {
 		PX_delete(pxdoc->px_pindex);
 	}
+	/* The self build index is replaced by the one in the index file */
+	if(pxdoc->px_indexdata && pxdoc->px_indexdatasize > 0) {
+		pxdoc->free(pxdoc, pxdoc->px_indexdata);
+	}
+	px_indexdir_free(pxdoc);
 	pxdoc->px_pindex = pindex;
 	pxdoc->px_indexdata = pindex->px_data;
 	pxdoc->px_indexdatalen = pindex->px_head->px_numrecords;
+	pxdoc->px_indexdatasize = 0;
 
-	return 0;
+	/* Build the record numbers right away instead of on first access
+	 * in PX_get_record2(), which may be called from several threads.
+	 */
+	return(px_indexdir_build(pxdoc));
 }
 /* }}} */
 
@@ -1250,9 +1833,10 @@ PX_write_primary_index(pxdoc_t *pxdoc, pxdoc_t *pxindex) {
 
 /* px_get_record_pos_with_index() {{{
  * Locates a database record by using the primary index.
- * The index is used by adding the number of records per block
- * until the block is found where the record with the given number
- * is stored. The function still disregards any sorting within the
+ * The entry of the index is found by a binary search on the number
+ * of the first record covered by each entry. Those numbers are
+ * calculated once from the number of records of each entry. The
+ * function still disregards any sorting within the
  * index. The record number is not an absolut value. Accessing a
  * database file with and without the index may result in different
  * record numbers for the same record.
@@ -1260,73 +1844,143 @@ PX_write_primary_index(pxdoc_t *pxdoc, pxdoc_t *pxindex) {
  */
 int
 px_get_record_pos_with_index(pxdoc_t *pxdoc, int recno, int *deleted, pxdatablockinfo_t *pxdbinfo) {
-	int j, numrecords, n, recsperdatablock;
-//	pxdoc_t *pindexdoc;
-	pxhead_t *pxh; //, *pxih;
-	pxpindex_t *pindex_data;
+	int j, left, right;
+	pxhead_t *pxh;
+	pxblockdir_t *indexdir;
 
 	pxh = pxdoc->px_head;
-//	pindexdoc = pxdoc->px_pindex;
-//	pxih = pindexdoc->px_head;
-//	pindex_data = pindexdoc->px_data;
-	pindex_data = pxdoc->px_indexdata;
 
-	if(!pindex_data) {
+	if(!pxdoc->px_indexdata) {
 		px_error(pxdoc, PX_RuntimeError, _("Cannot search for free slot in block without an index."));
 		return 0;
 	}
 
-	numrecords = 0 ;
-	recsperdatablock = (pxh->px_maxtablesize*0x400-sizeof(TDataBlock))/pxh->px_recordsize;
-	for(j=0; j<pxdoc->px_indexdatalen; j++) {
-		/* We currently just take level 1 index blocks into account.
-		 * This is only for large databases a speed disadvantage.
-		 */
-		if(pindex_data[j].level == 1) {
-			n = pindex_data[j].numrecords;
-			numrecords += n;
-			if(recno >= n) {
-				recno -= n;
-			} else {
-				int blocksize, ret;
-				TDataBlock datablock;
+	if(pxdoc->px_indexdir == NULL) {
+		if(px_indexdir_build(pxdoc) < 0)
+			return 0;
+	}
+	indexdir = pxdoc->px_indexdir;
+	if(pxdoc->px_indexdatalen == 0)
+		return 0;
 
-				pxdbinfo->number = pindex_data[j].blocknumber;
-				pxdbinfo->recno = recno;
-				pxdbinfo->blockpos = pxh->px_headersize + (pxdbinfo->number-1)*pxh->px_maxtablesize*0x400;
-				pxdbinfo->recordpos = pxdbinfo->blockpos + sizeof(TDataBlock) + recno*pxh->px_recordsize;
+	/* Search for the last entry starting at or before recno. Entries
+	 * without records share their first record number with the
+	 * following entry.
+	 */
+	left = 0;
+	right = pxdoc->px_indexdatalen-1;
+	while(left < right) {
+		int mid = (left+right+1)/2;
+		if(indexdir[mid].recno <= recno)
+			left = mid;
+		else
+			right = mid-1;
+	}
+	j = left;
+	recno -= indexdir[j].recno;
+	if(recno < 0 || recno >= indexdir[j].numrecords)
+		return 0;
 
-				/* Go to the start of the data block (skip the header) */
-				if((ret = pxdoc->seek(pxdoc, pxdoc->px_stream, pxdbinfo->blockpos, SEEK_SET)) < 0) {
-					px_error(pxdoc, PX_RuntimeError, _("Could not fseek start of first data block."));
-					return 0;
-				}
+	/* Read the links of the data block only once */
+	if(indexdir[j].prev < 0) {
+		TDataBlock datablock;
 
-				/* Get the info about this data block */
-				if((ret = (int)pxdoc->read(pxdoc, pxdoc->px_stream, sizeof(TDataBlock), &datablock)) < 0) {
-					px_error(pxdoc, PX_RuntimeError, _("Could not read datablock header."));
-					return 0;
-				}
+		if(get_datablock_head(pxdoc, pxdoc->px_stream, indexdir[j].blocknumber, &datablock) < 0) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not read datablock header."));
+			return 0;
+		}
+		indexdir[j].prev = get_short_le((char *) &datablock.prevBlock);
+		indexdir[j].next = get_short_le((char *) &datablock.nextBlock);
+	}
+
+	pxdbinfo->number = indexdir[j].blocknumber;
+	pxdbinfo->recno = recno;
+	pxdbinfo->blockpos = pxh->px_headersize + (pxdbinfo->number-1)*pxh->px_maxtablesize*0x400;
+	pxdbinfo->recordpos = pxdbinfo->blockpos + sizeof(TDataBlock) + recno*pxh->px_recordsize;
+	pxdbinfo->prev = indexdir[j].prev;
+	pxdbinfo->next = indexdir[j].next;
+	pxdbinfo->numrecords = indexdir[j].numrecords;
+	pxdbinfo->size = pxdbinfo->numrecords*pxh->px_recordsize;
+	*deleted = 0;
+	return 1;
+}
+/* }}} */
 
-				blocksize = get_short_le((char *) &datablock.addDataSize);
+/* px_get_record_pos_with_blockdir() {{{
+ * Locates a database record by using the block directory. The block
+ * is found by a binary search on the number of the first record in
+ * each block. If deleted is set, every block is considered to be
+ * completely filled, which makes the block directly addressable.
+ * Returns 1 if record could be found, otherwise 0
+ */
+static int
+px_get_record_pos_with_blockdir(pxdoc_t *pxdoc, int recno, int *deleted, pxdatablockinfo_t *pxdbinfo) {
+	pxhead_t *pxh;
+	pxblockdir_t *blockdir;
+	int recsperdatablock, numrecords, size, pos;
 
-				pxdbinfo->prev = get_short_le((char *) &datablock.prevBlock);
-				pxdbinfo->next = get_short_le((char *) &datablock.nextBlock);
-				pxdbinfo->size = blocksize+pxh->px_recordsize;
-				pxdbinfo->numrecords = pxdbinfo->size/pxh->px_recordsize;
-				deleted = 0;
-				return 1;
-			}
+	pxh = pxdoc->px_head;
+	blockdir = pxdoc->px_blockdir;
+	if(pxdoc->px_blockdirlen == 0)
+		return 0;
+
+	recsperdatablock = (pxh->px_maxtablesize*0x400-sizeof(TDataBlock))/pxh->px_recordsize;
+	if(*deleted) {
+		pos = recno / recsperdatablock;
+		if(pos >= pxdoc->px_blockdirlen)
+			return 0;
+		recno -= pos * recsperdatablock;
+		numrecords = recsperdatablock;
+		size = pxh->px_maxtablesize*0x400-sizeof(TDataBlock);
+		/* if we are within the range of valid data in the block,
+		 * then set the deleted flag to 0
+		 */
+		if(recno < blockdir[pos].numrecords)
+			*deleted = 0;
+	} else {
+		int left, right;
+
+		/* Search for the last block starting at or before recno. Empty
+		 * blocks share their first record number with the following
+		 * block, so this will always be a block with records, unless
+		 * recno is beyond the last record.
+		 */
+		left = 0;
+		right = pxdoc->px_blockdirlen-1;
+		while(left < right) {
+			int mid = (left+right+1)/2;
+			if(blockdir[mid].recno <= recno)
+				left = mid;
+			else
+				right = mid-1;
 		}
+		pos = left;
+		recno -= blockdir[pos].recno;
+		if(recno < 0 || recno >= blockdir[pos].numrecords)
+			return 0;
+		numrecords = blockdir[pos].numrecords;
+		size = numrecords*pxh->px_recordsize;
+		*deleted = 0;
 	}
-	return 0;
+
+	if(pxdbinfo != NULL) {
+		pxdbinfo->prev = blockdir[pos].prev;
+		pxdbinfo->next = blockdir[pos].next;
+		pxdbinfo->number = blockdir[pos].blocknumber;
+		pxdbinfo->size = size;
+		pxdbinfo->recno = recno;
+		pxdbinfo->numrecords = numrecords;
+		pxdbinfo->blockpos = pxh->px_headersize + (blockdir[pos].blocknumber-1)*pxh->px_maxtablesize*0x400;
+		pxdbinfo->recordpos = pxdbinfo->blockpos + sizeof(TDataBlock) + recno*pxh->px_recordsize;
+	}
+	return 1;
 }
 /* }}} */
 
 /* px_get_record_pos() {{{
- * Reads all data blocks until the requested recno is in the block.
- * This function doesn't use a primary index and is therefore far
- * from being efficient for large files.
+ * Locates the data block which contains the record with the given
+ * number. The block directory is used if it exists. Otherwise all
+ * data blocks are read until the requested recno is in the block.
  * Returns 1 if record could be found, otherwise 0
  */
 int
@@ -1336,6 +1990,9 @@ px_get_record_pos(pxdoc_t *pxdoc, int recno, int *deleted, pxdatablockinfo_t *px
 	TDataBlock datablock;
 	pxhead_t *pxh;
 
+	if(pxdoc->px_blockdir)
+		return(px_get_record_pos_with_blockdir(pxdoc, recno, deleted, pxdbinfo));
+
 	pxh = pxdoc->px_head;
 
 	found = 0;
@@ -1644,28 +2301,24 @@ px_find_blob_slot(pxblob_t *pxblob, int blobsize, pxmbblockinfo_t **blockinfo) {
 }
 /* }}} */
 
-/* px_convert_data() {{{
+/* px_encode_record() {{{
  * Takes a list of pointers, pointing towards the data of each
- * field and creates a record, which can be stored in the database
- * file.
+ * field and stores the record into data, which must have room for
+ * px_recordsize bytes.
  * Notice: This function modifies the header of the paradox database
  * if a field of type pxfAutoInc is affected and its value is NULL.
  *
- * Returns 0 on success or and -1 * in case of error.
+ * Returns 0 on success or -1 in case of error.
  */
-char *
-px_convert_data(pxdoc_t *pxdoc, pxval_t **dataptr) {
+static int
+px_encode_record(pxdoc_t *pxdoc, pxval_t **dataptr, char *data) {
 	int numfields;
 	pxhead_t *pxh;
 	pxfield_t *pxf;
 	int i, offset;
-	char *data;
 
 	pxh = pxdoc->px_head;
 
-	if(NULL == (data = pxdoc->malloc(pxdoc, pxh->px_recordsize, _("Allocate memory for data record.")))) {
-		return NULL;
-	}
 	/* Initialize to 0, so null values are the default */
 	memset(data, 0, pxh->px_recordsize);
 
@@ -1678,8 +2331,7 @@ px_convert_data(pxdoc_t *pxdoc, pxval_t **dataptr) {
 			switch(pxf->px_ftype) {
 				case pxfAlpha:
 					if(dataptr[i]->value.str.len > pxf->px_flen) {
-						pxdoc->free(pxdoc, data);
-						return NULL;
+						return -1;
 					}
 					PX_put_data_alpha(pxdoc, &data[offset], pxf->px_flen, (char *) dataptr[i]->value.str.val);
 					break;
@@ -1719,8 +2371,7 @@ px_convert_data(pxdoc_t *pxdoc, pxval_t **dataptr) {
 				case pxfFmtMemoBLOb:
 				case pxfMemoBLOb: {
 					if(0 > PX_put_data_blob(pxdoc, &data[offset], pxf->px_flen, dataptr[i]->value.str.val, dataptr[i]->value.str.len)) {
-						pxdoc->free(pxdoc, data);
-						return NULL;
+						return -1;
 					}
 					break;
 				}
@@ -1735,10 +2386,79 @@ px_convert_data(pxdoc_t *pxdoc, pxval_t **dataptr) {
 		offset += pxf->px_flen;
 		pxf++;
 	}
+	return 0;
+}
+/* }}} */
+
+/* px_convert_data() {{{
+ * Takes a list of pointers, pointing towards the data of each
+ * field and creates a record, which can be stored in the database
+ * file. See px_encode_record().
+ *
+ * Returns the record, which must be freed by the caller, or NULL in
+ * case of error.
+ */
+char *
+px_convert_data(pxdoc_t *pxdoc, pxval_t **dataptr) {
+	char *data;
+
+	if(NULL == (data = pxdoc->malloc(pxdoc, pxdoc->px_head->px_recordsize, _("Allocate memory for data record.")))) {
+		return NULL;
+	}
+	if(0 > px_encode_record(pxdoc, dataptr, data)) {
+		pxdoc->free(pxdoc, data);
+		return NULL;
+	}
 	return(data);
 }
 /* }}} */
 
+/* px_locate_record() {{{
+ * Checks whether the record number is in the range of records which
+ * can be read and locates the record either by the primary index or
+ * the data blocks. See PX_get_record2() for the meaning of deleted.
+ * Returns 1 if the record could be found, otherwise 0
+ */
+static int
+px_locate_record(pxdoc_t *pxdoc, int recno, int *deleted, pxdatablockinfo_t *pxdbinfo) {
+	pxhead_t *pxh;
+	int found;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return 0;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return 0;
+	}
+	pxh = pxdoc->px_head;
+
+	/* Allow to read records up to the theoretical number of records
+	 * in the file or the actual number of records depending on 'deleted'.
+	 * If a primary index exists do not care about 'deleted' and read
+	 * in any case only up to the actual number of records.
+	 */
+	if((recno < 0) ||
+	   (*deleted && (recno >= pxh->px_theonumrecords)) ||
+	   (pxdoc->px_pindex && (recno >= pxh->px_numrecords)) ||
+	   (!*deleted && (recno >= pxh->px_numrecords))) {
+		px_error(pxdoc, PX_RuntimeError, _("Record number out of range."));
+		return 0;
+	}
+
+	if(pxdoc->px_pindex)
+		found = px_get_record_pos_with_index(pxdoc, recno, deleted, pxdbinfo);
+	else
+		found = px_get_record_pos(pxdoc, recno, deleted, pxdbinfo);
+
+	if(!found)
+		px_error(pxdoc, PX_RuntimeError, _("Could not find record in database."));
+	return(found);
+}
+/* }}} */
+
 /* PX_get_record() {{{
  * Reads one record from a Paradox file. This function can be used
  * for different types of Paradox files. This function will not
@@ -1762,78 +2482,44 @@ PX_get_record(pxdoc_t *pxdoc, int recno, char *data) {
  */
 PXLIB_API char* PXLIB_CALL
 PX_get_record2(pxdoc_t *pxdoc, int recno, char *data, int *deleted, pxdatablockinfo_t *pxdbinfo) {
-	int ret, found;
 	pxhead_t *pxh;
 	pxdatablockinfo_t tmppxdbinfo;
 
-	if(pxdoc == NULL) {
-		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
-		return NULL;
-	}
-
-	if(pxdoc->px_head == NULL) {
-		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+	if(!px_locate_record(pxdoc, recno, deleted, &tmppxdbinfo))
 		return NULL;
-	}
 	pxh = pxdoc->px_head;
 
-	/* Allow to read records up to the theoretical number of records
-	 * in the file or the actual number of records depending on 'deleted'.
-	 * If a primary index exists do not care about 'deleted' and read
-	 * in any case only up to the actual number of records.
-	 */
-	if((recno < 0) ||
-	   (*deleted && (recno >= pxh->px_theonumrecords)) ||
-	   (pxdoc->px_pindex && (recno >= pxh->px_numrecords)) ||
-	   (!*deleted && (recno >= pxh->px_numrecords))) {
-		px_error(pxdoc, PX_RuntimeError, _("Record number out of range."));
-		return NULL;
+	if(pxdbinfo) {
+		memcpy(pxdbinfo, &tmppxdbinfo, sizeof(pxdatablockinfo_t));
 	}
 
-	if(pxdoc->px_indexdata)
-		found = px_get_record_pos_with_index(pxdoc, recno, deleted, &tmppxdbinfo);
-	else
-		found = px_get_record_pos(pxdoc, recno, deleted, &tmppxdbinfo);
-
-	if(found) {
-		if(pxdbinfo) {
-			memcpy(pxdbinfo, &tmppxdbinfo, sizeof(pxdatablockinfo_t));
-		}
-
-		if((ret = pxdoc->seek(pxdoc, pxdoc->px_stream, tmppxdbinfo.recordpos, SEEK_SET)) < 0) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not fseek start of record data."));
-			return NULL;
-		}
-		if((ret = (int)pxdoc->read(pxdoc, pxdoc->px_stream, pxh->px_recordsize, data)) < 0) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not read data of record."));
-			return NULL;
-		}
-		return data;
-	} else {
-		px_error(pxdoc, PX_RuntimeError, _("Could not find record in database."));
+	/* Read at the position of the record without changing the
+	 * position of the stream, which allows several threads to read
+	 * from the same file.
+	 */
+	if(pxdoc->pread(pxdoc, pxdoc->px_stream, tmppxdbinfo.recordpos, pxh->px_recordsize, data) < 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not read data of record."));
 		return NULL;
 	}
+	return data;
 }
 /* }}} */
 
-/* PX_put_recordn() {{{
- * Store a record into the paradox file. The record can be saved at
- * any position. If the position is beyond the last datablock, then
- * new datablocks will be added until the position lies in a
- * datablock. You may use this function to end a datablock and
- * start a new one. If the position is in the middle of a data block
- * without any records before this position, the position will be
- * recalculated and the record is placed after the last record in
- * that datablock.
- * Returns the next postion or -1 in case of an error.
+/* PX_get_records() {{{
+ * Reads count consecutive records starting at record first into
+ * buffer, which must have room for count*px_recordsize bytes. All
+ * records stored one after the other in a data block are read at once.
+ * If deleted is NULL only valid records are read, just like
+ * PX_get_record() does. Otherwise records are counted like in
+ * PX_get_record2() with *deleted set to 1, and deleted must have room
+ * for (count+7)/8 bytes. Bit i%8 of deleted[i/8] is set if the i'th
+ * record read is deleted.
+ * Returns the number of records read or -1 in case of an error.
  */
 PXLIB_API int PXLIB_CALL
-PX_put_recordn(pxdoc_t *pxdoc, char *data, int recpos) {
+PX_get_records(pxdoc_t *pxdoc, int first, int count, char *buffer, unsigned char *deleted) {
 	pxhead_t *pxh;
-	unsigned itmp, datablocknr;
-	int recsperdatablock, recdatablocknr;
-	int update; /* Will be set by px_add_data_to_block() if an existing
-				   record is updated */
+	int recno, last;
 
 	if(pxdoc == NULL) {
 		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
@@ -1846,21 +2532,154 @@ PX_put_recordn(pxdoc_t *pxdoc, char *data, int recpos) {
 	}
 	pxh = pxdoc->px_head;
 
-//	fprintf(stderr, "Putting record at position %d\n", recpos);
-
-	/* All the following calculation assume sequentially writing of
-	 * records and filling a datablock first before starting a new one.
-	 * This should be fixed. Better would be, if we keep record
-	 * in px_data (like a primary index) which datablocks are available
-	 * an how much space they still have.
+	/* The same range of record numbers as in PX_get_record2() is
+	 * allowed. A primary index only knows about valid records.
 	 */
-	/* Check if record still fits into a existing data block */
-	recsperdatablock = (pxh->px_maxtablesize*0x400-sizeof(TDataBlock)) / pxh->px_recordsize;
-	/* Calculate the number of the data block for this record.
-	 * Datablock numbers start at 1. */
-	datablocknr = (recpos / recsperdatablock) + 1;
-	/* Calculate the position within the datablock */
-	recdatablocknr = recpos % recsperdatablock;
+	if(deleted && !pxdoc->px_pindex)
+		last = pxh->px_theonumrecords;
+	else
+		last = pxh->px_numrecords;
+	if(first < 0 || count < 0 || count > last-first) {
+		px_error(pxdoc, PX_RuntimeError, _("Record number out of range."));
+		return -1;
+	}
+
+	if(deleted)
+		memset(deleted, 0, (count+7)/8);
+
+	recno = 0;
+	while(recno < count) {
+		pxdatablockinfo_t pxdbinfo;
+		int found, isdeleted, n, validrecords;
+
+		isdeleted = (deleted && !pxdoc->px_pindex) ? 1 : 0;
+		if(pxdoc->px_pindex)
+			found = px_get_record_pos_with_index(pxdoc, first+recno, &isdeleted, &pxdbinfo);
+		else
+			found = px_get_record_pos(pxdoc, first+recno, &isdeleted, &pxdbinfo);
+		if(!found) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not find record in database."));
+			return -1;
+		}
+
+		/* Read the rest of the block or the remaining records */
+		n = min(pxdbinfo.numrecords-pxdbinfo.recno, count-recno);
+		if(pxdoc->pread(pxdoc, pxdoc->px_stream, pxdbinfo.recordpos, n*pxh->px_recordsize, buffer+recno*pxh->px_recordsize) < 0) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not read data of records."));
+			return -1;
+		}
+
+		/* Records behind the valid records of the block are deleted */
+		if(deleted && !pxdoc->px_pindex) {
+			int i;
+
+			if(pxdoc->px_blockdir && pxdbinfo.number <= pxdoc->px_blockdirsize && pxdoc->px_blockdirmap[pxdbinfo.number-1] >= 0) {
+				validrecords = pxdoc->px_blockdir[pxdoc->px_blockdirmap[pxdbinfo.number-1]].numrecords;
+			} else {
+				TDataBlock datablock;
+				int datasize;
+
+				if(get_datablock_head(pxdoc, pxdoc->px_stream, pxdbinfo.number, &datablock) < 0) {
+					px_error(pxdoc, PX_RuntimeError, _("Could not get head of data block nr. %d."), pxdbinfo.number);
+					return -1;
+				}
+				datasize = get_short_le((char *) &datablock.addDataSize);
+				if(datasize > pxh->px_maxtablesize*0x400-(int)sizeof(TDataBlock)-pxh->px_recordsize)
+					validrecords = 0;
+				else
+					validrecords = datasize/pxh->px_recordsize+1;
+			}
+			for(i=max(validrecords-pxdbinfo.recno, 0); i<n; i++)
+				deleted[(recno+i)/8] |= 1 << ((recno+i)%8);
+		}
+		recno += n;
+	}
+	return(recno);
+}
+/* }}} */
+
+/* PX_pin_record() {{{
+ * Returns a pointer to the data of a record without copying it. The
+ * pointer points into the block cache, where the data is already
+ * decrypted, or into the mapping of a memory mapped file. The block
+ * stays in the cache until the record is released with
+ * PX_unpin_record(). See PX_get_record2() for the meaning of deleted.
+ * Returns a pointer to the record or NULL in case of an error.
+ */
+PXLIB_API const char * PXLIB_CALL
+PX_pin_record(pxdoc_t *pxdoc, int recno, int *deleted) {
+	pxdatablockinfo_t pxdbinfo;
+
+	if(!px_locate_record(pxdoc, recno, deleted, &pxdbinfo))
+		return NULL;
+
+	return((const char *) px_cache_pin(pxdoc, pxdbinfo.recordpos, pxdoc->px_head->px_recordsize));
+}
+/* }}} */
+
+/* PX_unpin_record() {{{
+ * Releases a record returned by PX_pin_record(). The pointer must not
+ * be used afterwards.
+ */
+PXLIB_API void PXLIB_CALL
+PX_unpin_record(pxdoc_t *pxdoc, const char *record) {
+	if(pxdoc == NULL || record == NULL) {
+		return;
+	}
+	px_cache_unpin(pxdoc, (const unsigned char *) record);
+}
+/* }}} */
+
+/* PX_put_recordn() {{{
+ * Store a record into the paradox file. The record can be saved at
+ * any position. If the position is beyond the last datablock, then
+ * new datablocks will be added until the position lies in a
+ * datablock. You may use this function to end a datablock and
+ * start a new one. If the position is in the middle of a data block
+ * without any records before this position, the position will be
+ * recalculated and the record is placed after the last record in
+ * that datablock.
+ * Returns the next postion or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_put_recordn(pxdoc_t *pxdoc, char *data, int recpos) {
+	pxhead_t *pxh;
+	unsigned itmp, datablocknr;
+	int recsperdatablock, recdatablocknr;
+	int update; /* Will be set by px_add_data_to_block() if an existing
+				   record is updated */
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return -1;
+	}
+	pxh = pxdoc->px_head;
+
+	if(pxdoc->px_bulkload != NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Database cannot be modified during a bulk load."));
+		return -1;
+	}
+
+//	fprintf(stderr, "Putting record at position %d\n", recpos);
+
+	/* All the following calculation assume sequentially writing of
+	 * records and filling a datablock first before starting a new one.
+	 * This should be fixed. Better would be, if we keep record
+	 * in px_data (like a primary index) which datablocks are available
+	 * an how much space they still have.
+	 */
+	/* Check if record still fits into a existing data block */
+	recsperdatablock = (pxh->px_maxtablesize*0x400-sizeof(TDataBlock)) / pxh->px_recordsize;
+	/* Calculate the number of the data block for this record.
+	 * Datablock numbers start at 1. */
+	datablocknr = (recpos / recsperdatablock) + 1;
+	/* Calculate the position within the datablock */
+	recdatablocknr = recpos % recsperdatablock;
 
 //	fprintf(stderr, "Data goes into block %d at record no %d (%d)\n", datablocknr, recdatablocknr, recsperdatablock);
 	/* add as many datablocks as require to store the record at the
@@ -1868,11 +2687,15 @@ PX_put_recordn(pxdoc_t *pxdoc, char *data, int recpos) {
 	itmp = datablocknr;
 	while(datablocknr > pxh->px_fileblocks) {
 //		fprintf(stderr, "We need an new datablock\n");
-		itmp = put_px_datablock(pxdoc, pxh, pxh->px_lastblock, pxdoc->px_stream);
+		int after = pxh->px_lastblock;
+		itmp = put_px_datablock(pxdoc, pxh, after, pxdoc->px_stream);
 		if(itmp < 0) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not write new data block."));
 			return -1;
 		}
+		if(px_blockdir_add_block(pxdoc, itmp, after) < 0) {
+			return -1;
+		}
 //		fprintf(stderr, "Added data block no. %d\n", itmp);
 	}
 	/* The datablock number return by px_put_datablock() should be
@@ -1907,9 +2730,12 @@ PX_put_recordn(pxdoc_t *pxdoc, char *data, int recpos) {
 	}
 	if(update == 0) {
 		pxh->px_numrecords++;
+		px_blockdir_add_records(pxdoc, datablocknr, 1);
 	}
 
-	put_px_head(pxdoc, pxh, pxdoc->px_stream);
+	if(px_head_modified(pxdoc) < 0) {
+		return -1;
+	}
 	return(pxdoc->last_position+1);
 }
 /* }}} */
@@ -1925,203 +2751,1359 @@ PX_put_record(pxdoc_t *pxdoc, char *data) {
 }
 /* }}} */
 
-/* PX_retrieve_record() {{{
- * Get a record from the paradox file.
- * Returns an array of *pxval_t or NULL in case of an error.
+/* px_record_alloc() {{{
+ * Takes size bytes from the arena of a record. The arena has been
+ * made large enough for the whole record by px_record_reserve().
+ * Returns a pointer to the memory or NULL if the arena is exhausted.
  */
-PXLIB_API pxval_t ** PXLIB_CALL
-PX_retrieve_record(pxdoc_t *pxdoc, int recno) {
-	pxhead_t *pxh;
-	char *data;
+static char *
+px_record_alloc(pxrecord_t *record, size_t size) {
+	char *ptr;
 
-	if(pxdoc == NULL) {
-		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+	if(record->arenaused + size > record->arenasize) {
+		px_error(record->pxdoc, PX_RuntimeError, _("Field values do not fit into memory of record."));
 		return NULL;
 	}
+	ptr = record->arena + record->arenaused;
+	record->arenaused += size;
+	return(ptr);
+}
+/* }}} */
 
-	if(pxdoc->px_head == NULL) {
-		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
-		return NULL;
+/* px_decode_skip() {{{
+ * Sets the values of fields which are not decoded to null.
+ */
+static void
+px_decode_skip(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	int i;
+
+	(void) pxdoc;
+	(void) data;
+	(void) record;
+
+	for(i=step->field; i<step->field+step->count; i++)
+		values[i]->isnull = 1;
+}
+/* }}} */
+
+/* px_decode_alpha() {{{
+ */
+static void
+px_decode_alpha(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	pxfield_t *pxf = &pxdoc->px_head->px_fields[step->field];
+	const char *d = data + step->offset;
+	int i;
+
+	for(i=step->field; i<step->field+step->count; i++, d+=pxf->px_flen, pxf++) {
+		char *value;
+		int ret;
+		if(record) {
+			size_t bufsize = px_alpha_buffer_size(pxdoc, pxf->px_flen);
+			if(NULL == (value = px_record_alloc(record, bufsize)))
+				ret = -1;
+			else
+				ret = px_get_data_alpha_buffer(pxdoc, (char *) d, pxf->px_flen, value, bufsize);
+		} else {
+			ret = PX_get_data_alpha(pxdoc, (char *) d, pxf->px_flen, &value);
+		}
+		if(0 < ret) {
+			values[i]->value.str.val = value;
+			values[i]->value.str.len = (int)strlen(value);
+		} else if(ret < 0) {
+			values[i]->isnull = 1;
+			px_error(pxdoc, PX_RuntimeError, _("Could not read of field of type pxfAlpha."));
+		} else {
+			values[i]->isnull = 1;
+		}
 	}
-	pxh = pxdoc->px_head;
+}
+/* }}} */
 
-	/* Allocate memory for record */
-	if((data = (char *) pxdoc->malloc(pxdoc, pxh->px_recordsize, _("Allocate memory for temporary record."))) == NULL) {
-		px_error(pxdoc, PX_RuntimeError, _("Could not allocate memory for temporary record."));
-		return NULL;
+/* px_decode_short() {{{
+ * Numbers are stored big endian with the sign bit flipped. They are
+ * null if all bytes are zero. Like in PX_get_record() the fields are
+ * stepped over by their length in the header.
+ */
+static void
+px_decode_short(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	pxfield_t *pxf = &pxdoc->px_head->px_fields[step->field];
+	const unsigned char *d = (const unsigned char *) data + step->offset;
+	int i;
+
+	(void) record;
+
+	for(i=step->field; i<step->field+step->count; i++, d+=pxf->px_flen, pxf++) {
+		unsigned int v = (d[0] << 8) | d[1];
+		if(v != 0)
+			values[i]->value.lval = (long) (short int) (v ^ 0x8000);
+		else
+			values[i]->isnull = 1;
 	}
+}
+/* }}} */
+
+/* px_decode_long() {{{
+ * Decodes long integers, dates, times and auto increments.
+ */
+static void
+px_decode_long(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	pxfield_t *pxf = &pxdoc->px_head->px_fields[step->field];
+	const unsigned char *d = (const unsigned char *) data + step->offset;
+	int i;
 
-	if(NULL != PX_get_record(pxdoc, recno, data)) {
-		int i, offset;
-		pxval_t **dataptr;
-		pxfield_t *pxf;
+	(void) record;
 
-		/* Allocate memory for return record */
-		if(NULL == (dataptr = (pxval_t **) pxdoc->malloc(pxdoc, pxh->px_numfields*sizeof(pxval_t *), _("Allocate memory for array of pointers to field values.")))) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not allocate memory for array of pointers to field values."));
-			pxdoc->free(pxdoc, data);
-			return NULL;
+	for(i=step->field; i<step->field+step->count; i++, d+=pxf->px_flen, pxf++) {
+		unsigned int v = ((unsigned int) d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
+		if(v != 0)
+			values[i]->value.lval = (long) (int) (v ^ 0x80000000U);
+		else
+			values[i]->isnull = 1;
+	}
+}
+/* }}} */
+
+/* px_decode_double() {{{
+ * Decodes numbers, currencies and timestamps. Positive numbers have
+ * the sign bit set, negative numbers have all bits inverted. Empty
+ * fields are returned as 0.0, as PX_retrieve_record() always did.
+ */
+static void
+px_decode_double(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	pxfield_t *pxf = &pxdoc->px_head->px_fields[step->field];
+	const unsigned char *d = (const unsigned char *) data + step->offset;
+	int i, k;
+
+	(void) record;
+
+	for(i=step->field; i<step->field+step->count; i++, d+=pxf->px_flen, pxf++) {
+		char tmp[8];
+		if(d[0] & 0x80) {
+			memcpy(tmp, d, 8);
+			tmp[0] &= 0x7f;
+		} else {
+			if(d[0] == 0 && d[1] == 0 && d[2] == 0 && d[3] == 0 &&
+			   d[4] == 0 && d[5] == 0 && d[6] == 0 && d[7] == 0)
+				continue;
+			for(k=0; k<8; k++)
+				tmp[k] = ~d[k];
 		}
-		pxf = PX_get_fields(pxdoc);
-		offset = 0;
-		for(i=0; i<PX_get_num_fields(pxdoc); i++) {
-			MAKE_PXVAL(pxdoc, dataptr[i]);
-			dataptr[i]->type = pxf->px_ftype;
+		values[i]->value.dval = get_double_be(tmp);
+	}
+}
+/* }}} */
+
+/* px_decode_logical() {{{
+ */
+static void
+px_decode_logical(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	const unsigned char *d = (const unsigned char *) data + step->offset;
+	int i;
+
+	(void) pxdoc;
+	(void) record;
+
+	for(i=step->field; i<step->field+step->count; i++, d++) {
+		if(*d != 0)
+			values[i]->value.lval = (long) (char) (*d ^ 0x80);
+		else
+			values[i]->isnull = 1;
+	}
+}
+/* }}} */
+
+/* px_decode_blob() {{{
+ * Reads blobs from the blob file. In a record the size of the blob
+ * has been added to the arena by px_record_reserve().
+ */
+static void
+px_decode_blob(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	pxfield_t *pxf = &pxdoc->px_head->px_fields[step->field];
+	const char *d = data + step->offset;
+	int i;
+
+	for(i=step->field; i<step->field+step->count; i++, d+=pxf->px_flen, pxf++) {
+		char *blobdata, *buffer = NULL;
+		int mod_nr, size, ret;
+		if(record) {
+			long blobsize = get_long_le(&d[pxf->px_flen-10+4]);
+			if(blobsize > 0)
+				buffer = px_record_alloc(record, blobsize);
+		}
+		ret = _px_get_data_blob(pxdoc, d, pxf->px_flen, pxf->px_ftype == pxfGraphic ? 17 : 9, &mod_nr, &size, &blobdata, buffer);
+		if(ret > 0) {
+			if(blobdata) {
+				values[i]->value.str.val = blobdata;
+				values[i]->value.str.len = size;
+			} else {
+				values[i]->isnull = 1;
+				px_error(pxdoc, PX_RuntimeError, _("Could not read blob data."));
+			}
+		} else if(ret == 0) {
+			values[i]->isnull = 1;
+		} else {
+			px_error(pxdoc, PX_RuntimeError, _("Could not read blob data."));
+		}
+	}
+}
+/* }}} */
+
+/* px_decode_bytes() {{{
+ */
+static void
+px_decode_bytes(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	pxfield_t *pxf = &pxdoc->px_head->px_fields[step->field];
+	const char *d = data + step->offset;
+	int i;
+
+	for(i=step->field; i<step->field+step->count; i++, d+=pxf->px_flen, pxf++) {
+		char *value;
+		int ret;
+		if(record) {
+			if(d[0] == '\0')
+				ret = 0;
+			else if(NULL == (value = px_record_alloc(record, pxf->px_flen)))
+				ret = -1;
+			else {
+				memcpy(value, d, pxf->px_flen);
+				ret = 1;
+			}
+		} else {
+			ret = PX_get_data_bytes(pxdoc, (char *) d, pxf->px_flen, &value);
+		}
+		if(0 < ret) {
+			values[i]->value.str.val = value;
+			values[i]->value.str.len = pxf->px_flen;
+		} else {
+			values[i]->isnull = 1;
+		}
+	}
+}
+/* }}} */
+
+/* px_decode_bcd() {{{
+ */
+static void
+px_decode_bcd(pxdoc_t *pxdoc, const pxdecodestep_t *step, const char *data, pxval_t **values, pxrecord_t *record) {
+	pxfield_t *pxf = &pxdoc->px_head->px_fields[step->field];
+	const char *d = data + step->offset;
+	char decimalpoint = px_decimal_point();
+	int i;
+
+	for(i=step->field; i<step->field+step->count; i++, d+=pxf->px_flen, pxf++) {
+		char *value;
+		int ret;
+		if(record) {
+			if(d[0] == '\0')
+				ret = 0;
+			else if(NULL == (value = px_record_alloc(record, PX_BCD_BUFFER_SIZE)))
+				ret = -1;
+			else
+				ret = px_get_data_bcd_buffer((unsigned char *) d, pxf->px_fdc, value, decimalpoint);
+		} else {
+			ret = PX_get_data_bcd(pxdoc, (unsigned char *) d, pxf->px_fdc, &value);
+		}
+		if(0 < ret) {
+			values[i]->value.str.val = value;
+			values[i]->value.str.len = (int)strlen(value);
+		} else {
+			values[i]->isnull = 1;
+		}
+	}
+}
+/* }}} */
+
+/* px_compile_decode_plan() {{{
+ * Compiles the plan for decoding records from the field definitions,
+ * the projection and the target encoding. Each step of the plan decodes
+ * a run of adjacent fields of the same kind, so the type of a field is
+ * not looked at again when decoding records. The plan must be compiled
+ * again whenever the projection or the target encoding changes.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int
+px_compile_decode_plan(pxdoc_t *pxdoc) {
+	pxhead_t *pxh = pxdoc->px_head;
+	pxdecodestep_t *plan, *step;
+	int i;
+
+	/* The plan is compiled when the file is opened */
+	if(pxh == NULL || pxdoc->px_fieldoffsets == NULL)
+		return 0;
+
+	if(NULL == (plan = pxdoc->malloc(pxdoc, (pxh->px_numfields+1)*sizeof(pxdecodestep_t), _("Allocate memory for plan to decode records.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for plan to decode records."));
+		return -1;
+	}
+
+	step = NULL;
+	for(i=0; i<pxh->px_numfields; i++) {
+		pxfield_t *pxf = &pxh->px_fields[i];
+		px_decoder_t decode;
+		size_t size = 0;
+
+		if(pxdoc->px_projection && !pxdoc->px_projection[i]) {
+			decode = px_decode_skip;
+		} else {
 			switch(pxf->px_ftype) {
-				case pxfAlpha: {
-					char *value;
-					int ret;
-					if(0 < (ret = PX_get_data_alpha(pxdoc, &data[offset], pxf->px_flen, &value))) {
-						dataptr[i]->value.str.val = value;
-						dataptr[i]->value.str.len = (int)strlen(value);
-					} else if(ret < 0) {
-						dataptr[i]->isnull = 1;
-						px_error(pxdoc, PX_RuntimeError, _("Could not read of field of type pxfAlpha."));
-					} else {
-						dataptr[i]->isnull = 1;
-					}
+				case pxfAlpha:
+					decode = px_decode_alpha;
+					size = px_alpha_buffer_size(pxdoc, pxf->px_flen);
 					break;
-				}
-				case pxfShort: {
-					short int value;
-					if(0 < PX_get_data_short(pxdoc, &data[offset], pxf->px_flen, &value)) {
-						dataptr[i]->value.lval = (long) value;
-					} else {
-						dataptr[i]->isnull = 1;
-					}
+				case pxfShort:
+					decode = px_decode_short;
 					break;
-					}
 				case pxfDate:
 				case pxfTime:
 				case pxfAutoInc:
-				case pxfLong: {
-					long value;
-					if(0 < PX_get_data_long(pxdoc, &data[offset], pxf->px_flen, &value)) {
-						dataptr[i]->value.lval = value;
-					} else {
-						dataptr[i]->isnull = 1;
-					}
+				case pxfLong:
+					decode = px_decode_long;
 					break;
-					}
 				case pxfTimestamp:
 				case pxfCurrency:
-				case pxfNumber: {
-					double value;
-					if(0 < PX_get_data_double(pxdoc, &data[offset], pxf->px_flen, &value)) {
-						dataptr[i]->value.dval = value;
-					} 
+				case pxfNumber:
+					decode = px_decode_double;
 					break;
-					} 
-				case pxfLogical: {
-					char value;
-					if(0 < PX_get_data_byte(pxdoc, &data[offset], pxf->px_flen, &value)) {
-						dataptr[i]->value.lval = (long) value;
-					} else {
-						dataptr[i]->isnull = 1;
-					}
+				case pxfLogical:
+					decode = px_decode_logical;
 					break;
-					}
 				case pxfGraphic:
 				case pxfBLOb:
 				case pxfFmtMemoBLOb:
 				case pxfMemoBLOb:
-				case pxfOLE: {
-					char *blobdata;
-					int mod_nr, size, ret;
-					if(pxf->px_ftype == pxfGraphic)
-						ret = PX_get_data_graphic(pxdoc, &data[offset], pxf->px_flen, &mod_nr, &size, &blobdata);
-					else
-						ret = PX_get_data_blob(pxdoc, &data[offset], pxf->px_flen, &mod_nr, &size, &blobdata);
-					if(ret > 0) {
-						if(blobdata) {
-							dataptr[i]->value.str.val = blobdata;
-							dataptr[i]->value.str.len = size;
-						} else {
-							dataptr[i]->isnull = 1;
-							px_error(pxdoc, PX_RuntimeError, _("Could not read blob data."));
-						}
-					} else if(ret == 0) {
-						dataptr[i]->isnull = 1;
-					} else {
-						px_error(pxdoc, PX_RuntimeError, _("Could not read blob data."));
-					}
-
+				case pxfOLE:
+					decode = px_decode_blob;
 					break;
-				}
-				case pxfBytes: {
-					char *value;
-					if(0 < PX_get_data_bytes(pxdoc, &data[offset], pxf->px_flen, &value)) {
-						dataptr[i]->value.str.val = value;
-						dataptr[i]->value.str.len = pxf->px_flen;
-					} else {
-						dataptr[i]->isnull = 1;
-					}
+				case pxfBytes:
+					decode = px_decode_bytes;
+					size = pxf->px_flen;
 					break;
-					}
-				case pxfBCD: {
-					char *value;
-					if(0 < PX_get_data_bcd(pxdoc, (unsigned char*) &data[offset], pxf->px_fdc, &value)) {
-						dataptr[i]->value.str.val = value;
-						dataptr[i]->value.str.len = (int)strlen(value);
-					} else {
-						dataptr[i]->isnull = 1;
-					}
+				case pxfBCD:
+					decode = px_decode_bcd;
+					size = PX_BCD_BUFFER_SIZE;
 					break;
-				}
 				default:
-					dataptr[i]->isnull = 1;
+					decode = px_decode_skip;
 					break;
 			}
-			offset += pxf->px_flen;
-			pxf++;
 		}
-/*
-		if(filetype == pxfFileTypPrimIndex) {
-			short int value;
-			if(0 < PX_get_data_short(pxdoc, &data[offset], 2, &value)) {
-				fprintf(outfp, "%d", value);
-			}
-			offset += 2;
-			if(0 < PX_get_data_short(pxdoc, &data[offset], 2, &value)) {
-				fprintf(outfp, "%d", value);
-				ireccounter += value;
+
+		if(step && step->decode == decode) {
+			step->count++;
+			step->arenasize += size;
+		} else {
+			step = step ? step+1 : plan;
+			step->field = i;
+			step->count = 1;
+			step->offset = pxdoc->px_fieldoffsets[i];
+			step->arenasize = size;
+			step->decode = decode;
+		}
+	}
+
+	if(pxdoc->px_plan)
+		pxdoc->free(pxdoc, pxdoc->px_plan);
+	pxdoc->px_plan = plan;
+	pxdoc->px_plansteps = step ? (int) (step-plan)+1 : 0;
+	return 0;
+}
+/* }}} */
+
+/* px_record_reserve() {{{
+ * Empties the arena of a record and makes sure it is large enough for
+ * the strings and blobs of the given record data. The arena never
+ * shrinks, so it is only reallocated if a record needs more memory
+ * than any record before.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int
+px_record_reserve(pxrecord_t *record, const char *data) {
+	pxdoc_t *pxdoc = record->pxdoc;
+	pxdecodestep_t *step;
+	size_t size;
+	int i;
+
+	size = 0;
+	for(step=pxdoc->px_plan; step<pxdoc->px_plan+pxdoc->px_plansteps; step++) {
+		size += step->arenasize;
+		if(step->decode == px_decode_blob) {
+			/* The size of the blob is stored in the record */
+			for(i=step->field; i<step->field+step->count; i++) {
+				pxfield_t *pxf = &pxdoc->px_head->px_fields[i];
+				long blobsize = get_long_le(&data[pxdoc->px_fieldoffsets[i]+pxf->px_flen-10+4]);
+				if(blobsize > 0)
+					size += blobsize;
 			}
-			offset += 2;
-			if(0 < PX_get_data_short(pxdoc, &data[offset], 2, &value)) {
-				fprintf(outfp, "%d", value);
+		}
+	}
+
+	if(size > record->arenasize) {
+		char *arena;
+		if(NULL == (arena = pxdoc->realloc(pxdoc, record->arena, size, _("Allocate memory for field values of record.")))) {
+			px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for field values of record."));
+			return -1;
+		}
+		record->arena = arena;
+		record->arenasize = size;
+	}
+	record->arenaused = 0;
+	return 0;
+}
+/* }}} */
+
+/* px_retrieve_record_data() {{{
+ * Converts the raw data of a record into an array of *pxval_t by
+ * running the plan for decoding records.
+ * If record is not NULL, the values are stored in the record and its
+ * arena, which must have been prepared by px_record_reserve().
+ * Otherwise all memory is allocated and must be freed by the caller.
+ * Returns an array of *pxval_t or NULL in case of an error.
+ */
+static pxval_t **
+px_retrieve_record_data(pxdoc_t *pxdoc, char *data, pxrecord_t *record) {
+	pxhead_t *pxh = pxdoc->px_head;
+	pxdecodestep_t *step;
+	pxval_t **dataptr;
+	int i;
+
+	/* Allocate memory for return record */
+	if(record) {
+		dataptr = record->values;
+	} else if(NULL == (dataptr = (pxval_t **) pxdoc->malloc(pxdoc, pxh->px_numfields*sizeof(pxval_t *), _("Allocate memory for array of pointers to field values.")))) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not allocate memory for array of pointers to field values."));
+		return NULL;
+	}
+	for(i=0; i<pxh->px_numfields; i++) {
+		if(record) {
+			memset(dataptr[i], 0, sizeof(pxval_t));
+		} else {
+			MAKE_PXVAL(pxdoc, dataptr[i]);
+		}
+		dataptr[i]->type = pxh->px_fields[i].px_ftype;
+	}
+	for(step=pxdoc->px_plan; step<pxdoc->px_plan+pxdoc->px_plansteps; step++)
+		step->decode(pxdoc, step, data, dataptr, record);
+	return(dataptr);
+}
+/* }}} */
+
+/* PX_retrieve_record() {{{
+ * Get a record from the paradox file.
+ * Returns an array of *pxval_t or NULL in case of an error.
+ */
+PXLIB_API pxval_t ** PXLIB_CALL
+PX_retrieve_record(pxdoc_t *pxdoc, int recno) {
+	const char *data;
+	pxval_t **dataptr;
+	int deleted = 0;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return NULL;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return NULL;
+	}
+
+	/* The record is converted in place without copying it */
+	if(NULL == (data = PX_pin_record(pxdoc, recno, &deleted))) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not read data for record with number %d."), recno);
+		return NULL;
+	}
+	dataptr = px_retrieve_record_data(pxdoc, (char *) data, NULL);
+	PX_unpin_record(pxdoc, data);
+	return(dataptr);
+}
+/* }}} */
+
+/* PX_set_projection() {{{
+ * Sets the fields which are decoded by PX_retrieve_record(),
+ * PX_cursor_retrieve_record() and the functions for reusable records.
+ * fields is an array of numfields field numbers. All other fields are
+ * returned as null values without reading them, which saves reading
+ * the blob file for blobs not needed. If fields is NULL, all fields
+ * will be decoded again.
+ * Returns 0 on success or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_set_projection(pxdoc_t *pxdoc, int *fields, int numfields) {
+	pxhead_t *pxh;
+	char *projection;
+	int i;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return -1;
+	}
+	pxh = pxdoc->px_head;
+
+	if(fields == NULL) {
+		if(pxdoc->px_projection)
+			pxdoc->free(pxdoc, pxdoc->px_projection);
+		pxdoc->px_projection = NULL;
+		return(px_compile_decode_plan(pxdoc));
+	}
+
+	for(i=0; i<numfields; i++) {
+		if(fields[i] < 0 || fields[i] >= pxh->px_numfields) {
+			px_error(pxdoc, PX_RuntimeError, _("Field number %d is out of range."), fields[i]);
+			return -1;
+		}
+	}
+
+	if(NULL == (projection = pxdoc->malloc(pxdoc, pxh->px_numfields, _("Allocate memory for projection of fields.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for projection of fields."));
+		return -1;
+	}
+	memset(projection, 0, pxh->px_numfields);
+	for(i=0; i<numfields; i++)
+		projection[fields[i]] = 1;
+
+	if(pxdoc->px_projection)
+		pxdoc->free(pxdoc, pxdoc->px_projection);
+	pxdoc->px_projection = projection;
+	return(px_compile_decode_plan(pxdoc));
+}
+/* }}} */
+
+/* PX_cursor_open() {{{
+ * Creates a cursor for reading all records of a database in the
+ * order of the block chain. Each data block is read only once.
+ * If deleted is set, the cursor will return deleted records as well.
+ * Returns a pointer to the cursor or NULL in case of an error.
+ */
+PXLIB_API pxcursor_t * PXLIB_CALL
+PX_cursor_open(pxdoc_t *pxdoc, int deleted) {
+	pxhead_t *pxh;
+	pxcursor_t *cursor;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return NULL;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return NULL;
+	}
+	pxh = pxdoc->px_head;
+
+	if(NULL == (cursor = pxdoc->malloc(pxdoc, sizeof(pxcursor_t), _("Allocate memory for cursor.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for cursor."));
+		return NULL;
+	}
+	memset(cursor, 0, sizeof(pxcursor_t));
+	if(NULL == (cursor->buffer = pxdoc->malloc(pxdoc, pxh->px_maxtablesize*0x400, _("Allocate memory for data block of cursor.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for data block of cursor."));
+		pxdoc->free(pxdoc, cursor);
+		return NULL;
+	}
+	cursor->pxdoc = pxdoc;
+	cursor->deleted = deleted;
+	cursor->next = pxh->px_firstblock;
+	return(cursor);
+}
+/* }}} */
+
+/* PX_cursor_next() {{{
+ * Returns the next record of the cursor. The record is not copied but
+ * points into the data block read by the cursor. It is valid until
+ * the next call of PX_cursor_next() or PX_cursor_close().
+ * *deleted is set to 1 if the record is deleted, otherwise to 0.
+ * Returns NULL if there are no more records or in case of an error.
+ * cursor->error is set if a data block could not be read.
+ */
+PXLIB_API char * PXLIB_CALL
+PX_cursor_next(pxcursor_t *cursor, int *deleted) {
+	pxdoc_t *pxdoc;
+	pxhead_t *pxh;
+
+	if(cursor == NULL) {
+		return NULL;
+	}
+	pxdoc = cursor->pxdoc;
+	pxh = pxdoc->px_head;
+
+	/* Read the next data block until one with records is found */
+	while(cursor->recno >= cursor->numrecords) {
+		TDataBlock *datablockhead;
+		int blocksize, recsperdatablock;
+		long blockpos;
+
+		cursor->record = NULL;
+		if(cursor->next <= 0 || cursor->blockcount >= (int)pxh->px_fileblocks)
+			return NULL;
+		cursor->blocknumber = cursor->next;
+		blockpos = pxh->px_headersize+(cursor->blocknumber-1)*pxh->px_maxtablesize*0x400;
+		/* Use the data of memory mapped files without copying it */
+		if(NULL == (cursor->block = (char *) px_stream_mapping(pxdoc, blockpos, pxh->px_maxtablesize*0x400))) {
+			cursor->block = cursor->buffer;
+			if(pxdoc->seek(pxdoc, pxdoc->px_stream, blockpos, SEEK_SET) < 0) {
+				px_error(pxdoc, PX_RuntimeError, _("Could not fseek start of data block nr. %d."), cursor->blocknumber);
+				cursor->error = 1;
+				return NULL;
+			}
+			if(pxdoc->read(pxdoc, pxdoc->px_stream, pxh->px_maxtablesize*0x400, cursor->block) < 1) {
+				px_error(pxdoc, PX_RuntimeError, _("Could not read data block nr. %d."), cursor->blocknumber);
+				cursor->error = 1;
+				return NULL;
 			}
-			fprintf(outfp, "%d", pxdbinfo.number);
 		}
-		if(markdeleted) {
-			fprintf(outfp, "%d", isdeleted);
+		cursor->blockcount++;
+
+		/* The size of the data in a block is negative if the block is
+		 * empty and larger than the block if it does not contain any
+		 * valid records.
+		 */
+		datablockhead = (TDataBlock *) cursor->block;
+		cursor->next = get_short_le((const char *) &datablockhead->nextBlock);
+		recsperdatablock = (pxh->px_maxtablesize*0x400-sizeof(TDataBlock)) / pxh->px_recordsize;
+		blocksize = get_short_le((const char *) &datablockhead->addDataSize);
+		if(blocksize > pxh->px_maxtablesize*0x400-(int)sizeof(TDataBlock)-pxh->px_recordsize)
+			cursor->validrecords = 0;
+		else
+			cursor->validrecords = blocksize/pxh->px_recordsize+1;
+		cursor->numrecords = cursor->deleted ? recsperdatablock : cursor->validrecords;
+		cursor->recno = 0;
+	}
+
+	if(deleted)
+		*deleted = (cursor->recno >= cursor->validrecords) ? 1 : 0;
+	cursor->record = cursor->block + sizeof(TDataBlock) + cursor->recno*pxh->px_recordsize;
+	cursor->recno++;
+	return(cursor->record);
+}
+/* }}} */
+
+/* PX_cursor_retrieve_record() {{{
+ * Converts the record returned last by PX_cursor_next() into an array
+ * of *pxval_t, just like PX_retrieve_record() does.
+ * Returns an array of *pxval_t or NULL in case of an error.
+ */
+PXLIB_API pxval_t ** PXLIB_CALL
+PX_cursor_retrieve_record(pxcursor_t *cursor) {
+	if(cursor == NULL) {
+		return NULL;
+	}
+	if(cursor->record == NULL) {
+		px_error(cursor->pxdoc, PX_RuntimeError, _("Cursor does not point to a record."));
+		return NULL;
+	}
+	return(px_retrieve_record_data(cursor->pxdoc, cursor->record, NULL));
+}
+/* }}} */
+
+/* PX_cursor_close() {{{
+ * Frees all memory used by the cursor.
+ */
+PXLIB_API void PXLIB_CALL
+PX_cursor_close(pxcursor_t *cursor) {
+	pxdoc_t *pxdoc;
+
+	if(cursor == NULL) {
+		return;
+	}
+	pxdoc = cursor->pxdoc;
+	if(cursor->buffer)
+		pxdoc->free(pxdoc, cursor->buffer);
+	pxdoc->free(pxdoc, cursor);
+}
+/* }}} */
+
+/* PX_record_new() {{{
+ * Creates a record which can be filled with the field values of any
+ * record of the database by PX_record_retrieve() or PX_record_decode().
+ * Strings and blobs are stored in memory owned by the record, which is
+ * reused for the next record. Reading records this way does not
+ * allocate any memory once the record has seen the largest record.
+ * Returns a pointer to the record or NULL in case of an error.
+ */
+PXLIB_API pxrecord_t * PXLIB_CALL
+PX_record_new(pxdoc_t *pxdoc) {
+	pxhead_t *pxh;
+	pxrecord_t *record;
+	int i;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return NULL;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return NULL;
+	}
+	pxh = pxdoc->px_head;
+
+	if(NULL == (record = pxdoc->malloc(pxdoc, sizeof(pxrecord_t), _("Allocate memory for record.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for record."));
+		return NULL;
+	}
+	memset(record, 0, sizeof(pxrecord_t));
+	record->pxdoc = pxdoc;
+	if(NULL == (record->values = pxdoc->malloc(pxdoc, pxh->px_numfields*sizeof(pxval_t *), _("Allocate memory for array of pointers to field values.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for array of pointers to field values."));
+		pxdoc->free(pxdoc, record);
+		return NULL;
+	}
+	if(NULL == (record->valuemem = pxdoc->malloc(pxdoc, pxh->px_numfields*sizeof(pxval_t), _("Allocate memory for field values.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for field values."));
+		pxdoc->free(pxdoc, record->values);
+		pxdoc->free(pxdoc, record);
+		return NULL;
+	}
+	for(i=0; i<pxh->px_numfields; i++)
+		record->values[i] = &record->valuemem[i];
+	return(record);
+}
+/* }}} */
+
+/* PX_record_retrieve() {{{
+ * Reads the record with the given number into the record. The field
+ * values are valid until the record is filled again or deleted and
+ * must not be freed.
+ * Returns the array of *pxval_t of the record or NULL in case of an error.
+ */
+PXLIB_API pxval_t ** PXLIB_CALL
+PX_record_retrieve(pxrecord_t *record, int recno) {
+	pxdoc_t *pxdoc;
+	const char *data;
+	pxval_t **dataptr;
+	int deleted = 0;
+
+	if(record == NULL) {
+		return NULL;
+	}
+	pxdoc = record->pxdoc;
+
+	if(NULL == (data = PX_pin_record(pxdoc, recno, &deleted))) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not read data for record with number %d."), recno);
+		return NULL;
+	}
+	dataptr = PX_record_decode(record, data);
+	PX_unpin_record(pxdoc, data);
+	return(dataptr);
+}
+/* }}} */
+
+/* PX_record_decode() {{{
+ * Converts the raw data of a record, e.g. as returned by
+ * PX_cursor_next(), into the field values of the record.
+ * Returns the array of *pxval_t of the record or NULL in case of an error.
+ */
+PXLIB_API pxval_t ** PXLIB_CALL
+PX_record_decode(pxrecord_t *record, const char *data) {
+	if(record == NULL) {
+		return NULL;
+	}
+	if(px_record_reserve(record, data) < 0)
+		return NULL;
+	return(px_retrieve_record_data(record->pxdoc, (char *) data, record));
+}
+/* }}} */
+
+/* PX_record_delete() {{{
+ * Frees the record and the memory of its field values.
+ */
+PXLIB_API void PXLIB_CALL
+PX_record_delete(pxrecord_t *record) {
+	pxdoc_t *pxdoc;
+
+	if(record == NULL) {
+		return;
+	}
+	pxdoc = record->pxdoc;
+	if(record->arena)
+		pxdoc->free(pxdoc, record->arena);
+	pxdoc->free(pxdoc, record->valuemem);
+	pxdoc->free(pxdoc, record->values);
+	pxdoc->free(pxdoc, record);
+}
+/* }}} */
+
+/* PX_columns_new() {{{
+ * Creates columns for the given fields of the database, which can be
+ * filled with the values of a range of records by PX_columns_decode().
+ * fields is an array of numfields field numbers. If fields is NULL,
+ * a column is created for each field. Blobs cannot be decoded into
+ * columns.
+ * Returns a pointer to the columns or NULL in case of an error.
+ */
+PXLIB_API pxcolumns_t * PXLIB_CALL
+PX_columns_new(pxdoc_t *pxdoc, int *fields, int numfields) {
+	pxhead_t *pxh;
+	pxcolumns_t *columns;
+	int i;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return NULL;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return NULL;
+	}
+	pxh = pxdoc->px_head;
+
+	if(fields == NULL)
+		numfields = pxh->px_numfields;
+	if(numfields <= 0) {
+		px_error(pxdoc, PX_RuntimeError, _("At least one column must be decoded."));
+		return NULL;
+	}
+
+	if(NULL == (columns = pxdoc->malloc(pxdoc, sizeof(pxcolumns_t), _("Allocate memory for columns.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for columns."));
+		return NULL;
+	}
+	memset(columns, 0, sizeof(pxcolumns_t));
+	columns->pxdoc = pxdoc;
+	if(NULL == (columns->columns = pxdoc->malloc(pxdoc, numfields*sizeof(pxcolumn_t), _("Allocate memory for columns.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for columns."));
+		pxdoc->free(pxdoc, columns);
+		return NULL;
+	}
+	memset(columns->columns, 0, numfields*sizeof(pxcolumn_t));
+	columns->numcolumns = numfields;
+
+	for(i=0; i<numfields; i++) {
+		pxcolumn_t *column = &columns->columns[i];
+		int field = fields ? fields[i] : i;
+
+		if(field < 0 || field >= pxh->px_numfields) {
+			px_error(pxdoc, PX_RuntimeError, _("Field number %d is out of range."), field);
+			PX_columns_delete(columns);
+			return NULL;
+		}
+		column->field = field;
+		column->type = pxh->px_fields[field].px_ftype;
+		column->len = pxh->px_fields[field].px_flen;
+		column->offset = pxdoc->px_fieldoffsets[field];
+
+		switch(column->type) {
+			case pxfAlpha:
+			case pxfBCD:
+			case pxfBytes:
+			case pxfShort:
+			case pxfLogical:
+			case pxfLong:
+			case pxfDate:
+			case pxfTime:
+			case pxfAutoInc:
+			case pxfNumber:
+			case pxfCurrency:
+			case pxfTimestamp:
+				break;
+			default:
+				px_error(pxdoc, PX_RuntimeError, _("Field '%s' cannot be decoded into a column."), pxh->px_fields[field].px_fname);
+				PX_columns_delete(columns);
+				return NULL;
+		}
+	}
+	return(columns);
+}
+/* }}} */
+
+/* px_columns_grow() {{{
+ * Makes sure the columns have room for count records.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int
+px_columns_grow(pxcolumns_t *columns, int count) {
+	pxdoc_t *pxdoc = columns->pxdoc;
+	pxhead_t *pxh = pxdoc->px_head;
+	int i;
+
+	if(count > columns->size) {
+		char *buffer;
+
+		if(NULL == (buffer = pxdoc->realloc(pxdoc, columns->buffer, (size_t) count*pxh->px_recordsize, _("Allocate memory for records of columns.")))) {
+			px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for records of columns."));
+			return -1;
+		}
+		columns->buffer = buffer;
+	}
+
+	for(i=0; i<columns->numcolumns; i++) {
+		pxcolumn_t *column = &columns->columns[i];
+		size_t datasize;
+		void *mem;
+
+		if(count > columns->size) {
+			if(NULL == (mem = pxdoc->realloc(pxdoc, column->valid, (count+7)/8, _("Allocate memory for null values of column.")))) {
+				px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for null values of column."));
+				return -1;
+			}
+			column->valid = mem;
+		}
+
+		switch(column->type) {
+			case pxfShort:
+			case pxfLogical:
+				if(count > columns->size) {
+					if(NULL == (mem = pxdoc->realloc(pxdoc, column->svals, count*sizeof(short int), _("Allocate memory for values of column.")))) {
+						px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for values of column."));
+						return -1;
+					}
+					column->svals = mem;
+				}
+				break;
+			case pxfLong:
+			case pxfDate:
+			case pxfTime:
+			case pxfAutoInc:
+				if(count > columns->size) {
+					if(NULL == (mem = pxdoc->realloc(pxdoc, column->lvals, count*sizeof(int), _("Allocate memory for values of column.")))) {
+						px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for values of column."));
+						return -1;
+					}
+					column->lvals = mem;
+				}
+				break;
+			case pxfNumber:
+			case pxfCurrency:
+			case pxfTimestamp:
+				if(count > columns->size) {
+					if(NULL == (mem = pxdoc->realloc(pxdoc, column->dvals, count*sizeof(double), _("Allocate memory for values of column.")))) {
+						px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for values of column."));
+						return -1;
+					}
+					column->dvals = mem;
+				}
+				break;
+			case pxfAlpha:
+			case pxfBCD:
+			case pxfBytes:
+				if(count > columns->size) {
+					if(NULL == (mem = pxdoc->realloc(pxdoc, column->offsets, (count+1)*sizeof(int), _("Allocate memory for offsets of column.")))) {
+						px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for offsets of column."));
+						return -1;
+					}
+					column->offsets = mem;
+				}
+				/* The space needed for strings depends on the target encoding,
+				 * which may change at any time.
+				 */
+				if(column->type == pxfAlpha)
+					datasize = (size_t) count*px_alpha_buffer_size(pxdoc, column->len);
+				else if(column->type == pxfBCD)
+					datasize = (size_t) count*PX_BCD_BUFFER_SIZE;
+				else
+					datasize = (size_t) count*column->len;
+				if(datasize > column->datasize) {
+					if(NULL == (mem = pxdoc->realloc(pxdoc, column->data, datasize, _("Allocate memory for data of column.")))) {
+						px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for data of column."));
+						return -1;
+					}
+					column->data = mem;
+					column->datasize = datasize;
+				}
+				break;
+		}
+	}
+	if(count > columns->size)
+		columns->size = count;
+	return 0;
+}
+/* }}} */
+
+/* px_column_decode() {{{
+ * Decodes the values of one column from count records stored one
+ * after the other in data. Numbers are stored with their sign bit
+ * flipped and are null if all bytes are zero. They are decoded by the
+ * vectorized decoders in px_column.c.
+ */
+static void
+px_column_decode(pxdoc_t *pxdoc, pxcolumn_t *column, const char *data, int recordsize, int count) {
+	const unsigned char *d;
+	char decimalpoint;
+	int i, pos;
+
+	memset(column->valid, 0, (count+7)/8);
+	d = (const unsigned char *) data + column->offset;
+	switch(column->type) {
+		case pxfShort:
+			px_decode_short_column(d, recordsize, count, column->svals, column->valid);
+			break;
+		case pxfLogical:
+			for(i=0; i<count; i++, d+=recordsize) {
+				column->svals[i] = (signed char) (d[0] ^ 0x80);
+				if(d[0] != 0)
+					column->valid[i/8] |= 1 << (i%8);
+				else
+					column->svals[i] = 0;
+			}
+			break;
+		case pxfLong:
+		case pxfDate:
+		case pxfTime:
+		case pxfAutoInc:
+			px_decode_long_column(d, recordsize, count, column->lvals, column->valid);
+			break;
+		case pxfNumber:
+		case pxfCurrency:
+		case pxfTimestamp:
+			px_decode_double_column(d, recordsize, count, column->dvals, column->valid);
+			break;
+		case pxfAlpha:
+			pos = 0;
+			for(i=0; i<count; i++, d+=recordsize) {
+				column->offsets[i] = pos;
+				if(d[0] == '\0')
+					continue;
+				if(pxdoc->targetencoding != NULL) {
+					if(px_get_data_alpha_buffer(pxdoc, (char *) d, column->len, column->data+pos, px_alpha_buffer_size(pxdoc, column->len)) <= 0)
+						continue;
+					pos += (int) strlen(column->data+pos);
+				} else {
+					const unsigned char *end = memchr(d, '\0', column->len);
+					int len = end ? (int) (end-d) : column->len;
+					memcpy(column->data+pos, d, len);
+					pos += len;
+				}
+				column->valid[i/8] |= 1 << (i%8);
+			}
+			column->offsets[count] = pos;
+			break;
+		case pxfBCD:
+			pos = 0;
+			decimalpoint = px_decimal_point();
+			for(i=0; i<count; i++, d+=recordsize) {
+				column->offsets[i] = pos;
+				if(d[0] == '\0')
+					continue;
+				if(px_get_data_bcd_buffer((unsigned char *) d, pxdoc->px_head->px_fields[column->field].px_fdc, column->data+pos, decimalpoint) < 0)
+					continue;
+				pos += (int) strlen(column->data+pos);
+				column->valid[i/8] |= 1 << (i%8);
+			}
+			column->offsets[count] = pos;
+			break;
+		case pxfBytes:
+			pos = 0;
+			for(i=0; i<count; i++, d+=recordsize) {
+				column->offsets[i] = pos;
+				if(d[0] == '\0')
+					continue;
+				memcpy(column->data+pos, d, column->len);
+				pos += column->len;
+				column->valid[i/8] |= 1 << (i%8);
+			}
+			column->offsets[count] = pos;
+			break;
+	}
+}
+/* }}} */
+
+/* PX_columns_decode() {{{
+ * Reads count records starting at record first and decodes the
+ * values of all columns. The values of a column are stored in arrays
+ * of the column which are valid until the next call.
+ * Returns the number of records decoded or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_columns_decode(pxcolumns_t *columns, int first, int count) {
+	pxdoc_t *pxdoc;
+	int i;
+
+	if(columns == NULL) {
+		return -1;
+	}
+	pxdoc = columns->pxdoc;
+	columns->count = 0;
+	if(count < 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Record number out of range."));
+		return -1;
+	}
+
+	/* The arrays are allocated even if no record is decoded, because
+	 * the end offset of strings is always stored */
+	if(px_columns_grow(columns, max(count, 1)) < 0)
+		return -1;
+	if(PX_get_records(pxdoc, first, count, columns->buffer, NULL) < 0)
+		return -1;
+	for(i=0; i<columns->numcolumns; i++)
+		px_column_decode(pxdoc, &columns->columns[i], columns->buffer, pxdoc->px_head->px_recordsize, count);
+	columns->count = count;
+	return(count);
+}
+/* }}} */
+
+/* PX_columns_delete() {{{
+ * Frees the columns and their values.
+ */
+PXLIB_API void PXLIB_CALL
+PX_columns_delete(pxcolumns_t *columns) {
+	pxdoc_t *pxdoc;
+	int i;
+
+	if(columns == NULL) {
+		return;
+	}
+	pxdoc = columns->pxdoc;
+	for(i=0; i<columns->numcolumns; i++) {
+		pxcolumn_t *column = &columns->columns[i];
+		if(column->valid)
+			pxdoc->free(pxdoc, column->valid);
+		if(column->lvals)
+			pxdoc->free(pxdoc, column->lvals);
+		if(column->svals)
+			pxdoc->free(pxdoc, column->svals);
+		if(column->dvals)
+			pxdoc->free(pxdoc, column->dvals);
+		if(column->offsets)
+			pxdoc->free(pxdoc, column->offsets);
+		if(column->data)
+			pxdoc->free(pxdoc, column->data);
+	}
+	pxdoc->free(pxdoc, columns->columns);
+	if(columns->buffer)
+		pxdoc->free(pxdoc, columns->buffer);
+	pxdoc->free(pxdoc, columns);
+}
+/* }}} */
+
+/* PX_insert_record() {{{
+ * Add a record to the paradox file. The record is saved in the first
+ * free position found in the database. This doesn't have to be in
+ * the last block. If records has been deleted before, this function
+ * will try to reuse the space first, unless the insert policy is
+ * pxfInsertLastBlock. The block is taken from the map of blocks with
+ * free slots.
+ * Returns the record number starting from 0 or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_insert_record(pxdoc_t *pxdoc, pxval_t **dataptr) {
+	pxhead_t *pxh;
+	char *data;
+	int datablocknr;
+	int itmp, recno, newrecpos;
+	int update; /* Will be set by px_add_data_to_block() if an existing
+				   record is updated */
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return -1;
+	}
+	pxh = pxdoc->px_head;
+
+	if(pxdoc->px_bulkload != NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Database cannot be modified during a bulk load."));
+		return -1;
+	}
+
+	/* Check for a free record in the exiting file */
+	if(pxdoc->px_blockdir == NULL && pxh->px_fileblocks > 0) {
+		if(build_block_directory(pxdoc) < 0) {
+			px_error(pxdoc, PX_RuntimeError, _("Error while searching for free slot of new record."));
+			return -1;
+		}
+	}
+	datablocknr = px_freemap_find(pxdoc);
+
+	/* If not free space for the new record was found, then create a new block */
+	if(datablocknr == 0) {
+		pxpindex_t *pindex;
+
+		int after = pxh->px_lastblock;
+
+		datablocknr = put_px_datablock(pxdoc, pxh, after, pxdoc->px_stream);
+		if(datablocknr < 0) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not write new data block."));
+			return -1;
+		}
+		if(px_blockdir_add_block(pxdoc, datablocknr, after) < 0) {
+			return -1;
+		}
+		recno = 0;
+		/* Append the new block to the index */
+		if(px_indexdata_grow(pxdoc, pxdoc->px_indexdatalen+1) < 0) {
+			return -1;
+		}
+		pindex = pxdoc->px_indexdata;
+
+		pindex[pxdoc->px_indexdatalen].data = NULL;
+		pindex[pxdoc->px_indexdatalen].blocknumber = datablocknr;
+		pindex[pxdoc->px_indexdatalen].numrecords = 1;
+		pindex[pxdoc->px_indexdatalen].myblocknumber = 0;
+		pindex[pxdoc->px_indexdatalen].level = 1;
+
+		/* Append the new block to the record numbers of the index */
+		if(pxdoc->px_indexdir) {
+			pxblockdir_t *indexdir;
+			int j;
+
+			indexdir = pxdoc->px_indexdir;
+			j = pxdoc->px_indexdatalen;
+			indexdir[j].blocknumber = datablocknr;
+			indexdir[j].numrecords = 1;
+			indexdir[j].recno = j > 0 ? indexdir[j-1].recno + indexdir[j-1].numrecords : 0;
+			indexdir[j].prev = after;
+			indexdir[j].next = 0;
+			/* The block before the new one has a new successor. It is
+			 * usually the last entry of the index. */
+			if(j > 0 && indexdir[j-1].blocknumber == after) {
+				indexdir[j-1].prev = indexdir[j-1].next = -1;
+			} else {
+				for(j=0; j<pxdoc->px_indexdatalen; j++) {
+					if(indexdir[j].blocknumber == after)
+						indexdir[j].prev = indexdir[j].next = -1;
+				}
+			}
+		}
+		pxdoc->px_indexdatalen++;
+		newrecpos = pxh->px_numrecords;
+	} else {
+		pxblockdir_t *blockdir = &pxdoc->px_blockdir[pxdoc->px_blockdirmap[datablocknr-1]];
+		px_indexdir_add_records(pxdoc, datablocknr, 1);
+		recno = blockdir->numrecords;
+		newrecpos = blockdir->recno+recno;
+	}
+	/* The datablock number return by px_put_datablock() should be
+	 * the same as the calculated datablocknr after all datablocks
+	 * has been added.
+	 */
+
+	/* write data */
+	data = px_convert_data(pxdoc, dataptr);
+	itmp = px_add_data_to_block(pxdoc, pxh, datablocknr, recno, data, pxdoc->px_stream, &update);
+	pxdoc->free(pxdoc, data);
+	if(update == 1) {
+		px_error(pxdoc, PX_RuntimeError, _("Request for inserting a new record turned out to be an update of an exiting record. This should not happen."));
+		return -1;
+	}
+
+	/* The record number within the data block must be the same
+	 * as the calculated one.
+	 */
+	if(itmp < 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Error in writing record into data block."));
+		return -1;
+	}
+	px_blockdir_add_records(pxdoc, datablocknr, 1);
+	
+	pxh->px_numrecords++;
+	if(px_head_modified(pxdoc) < 0) {
+		return -1;
+	}
+	return(newrecpos);
+}
+/* }}} */
+
+/* Bulk loading {{{
+ *
+ * PX_bulk_begin(), PX_bulk_append() and PX_bulk_finish() add many
+ * records to the end of a database. Records are collected in a data
+ * block in memory, which is written with a single write once it is
+ * full. The block directory and the internal primary index are updated
+ * for each written block. The header of the file is written only once
+ * by PX_bulk_finish().
+ */
+struct px_bulkload {
+	char *block;           /* Data block being filled */
+	int blocknumber;       /* Number of that block */
+	int prev;              /* Number of the block before it */
+	int isnew;             /* Set if the block is not in the file yet */
+	int numrecords;        /* Number of records in the block */
+	int added;             /* Records added to the block and not yet
+	                        * counted in the header */
+	int linkprev;          /* Set if the block before the first new block
+	                        * must be linked to it */
+};
+/* }}} */
+
+/* px_bulk_write_block() {{{
+ * Writes the block being filled into the file and accounts its records.
+ * next is the number of the block following it or 0.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int
+px_bulk_write_block(pxdoc_t *pxdoc, int next) {
+	pxbulkload_t *bulk = pxdoc->px_bulkload;
+	pxhead_t *pxh = pxdoc->px_head;
+	TDataBlock *datablockhead = (TDataBlock *) bulk->block;
+
+	put_short_le((char *) &datablockhead->prevBlock, bulk->prev);
+	put_short_le((char *) &datablockhead->nextBlock, next);
+	put_short_le((char *) &datablockhead->addDataSize, (bulk->numrecords-1)*pxh->px_recordsize);
+	if(px_write_blocks(pxdoc, bulk->blocknumber, 1, (unsigned char *) bulk->block) < 0)
+		return -1;
+
+	/* The last block of the file before the bulk load was full */
+	if(bulk->linkprev) {
+		TDataBlock prevdatablockhead;
+		if(get_datablock_head(pxdoc, pxdoc->px_stream, bulk->prev, &prevdatablockhead) < 0) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not get head of data block nr. %d."), bulk->prev);
+			return -1;
+		}
+		put_short_le((char *) &prevdatablockhead.nextBlock, bulk->blocknumber);
+		if(put_datablock_head(pxdoc, pxdoc->px_stream, bulk->prev, &prevdatablockhead) < 0) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not update data block header before new block."));
+			return -1;
 		}
-*/
-		pxdoc->free(pxdoc, data);
-		return(dataptr);
+		bulk->linkprev = 0;
+	}
+
+	if(bulk->isnew) {
+		pxpindex_t *pindex;
+
+		pxh->px_fileblocks++;
+		if(bulk->prev == 0)
+			pxh->px_firstblock = bulk->blocknumber;
+		pxh->px_lastblock = bulk->blocknumber;
+		if(px_blockdir_add_block(pxdoc, bulk->blocknumber, bulk->prev) < 0)
+			return -1;
+		px_blockdir_add_records(pxdoc, bulk->blocknumber, bulk->added);
+
+		/* Append the block to the internal primary index. Its record
+		 * numbers are calculated again by PX_bulk_finish(). */
+		px_indexdir_free(pxdoc);
+		if(px_indexdata_grow(pxdoc, pxdoc->px_indexdatalen+1) < 0)
+			return -1;
+		pindex = (pxpindex_t *) pxdoc->px_indexdata + pxdoc->px_indexdatalen;
+		pindex->data = NULL;
+		pindex->blocknumber = bulk->blocknumber;
+		pindex->numrecords = bulk->numrecords;
+		pindex->myblocknumber = 0;
+		pindex->level = 1;
+		pxdoc->px_indexdatalen++;
 	} else {
-		px_error(pxdoc, PX_RuntimeError, _("Could not read data for record with number %d."), recno);
-		pxdoc->free(pxdoc, data);
-		return NULL;
+		px_blockdir_add_records(pxdoc, bulk->blocknumber, bulk->added);
+		px_indexdir_add_records(pxdoc, bulk->blocknumber, bulk->added);
 	}
+	pxh->px_numrecords += bulk->added;
+	bulk->added = 0;
+	return 0;
 }
 /* }}} */
 
-/* PX_insert_record() {{{
- * Add a record to the paradox file. The record is saved in the first
- * free position found in the database. This doesn't have to be in
- * the last block. If records has been deleted before, this function
- * will try to reuse the space first.
- * Returns the record number starting from 0 or -1 in case of an error.
+/* PX_bulk_begin() {{{
+ * Starts adding records with PX_bulk_append(). The first records fill
+ * the free space of the last data block, all other records go into new
+ * blocks at the end of the file. Free space in other blocks is not
+ * used. The records are not accessible before PX_bulk_finish() has
+ * been called. Inserting, updating and deleting records is refused in
+ * the meantime.
+ * Returns 0 on success or -1 in case of an error.
  */
 PXLIB_API int PXLIB_CALL
-PX_insert_record(pxdoc_t *pxdoc, pxval_t **dataptr) {
+PX_bulk_begin(pxdoc_t *pxdoc) {
 	pxhead_t *pxh;
-	pxdatablockinfo_t tmppxdbinfo;
-	char *data;
-	int datablocknr;
-	int itmp, found, recno, newrecpos;
-	int update; /* Will be set by px_add_data_to_block() if an existing
-				   record is updated */
+	pxbulkload_t *bulk;
+	int blocksize, recsperdatablock;
 
 	if(pxdoc == NULL) {
 		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
@@ -2134,81 +4116,156 @@ PX_insert_record(pxdoc_t *pxdoc, pxval_t **dataptr) {
 	}
 	pxh = pxdoc->px_head;
 
-	/* Check for a free record in the exiting file */
-	if(pxdoc->px_indexdata)
-		found = px_find_slot_with_index(pxdoc, &tmppxdbinfo);
-	else
-		found = px_find_slot(pxdoc, &tmppxdbinfo);
+	if(pxdoc->px_bulkload != NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Bulk load has already been started."));
+		return -1;
+	}
 
-	if(found < 0) {
-		px_error(pxdoc, PX_RuntimeError, _("Error while searching for free slot of new record."));
+	blocksize = pxh->px_maxtablesize*0x400;
+	recsperdatablock = (blocksize-sizeof(TDataBlock)) / pxh->px_recordsize;
+	if(NULL == (bulk = pxdoc->malloc(pxdoc, sizeof(pxbulkload_t), _("Allocate memory for bulk load.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for bulk load."));
+		return -1;
+	}
+	memset(bulk, 0, sizeof(pxbulkload_t));
+	if(NULL == (bulk->block = pxdoc->malloc(pxdoc, blocksize, _("Allocate memory for data block of bulk load.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for data block of bulk load."));
+		pxdoc->free(pxdoc, bulk);
 		return -1;
 	}
+	memset(bulk->block, 0, blocksize);
 
-	/* If not free space for the new record was found, then create a new block */
-	if(found == 0) {
-		pxpindex_t *pindex;
+	/* Continue in the last block if it has room for more records */
+	if(pxh->px_lastblock > 0) {
+		TDataBlock *datablockhead = (TDataBlock *) bulk->block;
+		int datasize;
 
-		datablocknr = put_px_datablock(pxdoc, pxh, pxh->px_lastblock, pxdoc->px_stream);
-		if(datablocknr < 0) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not write new data block."));
+		if(pxdoc->seek(pxdoc, pxdoc->px_stream, pxh->px_headersize+(pxh->px_lastblock-1)*blocksize, SEEK_SET) < 0 ||
+		   pxdoc->read(pxdoc, pxdoc->px_stream, blocksize, bulk->block) < 1) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not read data block nr. %d."), pxh->px_lastblock);
+			pxdoc->free(pxdoc, bulk->block);
+			pxdoc->free(pxdoc, bulk);
 			return -1;
 		}
-		recno = 0;
-		/* Rebuild the index */
-		/* Allocate memory for internal list of index entries */
-		if(NULL == (pindex = pxdoc->malloc(pxdoc, pxh->px_fileblocks*sizeof(pxpindex_t), _("Allocate memory for self build internal primary index.")))) {
-			px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for self build internal index."));
-			return -1;
+		datasize = get_short_le_s((const char *) &datablockhead->addDataSize);
+		bulk->numrecords = datasize/pxh->px_recordsize + 1;
+		/* An empty last block is filled instead of appending one */
+		if(bulk->numrecords >= 0 && bulk->numrecords < recsperdatablock) {
+			bulk->blocknumber = pxh->px_lastblock;
+			bulk->prev = get_short_le((const char *) &datablockhead->prevBlock);
+			bulk->isnew = 0;
+		} else {
+			memset(bulk->block, 0, blocksize);
+			bulk->numrecords = 0;
+			bulk->blocknumber = pxh->px_fileblocks+1;
+			bulk->prev = pxh->px_lastblock;
+			bulk->isnew = 1;
+			bulk->linkprev = 1;
 		}
+	} else {
+		bulk->blocknumber = pxh->px_fileblocks+1;
+		bulk->prev = 0;
+		bulk->isnew = 1;
+	}
+	pxdoc->px_bulkload = bulk;
+	return 0;
+}
+/* }}} */
 
-		if(pxdoc->px_indexdata) {
-			memcpy(pindex, pxdoc->px_indexdata, pxdoc->px_indexdatalen*sizeof(pxpindex_t));
-			pxdoc->free(pxdoc, pxdoc->px_indexdata);
-		}
+/* PX_bulk_append() {{{
+ * Adds a record during a bulk load started with PX_bulk_begin().
+ * Returns the record number starting from 0 or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_bulk_append(pxdoc_t *pxdoc, pxval_t **dataptr) {
+	pxhead_t *pxh;
+	pxbulkload_t *bulk;
+	int recsperdatablock;
 
-		pxdoc->px_indexdata = pindex;
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
 
-		pindex[pxdoc->px_indexdatalen].data = NULL;
-		pindex[pxdoc->px_indexdatalen].blocknumber = datablocknr;
-		pindex[pxdoc->px_indexdatalen].numrecords = 1;
-		pindex[pxdoc->px_indexdatalen].myblocknumber = 0;
-		pindex[pxdoc->px_indexdatalen].level = 1;
-		pxdoc->px_indexdatalen++;
-		newrecpos = pxh->px_numrecords;
-	} else {
-		pxpindex_t *pindex;
-		pindex = pxdoc->px_indexdata;
-		datablocknr = tmppxdbinfo.number;
-		pindex[datablocknr-1].numrecords++;
-		recno = tmppxdbinfo.recno;
-		newrecpos = found-1;
+	if(NULL == (bulk = pxdoc->px_bulkload)) {
+		px_error(pxdoc, PX_RuntimeError, _("Bulk load has not been started."));
+		return -1;
 	}
-	/* The datablock number return by px_put_datablock() should be
-	 * the same as the calculated datablocknr after all datablocks
-	 * has been added.
-	 */
+	pxh = pxdoc->px_head;
 
-	/* write data */
-	data = px_convert_data(pxdoc, dataptr);
-	itmp = px_add_data_to_block(pxdoc, pxh, datablocknr, recno, data, pxdoc->px_stream, &update);
-	pxdoc->free(pxdoc, data);
-	if(update == 1) {
-		px_error(pxdoc, PX_RuntimeError, _("Request for inserting a new record turned out to be an update of an exiting record. This should not happen."));
+	/* Write the full block and start a new one */
+	recsperdatablock = (pxh->px_maxtablesize*0x400-sizeof(TDataBlock)) / pxh->px_recordsize;
+	if(bulk->numrecords >= recsperdatablock) {
+		int next = bulk->isnew ? bulk->blocknumber+1 : (int) pxh->px_fileblocks+1;
+		if(px_bulk_write_block(pxdoc, next) < 0)
+			return -1;
+		bulk->prev = bulk->blocknumber;
+		bulk->blocknumber = next;
+		bulk->isnew = 1;
+		bulk->numrecords = 0;
+		memset(bulk->block, 0, pxh->px_maxtablesize*0x400);
+	}
+
+	if(0 > px_encode_record(pxdoc, dataptr, bulk->block+sizeof(TDataBlock)+bulk->numrecords*pxh->px_recordsize)) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not convert record."));
+		memset(bulk->block+sizeof(TDataBlock)+bulk->numrecords*pxh->px_recordsize, 0, pxh->px_recordsize);
 		return -1;
 	}
+	bulk->numrecords++;
+	bulk->added++;
+	return(pxh->px_numrecords+bulk->added-1);
+}
+/* }}} */
 
-	/* The record number within the data block must be the same
-	 * as the calculated one.
-	 */
-	if(itmp < 0) {
-		px_error(pxdoc, PX_RuntimeError, _("Error in writing record into data block."));
+/* PX_bulk_finish() {{{
+ * Writes the last block of a bulk load and the header of the file.
+ * Returns 0 on success or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_bulk_finish(pxdoc_t *pxdoc) {
+	pxbulkload_t *bulk;
+	int ret = 0;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
 		return -1;
 	}
-	
-	pxh->px_numrecords++;
-	put_px_head(pxdoc, pxh, pxdoc->px_stream);
-	return(newrecpos);
+
+	if(NULL == (bulk = pxdoc->px_bulkload)) {
+		px_error(pxdoc, PX_RuntimeError, _("Bulk load has not been started."));
+		return -1;
+	}
+
+	if(bulk->added > 0) {
+		if(px_bulk_write_block(pxdoc, 0) < 0)
+			ret = -1;
+	} else if(bulk->isnew && bulk->prev > 0 && !bulk->linkprev) {
+		/* The block written last already points to the new block,
+		 * which will not be written, because no record could be added
+		 * to it. */
+		TDataBlock datablockhead;
+		if(get_datablock_head(pxdoc, pxdoc->px_stream, bulk->prev, &datablockhead) < 0) {
+			px_error(pxdoc, PX_RuntimeError, _("Could not get head of data block nr. %d."), bulk->prev);
+			ret = -1;
+		} else {
+			put_short_le((char *) &datablockhead.nextBlock, 0);
+			if(put_datablock_head(pxdoc, pxdoc->px_stream, bulk->prev, &datablockhead) < 0) {
+				px_error(pxdoc, PX_RuntimeError, _("Could not update data block header before new block."));
+				ret = -1;
+			}
+		}
+	}
+	if(pxdoc->px_indexdata != NULL && pxdoc->px_indexdir == NULL && px_indexdir_build(pxdoc) < 0)
+		ret = -1;
+	if(put_px_head(pxdoc, pxdoc->px_head, pxdoc->px_stream) < 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Unable to write file header."));
+		ret = -1;
+	}
+
+	pxdoc->free(pxdoc, bulk->block);
+	pxdoc->free(pxdoc, bulk);
+	pxdoc->px_bulkload = NULL;
+	return(ret);
 }
 /* }}} */
 
@@ -2343,12 +4400,17 @@ PX_update_record(pxdoc_t *pxdoc, pxval_t **dataptr, int recno) {
 	}
 	pxh = pxdoc->px_head;
 
+	if(pxdoc->px_bulkload != NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Database cannot be modified during a bulk load."));
+		return -1;
+	}
+
 	if((recno < 0) || (recno >= pxh->px_numrecords)) {
 		px_error(pxdoc, PX_RuntimeError, _("Record number out of range."));
 		return -1;
 	}
 
-	if(pxdoc->px_indexdata)
+	if(pxdoc->px_pindex)
 		found = px_get_record_pos_with_index(pxdoc, recno, &deleted, &tmppxdbinfo);
 	else
 		found = px_get_record_pos(pxdoc, recno, &deleted, &tmppxdbinfo);
@@ -2405,6 +4467,11 @@ PX_delete_record(pxdoc_t *pxdoc, int recno) {
 		return -1;
 	}
 	pxh = pxdoc->px_head;
+
+	if(pxdoc->px_bulkload != NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Database cannot be modified during a bulk load."));
+		return -1;
+	}
 	pxs = pxdoc->px_stream;
 	pxblob = pxdoc->px_blob;
 
@@ -2413,7 +4480,7 @@ PX_delete_record(pxdoc_t *pxdoc, int recno) {
 		return -1;
 	}
 
-	if(pxdoc->px_indexdata)
+	if(pxdoc->px_pindex)
 		found = px_get_record_pos_with_index(pxdoc, recno, &deleted, &tmppxdbinfo);
 	else
 		found = px_get_record_pos(pxdoc, recno, &deleted, &tmppxdbinfo);
@@ -2435,14 +4502,16 @@ PX_delete_record(pxdoc_t *pxdoc, int recno) {
 		ret = px_delete_data_from_block(pxdoc, pxh, datablocknr, tmppxdbinfo.recno, pxdoc->px_stream);
 		if(ret >= 0) {
 			pxh->px_numrecords--;
-			put_px_head(pxdoc, pxh, pxdoc->px_stream);
+			px_blockdir_add_records(pxdoc, datablocknr, -1);
 
 			/* Update the primary index */
 			if(pxdoc->px_indexdata) {
-				pxpindex_t *pindex = pxdoc->px_indexdata;
-				pindex[datablocknr-1].numrecords = ret;
+				px_indexdir_add_records(pxdoc, datablocknr, -1);
 			}
 
+			if(px_head_modified(pxdoc) < 0) {
+				return -1;
+			}
 		} else {
 			px_error(pxdoc, PX_RuntimeError, _("Error while deleting record data. Error number %d."), ret);
 		}
@@ -2454,21 +4523,90 @@ PX_delete_record(pxdoc_t *pxdoc, int recno) {
 }
 /* }}} */
 
+/* Size of the buffers used by PX_pack() for reading and writing data
+ * blocks */
+#define PX_PACK_BUFFER_SIZE (1024*1024)
+
+/* px_pack_rescue() {{{
+ * Moves a data block, which has not been read by PX_pack() yet, behind
+ * the end of the file before its place is overwritten. The block
+ * directory is changed to point to the new place.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int px_pack_rescue(pxdoc_t *pxdoc, int blocknumber, int *endblock, unsigned char *buffer) {
+	int pos;
+
+	if(px_read_blocks(pxdoc, blocknumber, 1, buffer) < 0)
+		return -1;
+	(*endblock)++;
+	if(px_blockdir_grow(pxdoc, *endblock) < 0)
+		return -1;
+	if(px_write_blocks(pxdoc, *endblock, 1, buffer) < 0)
+		return -1;
+	pos = pxdoc->px_blockdirmap[blocknumber-1];
+	pxdoc->px_blockdir[pos].blocknumber = *endblock;
+	pxdoc->px_blockdirmap[*endblock-1] = pos;
+	pxdoc->px_blockdirmap[blocknumber-1] = -1;
+	return 0;
+}
+/* }}} */
+
+/* px_pack_write() {{{
+ * Writes n packed data blocks starting at block number first. Blocks
+ * of the chain at these places, which have not been read yet, are
+ * moved away before. nextunread is the position in the block directory
+ * of the first block not read yet.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int px_pack_write(pxdoc_t *pxdoc, int first, int n, unsigned char *blocks, int nextunread, int *endblock, unsigned char *buffer) {
+	int i;
+
+	for(i=first; i<first+n; i++) {
+		if(i <= pxdoc->px_blockdirsize && pxdoc->px_blockdirmap[i-1] >= nextunread) {
+			if(px_pack_rescue(pxdoc, i, endblock, buffer) < 0)
+				return -1;
+		}
+	}
+	return(px_write_blocks(pxdoc, first, n, blocks));
+}
+/* }}} */
+
+/* px_pack_finish_block() {{{
+ * Sets the header of the packed block with index k, which is stored
+ * as block number k+1. numblocks is the number of packed blocks.
+ */
+static void px_pack_finish_block(pxdoc_t *pxdoc, unsigned char *block, int k, int numblocks, int numrecords) {
+	TDataBlock *datablockhead = (TDataBlock *) block;
+
+	put_short_le((char *) &datablockhead->prevBlock, k);
+	put_short_le((char *) &datablockhead->nextBlock, k+1 < numblocks ? k+2 : 0);
+	put_short_le((char *) &datablockhead->addDataSize, (numrecords-1)*pxdoc->px_head->px_recordsize);
+}
+/* }}} */
+
 /* PX_pack() {{{
  * Packs database into the smallest possible file size by filling
  * all datablocks to its maximum number of records and deleting
  * empty datablocks.
+ * The records are moved forward in the order of the chain of data
+ * blocks, which are read and written in large pieces. The packed
+ * blocks are stored in the order of the chain at the start of the
+ * file, which is truncated behind the last one. Blocks at the start
+ * of the file which are already full are not touched. The block
+ * directory, the internal primary index and the header are built
+ * once at the end.
+ * Returns the number of bytes the file has been shrunk by or -1 in
+ * case of an error. Only files opened by name are shrunk, for other
+ * streams 0 is returned.
  */
 PXLIB_API int PXLIB_CALL
 PX_pack(pxdoc_t *pxdoc) {
 	pxhead_t *pxh;
-	pxstream_t *pxs;
-	pxpindex_t *pindex_data;
-	long blockpos, blockoutpos;
-	long recordpos, recordoutpos;
-	long blocknumber, blockoutnumber;
-	int recsperblock;
-	int i, j, n, jout, nout;
+	pxblockdir_t *blockdir;
+	unsigned char *inbuf, *outbuf, *buffer;
+	int blocksize, recsize, recsperblock, maxblocks;
+	int numrecords, numblocks, oldblocks, endblock, truncated;
+	int pos, start, n, i, outfirst, outblocks, outrecs, ret;
 
 	if(pxdoc == NULL) {
 		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
@@ -2480,40 +4618,193 @@ PX_pack(pxdoc_t *pxdoc) {
 		return -1;
 	}
 	pxh = pxdoc->px_head;
-	pxs = pxdoc->px_stream;
-	pindex_data = pxdoc->px_indexdata;
-	recsperblock = (pxh->px_maxtablesize*0x400-sizeof(TDataBlock)) / pxh->px_recordsize;
 
-	jout = 0;
-	nout = 0;
-	blockoutnumber = pindex_data[jout].blocknumber;
-	blockoutpos = pxh->px_headersize + (blockoutnumber-1)*pxh->px_maxtablesize*0x400;
-	for(j=0; j<pxdoc->px_indexdatalen; j++) {
-		if(pindex_data[j].level == 1) {
-			blocknumber = pindex_data[j].blocknumber;
-			blockpos = pxh->px_headersize + (blocknumber-1)*pxh->px_maxtablesize*0x400;
-			n = pindex_data[j].numrecords;
-			for(i=0; i<n; i++) {
-				recordpos = blockpos + sizeof(TDataBlock) + i*pxh->px_recordsize;
-				recordoutpos = blockoutpos + sizeof(TDataBlock) + nout*pxh->px_recordsize;
-				if(recordpos != recordoutpos)
-					fprintf(stdout, "copy record from 0x%lX (block %d) to 0x%lX (block %d)\n", recordpos, j, recordoutpos, jout);
-				nout++;
-				if(nout > recsperblock) {
-					jout++;
-					nout = 0;
-					blockoutnumber = pindex_data[jout].blocknumber;
-					blockoutpos = pxh->px_headersize + (blockoutnumber-1)*pxh->px_maxtablesize*0x400;
+	if(pxdoc->px_bulkload != NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Database cannot be packed during a bulk load."));
+		return -1;
+	}
+
+	if(pxdoc->px_pindex != NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Database cannot be packed while a primary index file is used."));
+		return -1;
+	}
+
+	if(pxdoc->px_stream->type == pxfIOMmap || pxdoc->px_cachepinned > 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Database cannot be packed while it is mapped into memory or records are pinned."));
+		return -1;
+	}
+
+	if(pxdoc->px_blockdir == NULL && pxh->px_fileblocks > 0) {
+		if(build_block_directory(pxdoc) < 0) {
+			return -1;
+		}
+	}
+
+	blocksize = pxh->px_maxtablesize*0x400;
+	recsize = pxh->px_recordsize;
+	recsperblock = (blocksize-(int)sizeof(TDataBlock)) / recsize;
+
+	numrecords = 0;
+	oldblocks = pxh->px_fileblocks;
+	endblock = oldblocks;
+	blockdir = pxdoc->px_blockdir;
+	for(pos=0; pos<pxdoc->px_blockdirlen; pos++) {
+		numrecords += blockdir[pos].numrecords;
+		endblock = max(endblock, blockdir[pos].blocknumber);
+	}
+	numblocks = (numrecords+recsperblock-1) / recsperblock;
+
+	/* Full blocks at the start of the file, which are already linked
+	 * in the right order, stay where they are */
+	for(pos=0; pos<pxdoc->px_blockdirlen; pos++) {
+		if(blockdir[pos].blocknumber != pos+1 ||
+		   blockdir[pos].numrecords != recsperblock ||
+		   blockdir[pos].prev != pos ||
+		   blockdir[pos].next != (pos+1 < numblocks ? pos+2 : 0))
+			break;
+	}
+	if(pos == pxdoc->px_blockdirlen && numblocks == oldblocks)
+		return 0;
+
+	px_prefetch_stop(pxdoc);
+	if(px_flush(pxdoc, pxdoc->px_stream) < 0)
+		return -1;
+
+	maxblocks = max(PX_PACK_BUFFER_SIZE/blocksize, 1);
+	inbuf = pxdoc->malloc(pxdoc, maxblocks*blocksize, _("Allocate memory for reading data blocks."));
+	outbuf = pxdoc->malloc(pxdoc, maxblocks*blocksize, _("Allocate memory for writing data blocks."));
+	buffer = pxdoc->malloc(pxdoc, blocksize, _("Allocate memory for moving a data block."));
+	if(inbuf == NULL || outbuf == NULL || buffer == NULL) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for packing the database."));
+		if(inbuf)
+			pxdoc->free(pxdoc, inbuf);
+		if(outbuf)
+			pxdoc->free(pxdoc, outbuf);
+		if(buffer)
+			pxdoc->free(pxdoc, buffer);
+		return -1;
+	}
+
+	/* Packed blocks are collected in outbuf and written as soon as it
+	 * is full. outfirst is the number of the first block in outbuf,
+	 * outblocks the number of complete blocks in it and outrecs the
+	 * number of records in the block being filled. */
+	ret = 0;
+	outfirst = pos+1;
+	outblocks = 0;
+	outrecs = 0;
+	memset(outbuf, 0, blocksize);
+	while(ret == 0 && pos < pxdoc->px_blockdirlen) {
+		/* Read adjacent blocks of the chain at once */
+		blockdir = pxdoc->px_blockdir;
+		start = pos;
+		n = 1;
+		while(n < maxblocks && start+n < pxdoc->px_blockdirlen &&
+		      blockdir[start+n].blocknumber == blockdir[start+n-1].blocknumber+1)
+			n++;
+		if(px_read_blocks(pxdoc, blockdir[start].blocknumber, n, inbuf) < 0) {
+			ret = -1;
+			break;
+		}
+		pos = start+n;
+
+		for(i=0; ret == 0 && i<n; i++) {
+			unsigned char *src = inbuf + i*blocksize + sizeof(TDataBlock);
+			int left = pxdoc->px_blockdir[start+i].numrecords;
+
+			while(left > 0) {
+				int m = left < recsperblock-outrecs ? left : recsperblock-outrecs;
+				memcpy(outbuf + outblocks*blocksize + sizeof(TDataBlock) + outrecs*recsize, src, m*recsize);
+				src += m*recsize;
+				left -= m;
+				outrecs += m;
+				if(outrecs < recsperblock)
+					continue;
+
+				px_pack_finish_block(pxdoc, outbuf + outblocks*blocksize, outfirst+outblocks-1, numblocks, outrecs);
+				outblocks++;
+				outrecs = 0;
+				if(outblocks == maxblocks) {
+					if(px_pack_write(pxdoc, outfirst, outblocks, outbuf, pos, &endblock, buffer) < 0) {
+						ret = -1;
+						break;
+					}
+					outfirst += outblocks;
+					outblocks = 0;
 				}
+				memset(outbuf + outblocks*blocksize, 0, blocksize);
 			}
 		}
 	}
-	if(nout == 0)
-		jout--;
-	if(pxdoc->px_indexdatalen > jout+1) {
-		for(i=jout; i<pxdoc->px_indexdatalen; i++) {
-			fprintf(stdout, "Block %d is empty\n", i);
-		}
+	if(ret == 0 && outrecs > 0) {
+		px_pack_finish_block(pxdoc, outbuf + outblocks*blocksize, outfirst+outblocks-1, numblocks, outrecs);
+		outblocks++;
+	}
+	if(ret == 0 && outblocks > 0)
+		ret = px_pack_write(pxdoc, outfirst, outblocks, outbuf, pos, &endblock, buffer);
+
+	pxdoc->free(pxdoc, inbuf);
+	pxdoc->free(pxdoc, outbuf);
+	pxdoc->free(pxdoc, buffer);
+
+	/* Blocks behind the packed ones are not used anymore */
+	truncated = 0;
+	if(ret == 0) {
+		pxh->px_fileblocks = numblocks;
+		pxh->px_firstblock = numblocks > 0 ? 1 : 0;
+		pxh->px_lastblock = numblocks;
+		if(px_stream_truncate(pxdoc->px_stream, pxh->px_headersize+(long)numblocks*blocksize) == 0)
+			truncated = 1;
+	}
+
+	/* The cache may contain blocks which have been moved */
+	px_cache_free(pxdoc);
+	px_blockdir_free(pxdoc);
+	if(build_primary_index(pxdoc) < 0)
+		return -1;
+	if(ret < 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not pack the database."));
+		return -1;
+	}
+	if(put_px_head(pxdoc, pxh, pxdoc->px_stream) < 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Unable to write file header."));
+		return -1;
+	}
+	return(truncated ? (oldblocks-numblocks)*blocksize : 0);
+}
+/* }}} */
+
+/* PX_flush() {{{
+ * Writes the header and all modified data blocks into the file.
+ * Modifications of the header are kept in memory until this function
+ * or PX_close() is called, unless a number of modifications was set
+ * with PX_set_value(pxdoc, "headerbatch", n).
+ * Returns 0 on success or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_flush(pxdoc_t *pxdoc) {
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return -1;
+	}
+
+	if(px_head_flush(pxdoc) < 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Unable to write file header."));
+		return -1;
+	}
+
+	if(px_flush(pxdoc, pxdoc->px_stream) < 0) {
+		return -1;
+	}
+
+	if(pxdoc->px_stream->type == pxfIOFile && pxdoc->px_stream->s.fp != NULL) {
+		fflush(pxdoc->px_stream->s.fp);
+		pxdoc->px_stream->dirty = px_false;
 	}
 	return 0;
 }
@@ -2530,6 +4821,17 @@ PX_close(pxdoc_t *pxdoc) {
 		return;
 	}
 
+	/* Records of an unfinished bulk load are written */
+	if(pxdoc->px_bulkload)
+		PX_bulk_finish(pxdoc);
+
+	/* Write the header if it was modified since it was written last */
+	if(pxdoc->px_head && pxdoc->px_stream)
+		px_head_flush(pxdoc);
+
+	/* The thread reading blocks ahead must not access the file anymore */
+	px_prefetch_stop(pxdoc);
+
 	/* Write modified cache block */
 	px_flush(pxdoc, pxdoc->px_stream);
 
@@ -2538,6 +4840,7 @@ PX_close(pxdoc_t *pxdoc) {
 		pxdoc->px_blob = NULL;
 	}
 
+	px_stream_unmap(pxdoc, pxdoc->px_stream);
 	if(pxdoc->px_stream && pxdoc->px_stream->close && (pxdoc->px_stream->s.fp != NULL)){
 		fclose(pxdoc->px_stream->s.fp);
 	}
@@ -2608,6 +4911,12 @@ PX_delete(pxdoc_t *pxdoc) {
 		}
 		pxdoc->free(pxdoc, pxdoc->px_head);
 	}
+	if(pxdoc->px_fieldoffsets)
+		pxdoc->free(pxdoc, pxdoc->px_fieldoffsets);
+	if(pxdoc->px_projection)
+		pxdoc->free(pxdoc, pxdoc->px_projection);
+	if(pxdoc->px_plan)
+		pxdoc->free(pxdoc, pxdoc->px_plan);
 	if(pxdoc->px_data) {
 		/* Free the data of the file. In case of an primary index file
 		 * this is the index data
@@ -2619,17 +4928,20 @@ PX_delete(pxdoc_t *pxdoc) {
 	/* px_indexdata will be set if the index was read from an index file
 	 * or build during PX_open_fp(). In the first case it is just a
 	 * pointer to pxdoc->px_index->px_data and should not be freed
-	 * because it is freed when the index file is deleted.
+	 * because it is freed when the index file is deleted, unless
+	 * px_indexdata_grow() has copied it.
 	 */
-	if(pxdoc->px_indexdata && !pxdoc->px_pindex) {
+	if(pxdoc->px_indexdata && pxdoc->px_indexdatasize > 0) {
 		pxdoc->free(pxdoc, pxdoc->px_indexdata);
 		pxdoc->px_indexdatalen = 0;
+		pxdoc->px_indexdatasize = 0;
 	}
 
 	/* Free the memory for the block cache */
-	if(pxdoc->curblock) {
-		pxdoc->free(pxdoc, pxdoc->curblock);
-	}
+	px_cache_free(pxdoc);
+
+	px_blockdir_free(pxdoc);
+	px_indexdir_free(pxdoc);
 
 	pxdoc->free(pxdoc, pxdoc);
 }
@@ -2747,12 +5059,12 @@ PX_get_recordsize(pxdoc_t *pxdoc) {
 
 /* PX_set_targetencoding() {{{
  * Sets the encoding of the output data. This is one of
- * the encodings supported by iconv or recode.
+ * the encodings supported by iconv or recode. UTF-8 is supported
+ * without them for the common DOS and Windows codepages.
  */
 PXLIB_API int PXLIB_CALL
 PX_set_targetencoding(pxdoc_t *pxdoc, const char *encoding) {
 	int codepage;
-#if PX_USE_RECODE || PX_USE_ICONV
 	if(pxdoc == NULL) {
 		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
 		return -1;
@@ -2772,13 +5084,17 @@ PX_set_targetencoding(pxdoc_t *pxdoc, const char *encoding) {
 	if(0 > px_set_targetencoding(pxdoc)) {
 		pxdoc->free(pxdoc, pxdoc->targetencoding);
 		pxdoc->targetencoding = NULL;
+#if PX_USE_RECODE || PX_USE_ICONV
 		px_error(pxdoc, PX_RuntimeError, _("Target encoding could not be set."));
 		return -1;
-	}
 #else
-	px_error(pxdoc, PX_RuntimeError, _("Library has not been compiled with support for reencoding."));
-	return -2;
+		px_error(pxdoc, PX_RuntimeError, _("Library has not been compiled with support for reencoding."));
+		return -2;
 #endif
+	}
+	/* Converted strings need more memory in a record */
+	if(px_compile_decode_plan(pxdoc) < 0)
+		return -1;
 	if(sscanf(encoding, "CP%d", &codepage)) {
 		PX_set_value(pxdoc, "codepage", (float)codepage);
 	}
@@ -2845,7 +5161,7 @@ PX_set_tablename(pxdoc_t *pxdoc, const char *tablename) {
 		pxdoc->free(pxdoc, pxdoc->px_head->px_tablename);
 
 	pxdoc->px_head->px_tablename = px_strdup(pxdoc, tablename);
-	if(put_px_head(pxdoc, pxdoc->px_head, pxdoc->px_stream) < 0) {
+	if(px_head_modified(pxdoc) < 0) {
 		return -1;
 	}
 	return 0;
@@ -2982,6 +5298,8 @@ PX_open_blob_fp(pxblob_t *pxblob, FILE *fp) {
 	pxblob->seek = px_mb_seek;
 	pxblob->tell = px_mb_tell;
 	pxblob->write = px_mb_write;
+	pxblob->pread = px_mb_pread;
+	pxblob->extend = px_mb_extend;
 
 	if((pxblob->mb_head = get_mb_head(pxblob, pxs)) == NULL) {
 		px_error(pxdoc, PX_RuntimeError, _("Unable to get header of blob file."));
@@ -3046,6 +5364,8 @@ PX_create_blob_fp(pxblob_t *pxblob, FILE *fp) {
 	pxblob->seek = px_mb_seek;
 	pxblob->tell = px_mb_tell;
 	pxblob->write = px_mb_write;
+	pxblob->pread = px_mb_pread;
+	pxblob->extend = px_mb_extend;
 
 	if(NULL == (mbh = pxdoc->malloc(pxdoc, sizeof(mbhead_t), _("Allocate memory for header of blob file.")))) {
 		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for header of blob file."));
@@ -3293,13 +5613,8 @@ _px_read_blobdata(pxblob_t *pxblob, const char *data, int len, int hsize, int *m
 		}
 //		fprintf(stderr, "offset=%ld ", offset);
 
-		if((ret = pxblob->seek(pxblob, pxblob->mb_stream, (long)offset, SEEK_SET)) < 0) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not fseek start of blob."));
-			return NULL;
-		}
-
 		/* Just read the first 3 Bytes because they are common for all block */
-		if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, 3, head)) < 0) {
+		if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset, 3, head)) < 0) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not read head of blob data."));
 			return NULL;
 		}
@@ -3318,7 +5633,7 @@ _px_read_blobdata(pxblob_t *pxblob, const char *data, int len, int hsize, int *m
 				return NULL;
 			}
 			/* Read the remaining 6/14 bytes from the header */
-			if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, hsize-3, head)) < 0) {
+			if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+3, hsize-3, head)) < 0) {
 				px_error(pxdoc, PX_RuntimeError, _("Could not read remaining head of single data block."));
 				return NULL;
 			}
@@ -3335,23 +5650,18 @@ _px_read_blobdata(pxblob_t *pxblob, const char *data, int len, int hsize, int *m
 				return(NULL);
 			}
 
-			if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, *blobsize, blobdata)) < 0) {
+			if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+hsize, *blobsize, blobdata)) < 0) {
 				px_error(pxdoc, PX_RuntimeError, _("Could not read all blob data."));
 				return NULL;
 			}
 		} else if(head[0] == 3) { /* Reading data from a block type 3 */
 			/* Read the remaining 9 bytes from the header */
-			if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, 9, head)) < 0) {
+			if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+3, 9, head)) < 0) {
 				px_error(pxdoc, PX_RuntimeError, _("Could not read remaining head of suballocated block."));
 				return NULL;
 			}
-			/* Goto the blob pointer with the passed index */
-			if((ret = pxblob->seek(pxblob, pxblob->mb_stream, (long)offset+12+(long)index*5, SEEK_SET)) < 0) {
-				px_error(pxdoc, PX_RuntimeError, _("Could not fseek blob pointer."));
-				return NULL;
-			}
-			/* Read the blob pointer */
-			if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, 5, head)) < 0) {
+			/* Read the blob pointer with the passed index */
+			if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+12+(long)index*5, 5, head)) < 0) {
 				px_error(pxdoc, PX_RuntimeError, _("Could not read blob pointer."));
 				return NULL;
 			}
@@ -3363,12 +5673,8 @@ _px_read_blobdata(pxblob_t *pxblob, const char *data, int len, int hsize, int *m
 				px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for blob."));
 				return(NULL);
 			}
-			/* Goto the start of the blob */
-			if((ret = pxblob->seek(pxblob, pxblob->mb_stream, (long)offset+head[0]*16, SEEK_SET)) < 0) {
-				px_error(pxdoc, PX_RuntimeError, _("Could not fseek start of blob."));
-				return NULL;
-			}
-			if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, size, blobdata)) < 0) {
+			/* Read from the start of the blob */
+			if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+head[0]*16, size, blobdata)) < 0) {
 				px_error(pxdoc, PX_RuntimeError, _("Could not read all blob data."));
 				return NULL;
 			}
@@ -3398,74 +5704,105 @@ PX_read_graphicdata(pxblob_t *pxblob, const char *data, int len, int *mod, int *
 
 /******* Function to access record data ******/
 
-/* PX_get_data_alpha() {{{
- * Extracts an alpha field value from a data block
+/* px_alpha_buffer_size() {{{
+ * Returns the size of a buffer which can hold a string field of the
+ * given length after conversion into the target encoding including
+ * the terminating 0.
  */
-PXLIB_API int PXLIB_CALL
-PX_get_data_alpha(pxdoc_t *pxdoc, char *data, int len, char **value) {
-	char *buffer, *obuf = NULL;
-	size_t olen;
+static size_t
+px_alpha_buffer_size(pxdoc_t *pxdoc, int len) {
+	/* Worst case for length of output buffer. A character of a single
+	 * byte encoding takes up to 3 bytes in UTF-8.
+	 */
+	if(pxdoc->targetencoding != NULL)
+		return(4*len + 1);
+	return(len + 1);
+}
+/* }}} */
 
+/* px_get_data_alpha_buffer() {{{
+ * Extracts a string from a data block and converts it into the target
+ * encoding. The string is stored in buffer, which must have room for
+ * px_alpha_buffer_size() bytes.
+ * Returns 1 on success, 0 if the field is empty and -1 in case of
+ * an error.
+ */
+static int
+px_get_data_alpha_buffer(pxdoc_t *pxdoc, char *data, int len, char *buffer, size_t bufsize) {
 	if(data[0] == '\0') {
-		*value = NULL;
 		return 0;
 	}
 
-	if(pxdoc->targetencoding != NULL) {
+	if(pxdoc->px_cptable != NULL) {
+		px_codepage_to_utf8(pxdoc->px_cptable, data, len, buffer);
+	} else if(pxdoc->targetencoding != NULL) {
 #if PX_USE_RECODE
+		char *obuf = NULL;
+		size_t olen;
 		int oallocated = 0;
+		/* The memory allocated by recode_buffer_to_buffer() is requested
+		 * with malloc and must be freed with free.
+		 */
 		recode_buffer_to_buffer(pxdoc->out_recode_request, data, len, &obuf, &olen, &oallocated);
+		if(olen > bufsize-1)
+			olen = bufsize-1;
+		memcpy(buffer, obuf, olen);
+		buffer[olen] = '\0';
+		free(obuf);
 #else
 #if PX_USE_ICONV
-		size_t ilen;
+		size_t ilen, olen;
 		char *iptr, *optr;
-		int res;
-		/* Worst case for length of output buffer. If conversion from 1 byte
-		 * to 2 byte chars takes place
-		 */
-		olen = 2*len + 1;
-		/* Do not pxdoc->malloc because the memory is freed with free
-		 * We use free because the memory allocated by recode_buffer_to_buffer()
-		 * is requested with malloc and must be freed with free.
-		 */
-		optr = obuf = (char *) malloc(olen);
 		iptr = data;
 		ilen = 0;
-		while(iptr[ilen] != '\0' && ilen < (size_t) len)
-			ilen++;
-//		printf("data(%d) = '%s'\n", ilen, data);
-//		printf("obuf(%d) = '%s'\n", olen, obuf);
-		if(0 > (res = iconv(pxdoc->out_iconvcd, &iptr, &ilen, &optr, &olen))) {
-			*value = NULL;
-			free(obuf);
+		while(iptr[ilen] != '\0' && ilen < (size_t) len)
+			ilen++;
+		optr = buffer;
+		olen = bufsize-1;
+		if((size_t) -1 == iconv(pxdoc->out_iconvcd, &iptr, &ilen, &optr, &olen)) {
 			return -1;
 		}
 		*optr = '\0';
-//		printf("data(%d) = '%s'\n", ilen, data);
-//		printf("obuf(%d) = '%s'\n", olen, obuf);
-		olen = optr-obuf;
+#else
+		memcpy(buffer, data, len);
+		buffer[len] = '\0';
 #endif
 #endif
 	} else {
-		olen = len;
-		obuf = data;
+		memcpy(buffer, data, len);
+		buffer[len] = '\0';
+	}
+	return 1;
+}
+/* }}} */
+
+/* PX_get_data_alpha() {{{
+ * Extracts an alpha field value from a data block
+ */
+PXLIB_API int PXLIB_CALL
+PX_get_data_alpha(pxdoc_t *pxdoc, char *data, int len, char **value) {
+	char *buffer;
+	size_t bufsize;
+	int ret;
+
+	if(data[0] == '\0') {
+		*value = NULL;
+		return 0;
 	}
-	/* Copy the encoded string into memory which belongs to pxlib */
-	buffer = (char *) pxdoc->malloc(pxdoc, olen+1, _("Allocate memory for field data."));
+
+	/* Convert the string right into memory which belongs to pxlib */
+	bufsize = px_alpha_buffer_size(pxdoc, len);
+	buffer = (char *) pxdoc->malloc(pxdoc, bufsize, _("Allocate memory for field data."));
 	if(!buffer) {
-		if(pxdoc->targetencoding != NULL) {
-			free(obuf);
-		}
 		*value = NULL;
 		return -1;
 	}
-	memcpy(buffer, obuf, olen);
-	buffer[olen] = '\0';
-	*value = buffer;
-
-	if(pxdoc->targetencoding != NULL) {
-		free(obuf);
+	if(0 >= (ret = px_get_data_alpha_buffer(pxdoc, data, len, buffer, bufsize))) {
+		pxdoc->free(pxdoc, buffer);
+		*value = NULL;
+		return ret;
 	}
+	*value = buffer;
 
 	return 1;
 }
@@ -3575,83 +5912,189 @@ PX_get_data_byte(pxdoc_t *pxdoc, char *data, int len, char *value) {
 }
 /* }}} */
 
+/* px_decimal_point() {{{
+ * Returns the decimal point of the current locale.
+ */
+static char
+px_decimal_point(void) {
+#ifdef HAVE_LOCALE_H
+	struct lconv *lc = localeconv();
+	if(lc)
+		return(lc->decimal_point[0]);
+#endif
+	return('.');
+}
+/* }}} */
+
+/* px_get_data_bcd_buffer() {{{
+ * Converts a bcd number in a data block into a string which is stored
+ * in buffer. buffer must have room for PX_BCD_BUFFER_SIZE bytes.
+ * len is the number decimal numbers, which are separated from the
+ * integer part by decimalpoint.
+ * Returns 1 on success or -1 in case of an error.
+ */
+static int
+px_get_data_bcd_buffer(unsigned char *data, int len, char *buffer, char decimalpoint) {
+	char digits[32];
+	unsigned char mask;
+	int i, j, intdigits;
+
+	if((data[0] & 0x3f) != len) {
+		return -1;
+	}
+	/* The digits of negative numbers are inverted */
+	mask = (data[0] & 0x80) ? 0x00 : 0xFF;
+	for(i=0; i<16; i++) {
+		unsigned char c = data[i+1] ^ mask;
+		if((c >> 4) > 9 || (c & 0x0f) > 9)
+			return -1;
+		digits[2*i] = (char) ('0' + (c >> 4));
+		digits[2*i+1] = (char) ('0' + (c & 0x0f));
+	}
+
+	j = 0;
+	if(mask)
+		buffer[j++] = '-';
+	intdigits = len < 32 ? 32-len : 0;
+	for(i=0; i<intdigits && digits[i] == '0'; i++)
+		;
+	if(i == intdigits) {
+		buffer[j++] = '0';
+	} else {
+		memcpy(buffer+j, digits+i, intdigits-i);
+		j += intdigits-i;
+	}
+	buffer[j++] = decimalpoint;
+	memcpy(buffer+j, digits+intdigits, 32-intdigits);
+	j += 32-intdigits;
+	buffer[j] = '\0';
+
+	return 1;
+}
+/* }}} */
+
 /* PX_get_data_bcd() {{{
  * Extracts a bcd number in a data block
  * len is the number decimal numbers
  */
 PXLIB_API int PXLIB_CALL
 PX_get_data_bcd(pxdoc_t *pxdoc, unsigned char *data, int len, char **value) {
-	int i, j;
-	unsigned char sign;
-	unsigned char nibble;
-	int size;
-	int lz;   /* 1 as long as leading zeros are found */
 	char *buffer;
 
 	if(data[0] == '\0') {
 		*value = NULL;
 		return 0;
 	}
-	buffer = (char *) pxdoc->malloc(pxdoc, 34+3, _("Allocate memory for field data."));
+	buffer = (char *) pxdoc->malloc(pxdoc, PX_BCD_BUFFER_SIZE, _("Allocate memory for field data."));
 	if(!buffer) {
 		*value = NULL;
 		return -1;
 	}
 
-	j = 0;
-	if(data[0] & 0x80) {
-		sign = 0x00;
-	} else  {
-		buffer[j++] = '-';
-		sign = 0x0F;
-	}
-	size = data[0] & 0x3f;
-	if(size != len) {
+	if(px_get_data_bcd_buffer(data, len, buffer, px_decimal_point()) < 0) {
+		pxdoc->free(pxdoc, buffer);
 		*value = NULL;
 		return -1;
 	}
-	lz = 1;
-	for(i=2; i<34-size; i++) {
-		if(i%2)
-			nibble = data[i/2] & 0x0f;
-		else
-			nibble = (data[i/2] >> 4) & 0x0f;
-		if(lz && (nibble^sign))
-			lz = 0;
-		if(lz == 0)
-			buffer[j++] = (nibble^sign)+48;
+	*value = buffer;
+
+	return 1;
+}
+/* }}} */
+
+/* PX_get_data_bcd_int64() {{{
+ * Extracts a bcd number in a data block as an integer, which is the
+ * number multiplied by 10^len. len is the number decimal numbers.
+ * Returns 1 on success, 0 if the value is null, -1 if it is invalid
+ * and -2 if it does not fit into 64 bits.
+ */
+PXLIB_API int PXLIB_CALL
+PX_get_data_bcd_int64(pxdoc_t *pxdoc, unsigned char *data, int len, long long *value) {
+	unsigned long long high, low;
+	int negative, ret;
+
+	*value = 0;
+	if(len > 32) {
+		return -1;
 	}
-	if(lz)
-		buffer[j++] = '0';
-#ifdef HAVE_LOCALE_H
-	struct lconv *lc = localeconv();
-	if(lc)
-		buffer[j++] = lc->decimal_point[0];
-	else
-#endif
-		buffer[j++] = '.';
-	for(; i<34; i++) {
-		if(i%2)
-			nibble = data[i/2] & 0x0f;
-		else
-			nibble = (data[i/2] >> 4) & 0x0f;
-		buffer[j++] = (nibble^sign)+48;
+	if(0 >= (ret = px_decode_bcd_digits(data, len, &high, &low, &negative))) {
+		return ret;
 	}
-	buffer[j] = '\0';
-	*value = buffer;
+	if(px_bcd_to_int64(high, low, negative, value) < 0) {
+		return -2;
+	}
+	return 1;
+}
+/* }}} */
 
+#ifdef PX_HAVE_INT128
+/* PX_get_data_bcd_int128() {{{
+ * Extracts a bcd number in a data block like PX_get_data_bcd_int64()
+ * does, but into a 128 bit integer, which can hold all 32 digits.
+ * Returns 1 on success, 0 if the value is null and -1 if it is invalid.
+ */
+PXLIB_API int PXLIB_CALL
+PX_get_data_bcd_int128(pxdoc_t *pxdoc, unsigned char *data, int len, __int128 *value) {
+	unsigned long long high, low;
+	int negative, ret;
+
+	*value = 0;
+	if(len > 32) {
+		return -1;
+	}
+	if(0 >= (ret = px_decode_bcd_digits(data, len, &high, &low, &negative))) {
+		return ret;
+	}
+	*value = (__int128) high * 10000000000000000LL + (__int128) low;
+	if(negative)
+		*value = -*value;
 	return 1;
 }
 /* }}} */
+#endif
+
+/* PX_decode_bcd_column() {{{
+ * Decodes count bcd numbers with len decimal numbers, stored stride
+ * bytes apart, into integers like PX_get_data_bcd_int64() does. data
+ * usually points to a field in the first of several records read by
+ * PX_get_records(), and stride is the size of a record. Bit i%8 of
+ * valid[i/8] is set if value i is not null, so valid must have room for
+ * (count+7)/8 bytes.
+ * Returns the number of values which are not null but could not be
+ * decoded, or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_decode_bcd_column(pxdoc_t *pxdoc, const char *data, int stride, int count, int len, long long *values, unsigned char *valid) {
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
+
+	if(data == NULL || values == NULL || valid == NULL || count < 0) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass memory for decoding bcd numbers."));
+		return -1;
+	}
+
+	if(len > 32) {
+		px_error(pxdoc, PX_RuntimeError, _("Bcd numbers have at most 32 decimal numbers."));
+		return -1;
+	}
+
+	return(px_decode_bcd_column((const unsigned char *) data, stride, count, len, values, valid));
+}
+/* }}} */
 
 /* _px_get_data_blob() {{{
  * Reads data of blob or graphic into memory and returns a pointer to it.
  * The parameter hsize contains the length of the header right before
  * the blob/graphic in the .MB file. It is 17 Bytes for graphics and 9
  * for all other types of blobs (I'm not completely sure about OLE).
+ * If buffer is not NULL, the data is stored in buffer instead of newly
+ * allocated memory. It must have room for the size of the blob as
+ * stored in the record.
  */
 static int
-_px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod, int *blobsize, char **value) {
+_px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod, int *blobsize, char **value, char *buffer) {
 	int ret;
 	char *blobdata = NULL;
 	unsigned char head[20];
@@ -3685,7 +6128,7 @@ _px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod
 
 	/* First check if the blob data is included in the record itself */
 	if(*blobsize <= leader) {
-		blobdata = pxdoc->malloc(pxdoc, *blobsize, _("Allocate memory for blob data."));
+		blobdata = buffer ? buffer : pxdoc->malloc(pxdoc, *blobsize, _("Allocate memory for blob data."));
 		if(!blobdata) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not allocate memory for blob data."));
 			*value = NULL;
@@ -3712,14 +6155,8 @@ _px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod
 	}
 //		fprintf(stderr, "offset=%ld ", offset);
 
-	if((ret = pxblob->seek(pxblob, pxblob->mb_stream, (long)offset, SEEK_SET)) < 0) {
-		px_error(pxdoc, PX_RuntimeError, _("Could not fseek start of blob."));
-		*value = NULL;
-		return -1;
-	}
-
 	/* Just read the first 3 Bytes because they are common for all block */
-	if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, 3, head)) < 0) {
+	if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset, 3, head)) < 0) {
 		px_error(pxdoc, PX_RuntimeError, _("Could not read head of blob data."));
 		*value = NULL;
 		return -1;
@@ -3742,7 +6179,7 @@ _px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod
 			return -1;
 		}
 		/* Read the remaining 6 bytes from the header */
-		if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, hsize-3, head)) < 0) {
+		if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+3, hsize-3, head)) < 0) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not read remaining head of single data block."));
 			*value = NULL;
 			return -1;
@@ -3756,34 +6193,29 @@ _px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod
 		 * was passed to PX_read_blobdata()
 		 */
 
-		blobdata = pxdoc->malloc(pxdoc, *blobsize, _("Allocate memory for blob data."));
+		blobdata = buffer ? buffer : pxdoc->malloc(pxdoc, *blobsize, _("Allocate memory for blob data."));
 		if(!blobdata) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not allocate memory for blob data."));
 			*value = NULL;
 			return -1;
 		}
 
-		if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, *blobsize, blobdata)) < 0) {
+		if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+hsize, *blobsize, blobdata)) < 0) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not read all blob data."));
 			*value = NULL;
-			pxdoc->free(pxdoc, blobdata);
+			if(blobdata != buffer)
+				pxdoc->free(pxdoc, blobdata);
 			return -1;
 		}
 	} else if(head[0] == 3) { /* Reading data from a block type 3 */
 		/* Read the remaining 9 bytes from the header */
-		if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, 9, head)) < 0) {
+		if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+3, 9, head)) < 0) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not read remaining head of suballocated block."));
 			*value = NULL;
 			return -1;
 		}
-		/* Goto the blob pointer with the passed index */
-		if((ret = pxblob->seek(pxblob, pxblob->mb_stream, (long)offset+12+(long)index*5, SEEK_SET)) < 0) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not fseek blob pointer."));
-			*value = NULL;
-			return -1;
-		}
-		/* Read the blob pointer */
-		if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, 5, head)) < 0) {
+		/* Read the blob pointer with the passed index */
+		if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+12+(long)index*5, 5, head)) < 0) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not read blob pointer."));
 			*value = NULL;
 			return -1;
@@ -3793,23 +6225,18 @@ _px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod
 			*value = NULL;
 			return -1;
 		}
-		blobdata = pxdoc->malloc(pxdoc, size, _("Allocate memory for blob data."));
+		blobdata = buffer ? buffer : pxdoc->malloc(pxdoc, size, _("Allocate memory for blob data."));
 		if(!blobdata) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not allocate memory for blob data."));
 			*value = NULL;
 			return -1;
 		}
-		/* Goto the start of the blob */
-		if((ret = pxblob->seek(pxblob, pxblob->mb_stream, (long)offset+head[0]*16, SEEK_SET)) < 0) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not fseek start of blob."));
-			*value = NULL;
-			pxdoc->free(pxdoc, blobdata);
-			return -1;
-		}
-		if((ret = (int)pxblob->read(pxblob, pxblob->mb_stream, size, blobdata)) < 0) {
+		/* Read from the start of the blob */
+		if((ret = (int)pxblob->pread(pxblob, pxblob->mb_stream, (long)offset+head[0]*16, size, blobdata)) < 0) {
 			px_error(pxdoc, PX_RuntimeError, _("Could not read all blob data."));
 			*value = NULL;
-			pxdoc->free(pxdoc, blobdata);
+			if(blobdata != buffer)
+				pxdoc->free(pxdoc, blobdata);
 			return -1;
 		}
 	}
@@ -3824,7 +6251,7 @@ _px_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int hsize, int *mod
  */
 PXLIB_API int PXLIB_CALL
 PX_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int *mod, int *blobsize, char **value) {
-	return(_px_get_data_blob(pxdoc, data, len, 9, mod, blobsize, value));
+	return(_px_get_data_blob(pxdoc, data, len, 9, mod, blobsize, value, NULL));
 }
 /* }}} */
 
@@ -3833,7 +6260,7 @@ PX_get_data_blob(pxdoc_t *pxdoc, const char *data, int len, int *mod, int *blobs
  */
 PXLIB_API int PXLIB_CALL
 PX_get_data_graphic(pxdoc_t *pxdoc, const char *data, int len, int *mod, int *blobsize, char **value) {
-	return(_px_get_data_blob(pxdoc, data, len, 17, mod, blobsize, value));
+	return(_px_get_data_blob(pxdoc, data, len, 17, mod, blobsize, value, NULL));
 }
 /* }}} */
 
@@ -4122,7 +6549,6 @@ _px_put_data_blob(pxdoc_t *pxdoc, const char *data, int len, char *value, int va
 			/* Do we have subblock already? Does the block have enough space? */
 			if(pxblob->subblockoffset == 0 || (pxblob->subblockblobcount > 63) || ((pxblob->subblockfree*16) < valuelen)) {
 				TMbBlockHeader3 mbbh;
-				int i, nullint=0;
 
 				if(pxblob->seek(pxblob, pxs, (pxblob->used_datablocks+1)*4096, SEEK_SET) < 0) {
 					px_error(pxdoc, PX_RuntimeError, _("Could not go to the beginning of the first free block in the blob file."));
@@ -4137,11 +6563,9 @@ _px_put_data_blob(pxdoc_t *pxdoc, const char *data, int len, char *value, int va
 					px_error(pxdoc, PX_RuntimeError, _("Could not write header of blob data to file."));
 					return -1;
 				}
-				for(i=0; i<4096-sizeof(TMbBlockHeader3); i++) {
-					if(pxblob->write(pxblob, pxs, 1, &nullint) < 1) {
-						px_error(pxdoc, PX_RuntimeError, _("Could not write remaining of a type 3 block."));
-						return -1;
-					}
+				if(pxblob->extend(pxblob, pxs, 4096-sizeof(TMbBlockHeader3)) < (ssize_t) (4096-sizeof(TMbBlockHeader3))) {
+					px_error(pxdoc, PX_RuntimeError, _("Could not write remaining of a type 3 block."));
+					return -1;
 				}
 				pxblob->used_datablocks++;
 				pxblob->subblockoffset = pxblob->used_datablocks;
@@ -4291,175 +6715,419 @@ PX_make_timestamp(pxdoc_t *pxdoc, int year, int month, int day, int hour, int mi
 /* }}} */
 
 #define isleap(year) ((((year) % 4) == 0 && ((year) % 100) != 0) || ((year) % 400)==0)
-/* PX_timestamp2string() {{{
- * Converts a timestamp as stored in the paradox database into
- * a string as specified by the format string.
+
+static const short px_daysbeforemonth[12] = {
+	0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+};
+
+static const char px_daysofmonth[12] = {
+	31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+};
+
+/* PX_dateformat_new() {{{
+ * Parses a format for dates, times and timestamps once, which can then
+ * be used by PX_dateformat_date(), PX_dateformat_time() and
+ * PX_dateformat_timestamp() for formatting any number of values. The
+ * characters of the format are explained in PX_timestamp2string().
+ * Returns a pointer to the format or NULL in case of an error.
  */
-PXLIB_API char * PXLIB_CALL
-PX_timestamp2string(pxdoc_t *pxdoc, double value, const char *format) {
-	char tmp_buff[32], *str;
-	int i, size=0;
-	struct tm ta;
-	int secs, days;
+PXLIB_API pxdateformat_t * PXLIB_CALL
+PX_dateformat_new(pxdoc_t *pxdoc, const char *format) {
+	pxdateformat_t *dateformat;
+	pxdateformatitem_t *item;
+	size_t formatlen, i;
+	int textlen;
 
-	value = value / 1000.0;
-	days = (int) (value / 86400);
-	secs = (int) fmod(value, 86400);
-	PX_SdnToGregorian(days+1721425, &ta.tm_year, &ta.tm_mon, &ta.tm_mday);
-	ta.tm_mon--;
-	ta.tm_hour = secs/3600;
-	ta.tm_min = secs/60%60;
-	ta.tm_sec = secs%60;
-
-	for (i = 0; i < strlen(format); i++) {
-		switch(format[i]) {
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return NULL;
+	}
+
+	if(format == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a format."));
+		return NULL;
+	}
+	formatlen = strlen(format);
+
+	if(NULL == (dateformat = pxdoc->malloc(pxdoc, sizeof(pxdateformat_t), _("Allocate memory for date format.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for date format."));
+		return NULL;
+	}
+	memset(dateformat, 0, sizeof(pxdateformat_t));
+	dateformat->pxdoc = pxdoc;
+	/* No month has been converted yet */
+	dateformat->firstday = 1;
+	dateformat->lastday = 0;
+	if(NULL == (dateformat->items = pxdoc->malloc(pxdoc, (formatlen+1)*sizeof(pxdateformatitem_t), _("Allocate memory for items of date format.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for items of date format."));
+		pxdoc->free(pxdoc, dateformat);
+		return NULL;
+	}
+	if(NULL == (dateformat->text = pxdoc->malloc(pxdoc, formatlen+1, _("Allocate memory for text of date format.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for text of date format."));
+		pxdoc->free(pxdoc, dateformat->items);
+		pxdoc->free(pxdoc, dateformat);
+		return NULL;
+	}
+
+	textlen = 0;
+	item = NULL;
+	for(i=0; i<formatlen; i++) {
+		char c = format[i];
+		int len = 0;
+
+		switch(c) {
 			case 'Y':       /* year, numeric, 4 digits */
-				size += 6;  /* Allow years to be 6 digits long */
+				len = 11; /* Any int */
+				dateformat->usesdate = 1;
 				break;
-			case 'y':		/* year, numeric, 2 digits */
-			case 'm':		/* month, numeric */
-			case 'n':		/* month, numeric, no leading zeroes */
-			case 'd':		/* day of the month, numeric */
-			case 'j':		/* day of the month, numeric, no leading zeros */
-			case 'H':		/* hour, numeric, 24 hour format */
-			case 'h':		/* hour, numeric, 12 hour format */
-			case 'G':		/* hour, numeric, 24 hour format, no leading zeroes */
-			case 'g':		/* hour, numeric, 12 hour format, no leading zeroes */
-			case 'i':		/* minutes, numeric */
-			case 's':		/* seconds, numeric */
-			case 'A':		/* AM/PM */
-			case 'a':		/* am/pm */
-			case 'S':		/* standard english suffix for the day of the month (e.g. 3rd, 2nd, etc) */
-				size += 2;
+			case 'y':       /* year, numeric, 2 digits */
+			case 'z':       /* day of the year, starting at 0 */
+				len = 3;
+				dateformat->usesdate = 1;
 				break;
-			case 'L':		/* boolean for leap year */
-				size++;
+			case 'm':       /* month, numeric */
+			case 'n':       /* month, numeric, no leading zeroes */
+			case 'd':       /* day of the month, numeric */
+			case 'j':       /* day of the month, numeric, no leading zeros */
+			case 'S':       /* standard english suffix for the day of the month */
+				len = 2;
+				dateformat->usesdate = 1;
 				break;
-			default:
-				size++;
+			case 'L':       /* boolean for leap year */
+				len = 1;
+				dateformat->usesdate = 1;
+				break;
+			case 'H':       /* hour, numeric, 24 hour format */
+			case 'h':       /* hour, numeric, 12 hour format */
+			case 'G':       /* hour, numeric, 24 hour format, no leading zeroes */
+			case 'g':       /* hour, numeric, 12 hour format, no leading zeroes */
+			case 'i':       /* minutes, numeric */
+			case 's':       /* seconds, numeric */
+				len = 3; /* Negative values have a sign */
+				break;
+			case 'A':       /* AM/PM */
+			case 'a':       /* am/pm */
+				len = 2;
+				break;
+			case '\\':
+				/* The next character is copied literally */
+				if(i == formatlen-1)
+					continue;
+				c = format[++i];
 				break;
+		}
 
+		if(len > 0) {
+			item = &dateformat->items[dateformat->numitems++];
+			item->conversion = c;
+			item->offset = 0;
+			item->len = 0;
+			dateformat->maxlen += len;
+			item = NULL;
+		} else {
+			/* Successive literal characters make up one item */
+			if(item == NULL) {
+				item = &dateformat->items[dateformat->numitems++];
+				item->conversion = 0;
+				item->offset = textlen;
+				item->len = 0;
+			}
+			dateformat->text[textlen++] = c;
+			item->len++;
+			dateformat->maxlen++;
 		}
 	}
-	if(NULL == (str = pxdoc->malloc(pxdoc, size+1, _("Allocate memory for timestamp string.")))) {
-		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for timestamp string."));
-		return NULL;
+	dateformat->text[textlen] = '\0';
+
+	return(dateformat);
+}
+/* }}} */
+
+/* px_dateformat_gregorian() {{{
+ * Converts a day number into a gregorian date. The month converted
+ * last is remembered, which saves the conversion of further days in
+ * the same month.
+ */
+static void
+px_dateformat_gregorian(pxdateformat_t *dateformat, long sdn, int *year, int *month, int *day) {
+	int days;
+
+	if(sdn >= dateformat->firstday && sdn <= dateformat->lastday) {
+		*year = dateformat->year;
+		*month = dateformat->month;
+		*day = (int) (sdn - dateformat->firstday) + 1;
+		return;
 	}
-	str[0] = '\0';
-	for (i = 0; i < strlen(format); i++) {
-		switch(format[i]) {
-			case '\\':
-				if (i < strlen(format) - 1) {
-					char ch[2];
-					ch[0] = format[++i];
-					ch[1] = '\0';
-					strcat(str, ch);
-				}
-			case 'Y':		/* year, numeric, 4 digits */
-				sprintf(tmp_buff, "%04d", ta.tm_year);  /* SAFE */
-				strcat(str, tmp_buff);
+
+	PX_SdnToGregorian(sdn, year, month, day);
+	/* Years before Christ have a different rule for leap years */
+	if(*year > 0) {
+		days = px_daysofmonth[*month-1];
+		if(*month == 2 && isleap(*year))
+			days++;
+		dateformat->firstday = sdn - *day + 1;
+		dateformat->lastday = dateformat->firstday + days - 1;
+		dateformat->year = *year;
+		dateformat->month = *month;
+	}
+}
+/* }}} */
+
+/* px_format_number() {{{
+ * Writes a number with at least width characters, filled with leading
+ * zeros like sprintf("%0*d") does.
+ * Returns a pointer to the character after the number.
+ */
+static char *
+px_format_number(char *ptr, int value, int width) {
+	char digits[12];
+	unsigned int u;
+	int n = 0;
+
+	if(value < 0) {
+		*ptr++ = '-';
+		width--;
+		u = 0U - (unsigned int) value;
+	} else {
+		u = (unsigned int) value;
+	}
+	do {
+		digits[n++] = (char) ('0' + u % 10);
+		u /= 10;
+	} while(u);
+	while(width-- > n)
+		*ptr++ = '0';
+	while(n > 0)
+		*ptr++ = digits[--n];
+	return(ptr);
+}
+/* }}} */
+
+/* px_dateformat_write() {{{
+ * Formats the day with number sdn and the seconds secs of that day.
+ * Returns the length of the string or -1 in case of an error.
+ */
+static int
+px_dateformat_write(pxdateformat_t *dateformat, long sdn, int secs, char *buffer, int len) {
+	char *ptr;
+	int i, year = 0, month = 0, day = 0, hour, minute, second, h;
+
+	if(buffer == NULL || len <= dateformat->maxlen) {
+		px_error(dateformat->pxdoc, PX_RuntimeError, _("Buffer for formatted date must have room for %d characters."), dateformat->maxlen+1);
+		return -1;
+	}
+
+	if(dateformat->usesdate)
+		px_dateformat_gregorian(dateformat, sdn, &year, &month, &day);
+	hour = secs/3600;
+	minute = secs/60%60;
+	second = secs%60;
+
+	ptr = buffer;
+	for(i=0; i<dateformat->numitems; i++) {
+		pxdateformatitem_t *item = &dateformat->items[i];
+		switch(item->conversion) {
+			case 0:
+				memcpy(ptr, dateformat->text+item->offset, item->len);
+				ptr += item->len;
+				break;
+			case 'Y':
+				ptr = px_format_number(ptr, year, 4);
 				break;
-			case 'z':		/* day (of the year) */
-				sprintf(tmp_buff, "%d", ta.tm_yday);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'z':
+				if(month > 0)
+					ptr = px_format_number(ptr, px_daysbeforemonth[month-1] + (month > 2 && isleap(year)) + day - 1, 1);
+				else
+					*ptr++ = '0';
 				break;
-			case 'y':		/* year, numeric, 2 digits */
-				sprintf(tmp_buff, "%02d", ((ta.tm_year)%100));  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'y':
+				ptr = px_format_number(ptr, year%100, 2);
 				break;
-			case 'm':		/* month, numeric */
-				sprintf(tmp_buff, "%02d", ta.tm_mon + 1);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'm':
+				ptr = px_format_number(ptr, month, 2);
 				break;
-			case 'n':      /* month, numeric, no leading zeros */
-				sprintf(tmp_buff, "%d", ta.tm_mon + 1);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'n':
+				ptr = px_format_number(ptr, month, 1);
 				break;
-			case 'd':		/* day of the month, numeric */
-				sprintf(tmp_buff, "%02d", ta.tm_mday);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'd':
+				ptr = px_format_number(ptr, day, 2);
 				break;
 			case 'j':
-				sprintf(tmp_buff, "%d", ta.tm_mday); /* SAFE */
-				strcat(str, tmp_buff);
+				ptr = px_format_number(ptr, day, 1);
 				break;
-			case 'H':		/* hour, numeric, 24 hour format */
-				sprintf(tmp_buff, "%02d", ta.tm_hour);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'H':
+				ptr = px_format_number(ptr, hour, 2);
 				break;
-			case 'h': {		/* hour, numeric, 12 hour format */
-				int h = ta.tm_hour % 12; if (h==0) h = 12;
-				sprintf(tmp_buff, "%02d", h);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'h':
+				h = hour % 12; if (h==0) h = 12;
+				ptr = px_format_number(ptr, h, 2);
 				break;
-			}
-			case 'G':      /* hour, numeric, 24 hour format, no leading zeros */
-				sprintf(tmp_buff, "%d", ta.tm_hour);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'G':
+				ptr = px_format_number(ptr, hour, 1);
 				break;
-			case 'g': {     /* hour, numeric, 12 hour format, no leading zeros */
-				int h = ta.tm_hour % 12; if (h==0) h = 12;
-				sprintf(tmp_buff, "%d", h);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'g':
+				h = hour % 12; if (h==0) h = 12;
+				ptr = px_format_number(ptr, h, 1);
 				break;
-			}
-			case 'i':		/* minutes, numeric */
-				sprintf(tmp_buff, "%02d", ta.tm_min);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 'i':
+				ptr = px_format_number(ptr, minute, 2);
 				break;
-			case 's':		/* seconds, numeric */
-				sprintf(tmp_buff, "%02d", ta.tm_sec);  /* SAFE */
-				strcat(str, tmp_buff);
+			case 's':
+				ptr = px_format_number(ptr, second, 2);
 				break;
-			case 'A':		/* AM/PM */
-				strcat(str, (ta.tm_hour >= 12 ? "PM" : "AM"));
+			case 'A':
+				*ptr++ = hour >= 12 ? 'P' : 'A';
+				*ptr++ = 'M';
 				break;
-			case 'a':		/* am/pm */
-				strcat(str, (ta.tm_hour >= 12 ? "pm" : "am"));
+			case 'a':
+				*ptr++ = hour >= 12 ? 'p' : 'a';
+				*ptr++ = 'm';
 				break;
-			case 'S':		/* standard english suffix, e.g. 2nd/3rd for the day of the month */
-				if (ta.tm_mday >= 10 && ta.tm_mday <= 19) {
-					strcat(str, "th");
-				} else {
-					switch (ta.tm_mday % 10) {
+			case 'S': {
+				const char *suffix = "th";
+				if (day < 10 || day > 19) {
+					switch (day % 10) {
 						case 1:
-							strcat(str, "st");
+							suffix = "st";
 							break;
 						case 2:
-							strcat(str, "nd");
+							suffix = "nd";
 							break;
 						case 3:
-							strcat(str, "rd");
-							break;
-						default:
-							strcat(str, "th");
+							suffix = "rd";
 							break;
 					}
 				}
+				*ptr++ = suffix[0];
+				*ptr++ = suffix[1];
 				break;
-			case 'L':		/* boolean for leapyear */
-				sprintf(tmp_buff, "%d", (isleap((ta.tm_year)) ? 1 : 0 ) );
-				strcat(str, tmp_buff);
-				break;
-			default: {
-				char ch[2];
-				ch[0] = format[i];
-				ch[1] = '\0';
-				strcat(str, ch);
 			}
+			case 'L':
+				*ptr++ = isleap(year) ? '1' : '0';
+				break;
 		}
 	}
+	*ptr = '\0';
+	return((int) (ptr - buffer));
+}
+/* }}} */
+
+/* PX_dateformat_timestamp() {{{
+ * Formats a timestamp as stored in the paradox database into buffer,
+ * which has room for len bytes. len must be greater than the maxlen
+ * member of the date format.
+ * Returns the length of the string or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_dateformat_timestamp(pxdateformat_t *dateformat, double value, char *buffer, int len) {
+	int secs, days;
+
+	if(dateformat == NULL) {
+		px_error(NULL, PX_RuntimeError, _("Did not pass a date format."));
+		return -1;
+	}
+
+	value = value / 1000.0;
+	days = (int) (value / 86400);
+	secs = (int) fmod(value, 86400);
+	return(px_dateformat_write(dateformat, days+1721425L, secs, buffer, len));
+}
+/* }}} */
+
+/* PX_dateformat_time() {{{
+ * Formats a time as stored in the paradox database into buffer like
+ * PX_dateformat_timestamp() does.
+ * Returns the length of the string or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_dateformat_time(pxdateformat_t *dateformat, long value, char *buffer, int len) {
+	if(dateformat == NULL) {
+		px_error(NULL, PX_RuntimeError, _("Did not pass a date format."));
+		return -1;
+	}
+
+	return(px_dateformat_write(dateformat, value/86400000L + 1721425L, (int) (value/1000 % 86400), buffer, len));
+}
+/* }}} */
+
+/* PX_dateformat_date() {{{
+ * Formats a date as stored in the paradox database into buffer like
+ * PX_dateformat_timestamp() does.
+ * Returns the length of the string or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_dateformat_date(pxdateformat_t *dateformat, long value, char *buffer, int len) {
+	if(dateformat == NULL) {
+		px_error(NULL, PX_RuntimeError, _("Did not pass a date format."));
+		return -1;
+	}
+
+	return(px_dateformat_write(dateformat, value + 1721425L, 0, buffer, len));
+}
+/* }}} */
+
+/* PX_dateformat_delete() {{{
+ * Frees a date format.
+ */
+PXLIB_API void PXLIB_CALL
+PX_dateformat_delete(pxdateformat_t *dateformat) {
+	pxdoc_t *pxdoc;
+
+	if(dateformat == NULL) {
+		return;
+	}
+	pxdoc = dateformat->pxdoc;
+	pxdoc->free(pxdoc, dateformat->text);
+	pxdoc->free(pxdoc, dateformat->items);
+	pxdoc->free(pxdoc, dateformat);
+}
+/* }}} */
+
+/* px_dateformat_string() {{{
+ * Formats the day with number sdn and the seconds secs of that day
+ * into a newly allocated string.
+ */
+static char *
+px_dateformat_string(pxdoc_t *pxdoc, const char *format, long sdn, int secs) {
+	pxdateformat_t *dateformat;
+	char *str;
+
+	if(NULL == (dateformat = PX_dateformat_new(pxdoc, format)))
+		return NULL;
+	if(NULL == (str = pxdoc->malloc(pxdoc, dateformat->maxlen+1, _("Allocate memory for timestamp string.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for timestamp string."));
+		PX_dateformat_delete(dateformat);
+		return NULL;
+	}
+	px_dateformat_write(dateformat, sdn, secs, str, dateformat->maxlen+1);
+	PX_dateformat_delete(dateformat);
 	return(str);
 }
 /* }}} */
 
+/* PX_timestamp2string() {{{
+ * Converts a timestamp as stored in the paradox database into
+ * a string as specified by the format string.
+ */
+PXLIB_API char * PXLIB_CALL
+PX_timestamp2string(pxdoc_t *pxdoc, double value, const char *format) {
+	int secs, days;
+
+	value = value / 1000.0;
+	days = (int) (value / 86400);
+	secs = (int) fmod(value, 86400);
+	return(px_dateformat_string(pxdoc, format, days+1721425L, secs));
+}
+/* }}} */
+
 /* PX_date2string() {{{
  * Converts a date as stored in the paradox database into
  * a string as specified by the format string.
  */
 PXLIB_API char * PXLIB_CALL
 PX_date2string(pxdoc_t *pxdoc, long value, const char *format) {
-	return(PX_timestamp2string(pxdoc, value*1000.0*86400.0, format));
+	return(px_dateformat_string(pxdoc, format, value + 1721425L, 0));
 }
 /* }}} */
 
@@ -4469,7 +7137,7 @@ PX_date2string(pxdoc_t *pxdoc, long value, const char *format) {
  */
 PXLIB_API char * PXLIB_CALL
 PX_time2string(pxdoc_t *pxdoc, long value, const char *format) {
-	return(PX_timestamp2string(pxdoc, (double) value, format));
+	return(px_dateformat_string(pxdoc, format, value/86400000L + 1721425L, (int) (value/1000 % 86400)));
 }
 /* }}} */
 
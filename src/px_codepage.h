@@ -0,0 +1,19 @@
+#ifndef __PX_CODEPAGE_H
+#define __PX_CODEPAGE_H 1
+
+const unsigned short *px_get_codepage_table(int codepage);
+
+int px_is_utf8(const char *encoding);
+
+size_t px_codepage_to_utf8(const unsigned short *table, const char *src,
+                           size_t len, char *dest);
+
+#endif /* __PX_CODEPAGE_H */
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker noet
+ * vim<600: sw=4 ts=4
+ */
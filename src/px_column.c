@@ -0,0 +1,491 @@
+/*
+ *    (c) Copyright 2003-2005  Uwe Steinmann.
+ *    All rights reserved.
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the
+ *    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ *    Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <string.h>
+
+#include "px_misc.h"
+#include "px_column.h"
+
+/* The decoders in this file turn a column of big endian numbers with
+ * a flipped sign bit, stored at a fixed distance (stride) from each
+ * other, into native values and a bitmap with one bit set for each
+ * value which is not null. Values which are null are set to 0.
+ *
+ * Besides the portable versions there are versions using SSE2 and AVX2
+ * on x86. They are compiled with gcc's target attribute, so the
+ * library itself does not require those instruction sets. Which
+ * version is used is decided on the first call by asking the cpu.
+ *
+ * Bcd numbers are decoded into scaled 64 bit integers without any
+ * vector instructions, but 16 digits at a time.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(WORDS_BIGENDIAN) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define PX_HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+typedef void (*px_short_decoder_t)(const unsigned char *, int, int, short int *, unsigned char *);
+typedef void (*px_long_decoder_t)(const unsigned char *, int, int, int *, unsigned char *);
+typedef void (*px_double_decoder_t)(const unsigned char *, int, int, double *, unsigned char *);
+
+static px_short_decoder_t px_short_decoder = NULL;
+static px_long_decoder_t px_long_decoder = NULL;
+static px_double_decoder_t px_double_decoder = NULL;
+
+/* Portable decoders {{{
+ * They also decode the remaining values which do not fill a full
+ * vector in the other decoders. first is the index of the first
+ * value to decode.
+ */
+static void
+px_decode_short_scalar(const unsigned char *data, int stride, int first, int count, short int *values, unsigned char *valid) {
+	const unsigned char *d = data + (long) first * stride;
+	int i;
+
+	for(i=first; i<count; i++, d+=stride) {
+		unsigned int v = (d[0] << 8) | d[1];
+		if(v != 0) {
+			values[i] = (short int) (v ^ 0x8000);
+			valid[i/8] |= 1 << (i%8);
+		} else
+			values[i] = 0;
+	}
+}
+
+static void
+px_decode_long_scalar(const unsigned char *data, int stride, int first, int count, int *values, unsigned char *valid) {
+	const unsigned char *d = data + (long) first * stride;
+	int i;
+
+	for(i=first; i<count; i++, d+=stride) {
+		unsigned int v = ((unsigned int) d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
+		if(v != 0) {
+			values[i] = (int) (v ^ 0x80000000U);
+			valid[i/8] |= 1 << (i%8);
+		} else
+			values[i] = 0;
+	}
+}
+
+static void
+px_decode_double_scalar(const unsigned char *data, int stride, int first, int count, double *values, unsigned char *valid) {
+	const unsigned char *d = data + (long) first * stride;
+	int i, k;
+
+	for(i=first; i<count; i++, d+=stride) {
+		char tmp[8];
+		/* Positive numbers have the sign bit set, negative numbers
+		 * have all bits inverted.
+		 */
+		if(d[0] & 0x80) {
+			memcpy(tmp, d, 8);
+			tmp[0] &= 0x7f;
+		} else {
+			for(k=0; k<8; k++)
+				tmp[k] = ~d[k];
+			if(d[0] == 0 && d[1] == 0 && d[2] == 0 && d[3] == 0 &&
+			   d[4] == 0 && d[5] == 0 && d[6] == 0 && d[7] == 0) {
+				values[i] = 0.0;
+				continue;
+			}
+		}
+		values[i] = get_double_be(tmp);
+		valid[i/8] |= 1 << (i%8);
+	}
+}
+
+static void
+px_decode_short_generic(const unsigned char *data, int stride, int count, short int *values, unsigned char *valid) {
+	px_decode_short_scalar(data, stride, 0, count, values, valid);
+}
+
+static void
+px_decode_long_generic(const unsigned char *data, int stride, int count, int *values, unsigned char *valid) {
+	px_decode_long_scalar(data, stride, 0, count, values, valid);
+}
+
+static void
+px_decode_double_generic(const unsigned char *data, int stride, int count, double *values, unsigned char *valid) {
+	px_decode_double_scalar(data, stride, 0, count, values, valid);
+}
+/* }}} */
+
+#ifdef PX_HAVE_X86_KERNELS
+/* SSE2 decoders {{{
+ * SSE2 cannot load values which are not next to each other, so they
+ * are collected with plain loads and converted eight at a time, which
+ * fills one byte of the bitmap.
+ */
+__attribute__((target("sse2"))) static inline __m128i
+px_sse2_bswap16(__m128i v) {
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+px_sse2_bswap32(__m128i v) {
+	v = px_sse2_bswap16(v);
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+px_sse2_bswap64(__m128i v) {
+	v = px_sse2_bswap16(v);
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1B), 0x1B);
+}
+
+__attribute__((target("sse2"))) static void
+px_decode_short_sse2(const unsigned char *data, int stride, int count, short int *values, unsigned char *valid) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i sign = _mm_set1_epi16((short) 0x8000);
+	int i, k;
+
+	for(i=0; i+8<=count; i+=8) {
+		unsigned short tmp[8];
+		__m128i v, isnull;
+		for(k=0; k<8; k++)
+			memcpy(&tmp[k], data + (long) (i+k) * stride, 2);
+		v = px_sse2_bswap16(_mm_loadu_si128((const __m128i *) tmp));
+		isnull = _mm_cmpeq_epi16(v, zero);
+		v = _mm_andnot_si128(isnull, _mm_xor_si128(v, sign));
+		_mm_storeu_si128((__m128i *) &values[i], v);
+		valid[i/8] = ~_mm_movemask_epi8(_mm_packs_epi16(isnull, isnull)) & 0xff;
+	}
+	px_decode_short_scalar(data, stride, i, count, values, valid);
+}
+
+__attribute__((target("sse2"))) static void
+px_decode_long_sse2(const unsigned char *data, int stride, int count, int *values, unsigned char *valid) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i sign = _mm_set1_epi32((int) 0x80000000U);
+	int i, j, k;
+
+	for(i=0; i+8<=count; i+=8) {
+		int mask = 0;
+		for(j=0; j<8; j+=4) {
+			unsigned int tmp[4];
+			__m128i v, isnull;
+			for(k=0; k<4; k++)
+				memcpy(&tmp[k], data + (long) (i+j+k) * stride, 4);
+			v = px_sse2_bswap32(_mm_loadu_si128((const __m128i *) tmp));
+			isnull = _mm_cmpeq_epi32(v, zero);
+			v = _mm_andnot_si128(isnull, _mm_xor_si128(v, sign));
+			_mm_storeu_si128((__m128i *) &values[i+j], v);
+			mask |= _mm_movemask_ps(_mm_castsi128_ps(isnull)) << j;
+		}
+		valid[i/8] = ~mask & 0xff;
+	}
+	px_decode_long_scalar(data, stride, i, count, values, valid);
+}
+
+__attribute__((target("sse2"))) static void
+px_decode_double_sse2(const unsigned char *data, int stride, int count, double *values, unsigned char *valid) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_cmpeq_epi32(zero, zero);
+	const __m128i top = _mm_set_epi32((int) 0x80000000U, 0, (int) 0x80000000U, 0);
+	int i, j, k;
+
+	for(i=0; i+8<=count; i+=8) {
+		int mask = 0;
+		for(j=0; j<8; j+=2) {
+			unsigned char tmp[16];
+			__m128i v, neg, isnull, flip;
+			for(k=0; k<2; k++)
+				memcpy(&tmp[k*8], data + (long) (i+j+k) * stride, 8);
+			v = px_sse2_bswap64(_mm_loadu_si128((const __m128i *) tmp));
+			/* There is no 64 bit compare in SSE2, so the sign and
+			 * null tests are done on 32 bit halves and combined.
+			 */
+			neg = _mm_shuffle_epi32(_mm_srai_epi32(v, 31), 0xF5);
+			isnull = _mm_cmpeq_epi32(v, zero);
+			isnull = _mm_and_si128(isnull, _mm_shuffle_epi32(isnull, 0xB1));
+			flip = _mm_or_si128(_mm_andnot_si128(neg, ones), top);
+			v = _mm_andnot_si128(isnull, _mm_xor_si128(v, flip));
+			_mm_storeu_pd(&values[i+j], _mm_castsi128_pd(v));
+			mask |= _mm_movemask_pd(_mm_castsi128_pd(isnull)) << j;
+		}
+		valid[i/8] = ~mask & 0xff;
+	}
+	px_decode_double_scalar(data, stride, i, count, values, valid);
+}
+/* }}} */
+
+/* AVX2 decoders {{{
+ * AVX2 can gather the values of eight records with a single
+ * instruction and swap their bytes with one shuffle.
+ */
+__attribute__((target("avx2"))) static void
+px_decode_short_avx2(const unsigned char *data, int stride, int count, short int *values, unsigned char *valid) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i sign = _mm256_set1_epi32(0x8000);
+	const __m256i swap = _mm256_setr_epi8(
+		1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1,
+		1, 0, -1, -1, 5, 4, -1, -1, 9, 8, -1, -1, 13, 12, -1, -1);
+	const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+	int i;
+
+	/* The gather reads four bytes for each value, which is two bytes
+	 * more than a short. The last value is therefore always left to
+	 * the scalar code, so nothing behind data is read.
+	 */
+	for(i=0; i+8<count; i+=8) {
+		__m256i v, isnull;
+		v = _mm256_i32gather_epi32((const int *) (data + (long) i * stride), index, 1);
+		v = _mm256_shuffle_epi8(v, swap);
+		isnull = _mm256_cmpeq_epi32(v, zero);
+		v = _mm256_andnot_si256(isnull, _mm256_xor_si256(v, sign));
+		/* Sign extend to 32 bit, so packing does not saturate */
+		v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+		v = _mm256_permute4x64_epi64(_mm256_packs_epi32(v, v), 0x08);
+		_mm_storeu_si128((__m128i *) &values[i], _mm256_castsi256_si128(v));
+		valid[i/8] = ~_mm256_movemask_ps(_mm256_castsi256_ps(isnull)) & 0xff;
+	}
+	px_decode_short_scalar(data, stride, i, count, values, valid);
+}
+
+__attribute__((target("avx2"))) static void
+px_decode_long_avx2(const unsigned char *data, int stride, int count, int *values, unsigned char *valid) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i sign = _mm256_set1_epi32((int) 0x80000000U);
+	const __m256i swap = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+	int i;
+
+	for(i=0; i+8<=count; i+=8) {
+		__m256i v, isnull;
+		v = _mm256_i32gather_epi32((const int *) (data + (long) i * stride), index, 1);
+		v = _mm256_shuffle_epi8(v, swap);
+		isnull = _mm256_cmpeq_epi32(v, zero);
+		v = _mm256_andnot_si256(isnull, _mm256_xor_si256(v, sign));
+		_mm256_storeu_si256((__m256i *) &values[i], v);
+		valid[i/8] = ~_mm256_movemask_ps(_mm256_castsi256_ps(isnull)) & 0xff;
+	}
+	px_decode_long_scalar(data, stride, i, count, values, valid);
+}
+
+__attribute__((target("avx2"))) static void
+px_decode_double_avx2(const unsigned char *data, int stride, int count, double *values, unsigned char *valid) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_cmpeq_epi64(zero, zero);
+	const __m256i top = _mm256_set1_epi64x((long long) 0x8000000000000000ULL);
+	const __m256i swap = _mm256_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	const __m128i index = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(stride));
+	int i, j;
+
+	for(i=0; i+8<=count; i+=8) {
+		int mask = 0;
+		for(j=0; j<8; j+=4) {
+			__m256i v, neg, isnull, flip;
+			v = _mm256_i32gather_epi64((const long long *) (data + (long) (i+j) * stride), index, 1);
+			v = _mm256_shuffle_epi8(v, swap);
+			neg = _mm256_cmpgt_epi64(zero, v);
+			isnull = _mm256_cmpeq_epi64(v, zero);
+			flip = _mm256_or_si256(_mm256_andnot_si256(neg, ones), top);
+			v = _mm256_andnot_si256(isnull, _mm256_xor_si256(v, flip));
+			_mm256_storeu_pd(&values[i+j], _mm256_castsi256_pd(v));
+			mask |= _mm256_movemask_pd(_mm256_castsi256_pd(isnull)) << j;
+		}
+		valid[i/8] = ~mask & 0xff;
+	}
+	px_decode_double_scalar(data, stride, i, count, values, valid);
+}
+/* }}} */
+#endif
+
+/* px_select_decoders() {{{
+ * Sets the decoders to the fastest version supported by the cpu.
+ * Calling it more than once, even from several threads, does no harm.
+ */
+static void
+px_select_decoders(void) {
+#ifdef PX_HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		px_long_decoder = px_decode_long_avx2;
+		px_double_decoder = px_decode_double_avx2;
+		px_short_decoder = px_decode_short_avx2;
+		return;
+	}
+	if(__builtin_cpu_supports("sse2")) {
+		px_long_decoder = px_decode_long_sse2;
+		px_double_decoder = px_decode_double_sse2;
+		px_short_decoder = px_decode_short_sse2;
+		return;
+	}
+#endif
+	px_long_decoder = px_decode_long_generic;
+	px_double_decoder = px_decode_double_generic;
+	px_short_decoder = px_decode_short_generic;
+}
+/* }}} */
+
+/* px_decode_short_column() {{{
+ * Decodes count short integers stored stride bytes apart.
+ */
+void
+px_decode_short_column(const unsigned char *data, int stride, int count, short int *values, unsigned char *valid) {
+	memset(valid, 0, (count+7)/8);
+	if(px_short_decoder == NULL)
+		px_select_decoders();
+	px_short_decoder(data, stride, count, values, valid);
+}
+/* }}} */
+
+/* px_decode_long_column() {{{
+ * Decodes count long integers stored stride bytes apart.
+ */
+void
+px_decode_long_column(const unsigned char *data, int stride, int count, int *values, unsigned char *valid) {
+	memset(valid, 0, (count+7)/8);
+	if(px_long_decoder == NULL)
+		px_select_decoders();
+	px_long_decoder(data, stride, count, values, valid);
+}
+/* }}} */
+
+/* px_decode_double_column() {{{
+ * Decodes count doubles stored stride bytes apart.
+ */
+void
+px_decode_double_column(const unsigned char *data, int stride, int count, double *values, unsigned char *valid) {
+	memset(valid, 0, (count+7)/8);
+	if(px_double_decoder == NULL)
+		px_select_decoders();
+	px_double_decoder(data, stride, count, values, valid);
+}
+/* }}} */
+
+/* px_unpack_bcd() {{{
+ * Converts 8 bytes holding 16 bcd digits, the first digit in the upper
+ * nibble of the first byte, into a number. The bytes are xor'ed with
+ * mask first, which inverts the digits of negative numbers. All digits
+ * are converted at once within a 64 bit integer: first pairs of digits
+ * into bytes, then pairs of bytes into 16 bit words and so on.
+ * Returns -1 if one of the digits is greater than 9.
+ */
+static int
+px_unpack_bcd(const unsigned char *d, unsigned long long mask, unsigned long long *value) {
+	unsigned long long v, hi, lo;
+
+	v = ((unsigned long long) d[0] << 56) | ((unsigned long long) d[1] << 48) |
+	    ((unsigned long long) d[2] << 40) | ((unsigned long long) d[3] << 32) |
+	    ((unsigned long long) d[4] << 24) | ((unsigned long long) d[5] << 16) |
+	    ((unsigned long long) d[6] << 8) | (unsigned long long) d[7];
+	v ^= mask;
+	hi = (v >> 4) & 0x0F0F0F0F0F0F0F0FULL;
+	lo = v & 0x0F0F0F0F0F0F0F0FULL;
+	/* Adding 6 to a digit greater than 9 carries into the upper nibble */
+	if(((hi + 0x0606060606060606ULL) | (lo + 0x0606060606060606ULL)) & 0xF0F0F0F0F0F0F0F0ULL)
+		return -1;
+	v = hi * 10 + lo;
+	v = ((v >> 8) & 0x00FF00FF00FF00FFULL) * 100 + (v & 0x00FF00FF00FF00FFULL);
+	v = ((v >> 16) & 0x0000FFFF0000FFFFULL) * 10000 + (v & 0x0000FFFF0000FFFFULL);
+	*value = (v >> 32) * 100000000ULL + (v & 0xFFFFFFFFULL);
+	return 0;
+}
+/* }}} */
+
+/* px_decode_bcd_digits() {{{
+ * Decodes the 32 digits of a bcd number with len digits after the
+ * decimal point. The digits are returned as two numbers with 16 digits
+ * each, the absolute value being high*10^16+low.
+ * Returns 1 on success, 0 if the value is null and -1 if it is invalid.
+ */
+int
+px_decode_bcd_digits(const unsigned char *data, int len, unsigned long long *high, unsigned long long *low, int *negative) {
+	unsigned long long mask;
+
+	if(data[0] == '\0')
+		return 0;
+	if((data[0] & 0x3f) != len)
+		return -1;
+	mask = (data[0] & 0x80) ? 0 : ~0ULL;
+	if(px_unpack_bcd(data+1, mask, high) < 0 ||
+	   px_unpack_bcd(data+9, mask, low) < 0)
+		return -1;
+	*negative = mask != 0;
+	return 1;
+}
+/* }}} */
+
+/* px_bcd_to_int64() {{{
+ * Combines the digits returned by px_decode_bcd_digits() into a 64 bit
+ * integer.
+ * Returns -1 if the number does not fit.
+ */
+int
+px_bcd_to_int64(unsigned long long high, unsigned long long low, int negative, long long *value) {
+	unsigned long long v;
+
+	/* 2^63 = 922*10^16 + 3372036854775808 */
+	if(high > 922)
+		return -1;
+	v = high * 10000000000000000ULL + low;
+	if(v > 9223372036854775807ULL + (negative ? 1 : 0))
+		return -1;
+	*value = negative ? (long long) (0ULL - v) : (long long) v;
+	return 0;
+}
+/* }}} */
+
+/* px_decode_bcd_column() {{{
+ * Decodes count bcd numbers with len digits after the decimal point,
+ * stored stride bytes apart, into 64 bit integers scaled by 10^len.
+ * Returns the number of values which are not null but could not be
+ * decoded, because they are invalid or too large. Those are set to 0
+ * and marked as null.
+ */
+int
+px_decode_bcd_column(const unsigned char *data, int stride, int count, int len, long long *values, unsigned char *valid) {
+	unsigned long long high, low;
+	int i, negative, ret, failed = 0;
+
+	memset(valid, 0, (count+7)/8);
+	for(i=0; i<count; i++, data+=stride) {
+		values[i] = 0;
+		ret = px_decode_bcd_digits(data, len, &high, &low, &negative);
+		if(ret == 0)
+			continue;
+		if(ret < 0 || px_bcd_to_int64(high, low, negative, &values[i]) < 0) {
+			failed++;
+			continue;
+		}
+		valid[i/8] |= 1 << (i%8);
+	}
+	return failed;
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker noet
+ * vim<600: sw=4 ts=4
+ */
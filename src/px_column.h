@@ -0,0 +1,30 @@
+#ifndef __PX_COLUMN_H
+#define __PX_COLUMN_H 1
+
+void px_decode_short_column(const unsigned char *data, int stride, int count,
+                            short int *values, unsigned char *valid);
+
+void px_decode_long_column(const unsigned char *data, int stride, int count,
+                           int *values, unsigned char *valid);
+
+void px_decode_double_column(const unsigned char *data, int stride, int count,
+                             double *values, unsigned char *valid);
+
+int px_decode_bcd_digits(const unsigned char *data, int len, unsigned long long *high,
+                  unsigned long long *low, int *negative);
+
+int px_bcd_to_int64(unsigned long long high, unsigned long long low,
+                    int negative, long long *value);
+
+int px_decode_bcd_column(const unsigned char *data, int stride, int count,
+                         int len, long long *values, unsigned char *valid);
+
+#endif /* __PX_COLUMN_H */
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker noet
+ * vim<600: sw=4 ts=4
+ */
@@ -231,6 +231,28 @@ void px_decrypt_db_block(unsigned char *src, unsigned char *dest,
 }
 /* }}} */
 
+/* px_decrypt_db_chunks(src, dest, encryption, offset, len, blockno) {{{
+ * Decrypts a part of a data block. offset is the position of the data
+ * within the block. offset and len must be a multiple of 256.
+ */
+void px_decrypt_db_chunks(unsigned char *src, unsigned char *dest,
+                          unsigned long encryption, unsigned long offset,
+                          unsigned long len, unsigned long blockno)
+{
+	unsigned int chunk;
+	unsigned char a,b;
+
+	a = encryption & 0xff;
+	b = (encryption >> 8) & 0xff;
+	offset >>= 8;
+	len >>= 8;
+
+	for (chunk = 0; chunk < len; ++chunk) {
+		px_decrypt_chunk(src + (chunk << 8), dest + (chunk << 8), a, b, offset+chunk, (unsigned char)blockno);
+	}
+}
+/* }}} */
+
 /* px_decrypt_mb_block(src, dest, encryption, blocksize) {{{
  */
 void px_decrypt_mb_block(unsigned char *src, unsigned char *dest,
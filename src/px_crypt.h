@@ -12,6 +12,10 @@ void px_decrypt_db_block(unsigned char *src, unsigned char *dest,
                          unsigned long encryption, unsigned long blocksize,
                          unsigned long blockno);
 
+void px_decrypt_db_chunks(unsigned char *src, unsigned char *dest,
+                          unsigned long encryption, unsigned long offset,
+                          unsigned long len, unsigned long blockno);
+
 void px_decrypt_mb_block(unsigned char *src, unsigned char *dest,
                          unsigned long encryption, unsigned long blocksize);
 
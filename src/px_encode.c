@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include "px_intern.h"
 #include "paradox.h"
+#include "px_codepage.h"
 
 /* px_init_targetencoding() {{{
  */
@@ -33,9 +34,17 @@ void px_init_inputencoding(pxdoc_t *pxdoc) {
 /* }}} */
 
 /* px_set_targetencoding() {{{
+ * Strings are converted into UTF-8 by the built in tables if the
+ * codepage of the file is known. Other encodings require recode or
+ * iconv.
  */
 int px_set_targetencoding(pxdoc_t *pxdoc) {
+	pxdoc->px_cptable = NULL;
 	if(pxdoc->targetencoding) {
+		if(px_is_utf8(pxdoc->targetencoding) &&
+		   NULL != (pxdoc->px_cptable = px_get_codepage_table(pxdoc->px_head->px_doscodepage))) {
+			return 0;
+		}
 #if PX_USE_RECODE
 		char buffer[30];
 		if(NULL == pxdoc->out_recode_outer)
@@ -53,6 +62,8 @@ int px_set_targetencoding(pxdoc_t *pxdoc) {
 		} else {
 			return 0;
 		}
+#else
+		return -1;
 #endif
 #endif
 	} else {
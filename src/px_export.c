@@ -0,0 +1,1079 @@
+/*
+ *    (c) Copyright 2003-2005  Uwe Steinmann.
+ *    All rights reserved.
+ *
+ *    This library is free software; you can redistribute it and/or
+ *    modify it under the terms of the GNU Lesser General Public
+ *    License as published by the Free Software Foundation; either
+ *    version 2 of the License, or (at your option) any later version.
+ *
+ *    This library is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *    Lesser General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Lesser General Public
+ *    License along with this library; if not, write to the
+ *    Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ *    Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if HAVE_LOCALE_H
+#include <locale.h>
+#endif
+
+#include "px_intern.h"
+#include "paradox.h"
+#include "px_error.h"
+#include "px_io.h"
+#include "px_misc.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* The exporter writes the records of a database as delimited text.
+ * Each column gets a function formatting its values, which is chosen
+ * once from the type of the field. The text of many records is
+ * collected in a large buffer, which is written with a single call of
+ * fwrite() once it is full.
+ */
+
+/* Size of the buffer collecting the exported text */
+#define PX_EXPORT_BUFFER_SIZE (1024*1024)
+
+/* Initial size of the buffer of a block range exported by a thread */
+#define PX_EXPORT_CHUNK_SIZE (256*1024)
+
+/* Size of the buffer for a formatted number */
+#define PX_EXPORT_NUMBER_SIZE 400
+
+/* How a column encloses its values in quotes */
+#define PX_EXPORT_QUOTE_NEVER 0
+#define PX_EXPORT_QUOTE_IF_NEEDED 1
+#define PX_EXPORT_QUOTE_ALWAYS 2
+
+typedef struct px_exporter px_exporter_t;
+typedef struct px_exportcolumn px_exportcolumn_t;
+
+/* Appends a value which is not null to the text of the exporter */
+typedef void (*px_exportformatter_t)(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value);
+
+struct px_exportcolumn {
+	px_exportformatter_t format;
+	int quote;                 /* One of PX_EXPORT_QUOTE_* */
+	int decimals;              /* Digits after the decimal point of numbers */
+	pxdateformat_t *dateformat; /* Format of dates, times and timestamps */
+};
+
+struct px_exporter {
+	pxdoc_t *pxdoc;
+	pxexportoptions_t options;
+	px_exportcolumn_t *columns;
+	int numcolumns;
+	size_t nulllen;            /* Length of options.null */
+	size_t eollen;             /* Length of options.eol */
+	pxdateformat_t *dateformat;
+	pxdateformat_t *timeformat;
+	pxdateformat_t *timestampformat;
+	char *scratch;             /* Memory for formatting a single value */
+	size_t scratchsize;
+	char *buffer;              /* Exported text not written yet */
+	size_t buffersize;         /* Allocated size of buffer */
+	size_t used;               /* Number of bytes in buffer */
+	FILE *fp;                  /* File written into or NULL if the text
+	                            * is only collected in buffer */
+	char decimalpoint[8];      /* Decimal point of the current locale */
+	size_t decimalpointlen;
+	int error;                 /* Set once writing failed */
+};
+
+/* PX_export_options_init() {{{
+ * Sets the options of PX_export_csv() to their defaults, which write
+ * comma separated values as described in RFC 4180.
+ */
+PXLIB_API void PXLIB_CALL
+PX_export_options_init(pxexportoptions_t *options) {
+	memset(options, 0, sizeof(pxexportoptions_t));
+	options->separator = ',';
+	options->quote = '"';
+	options->quoting = PX_EXPORT_QUOTE_NEEDED;
+	options->header = 1;
+	options->trim = 0;
+	options->null = "";
+	options->eol = "\n";
+	options->truestring = "true";
+	options->falsestring = "false";
+	options->dateformat = "Y-m-d";
+	options->timeformat = "H:i:s";
+	options->timestampformat = "Y-m-d H:i:s";
+	options->numberdecimals = 6;
+	options->currencydecimals = 2;
+	options->threads = 1;
+}
+/* }}} */
+
+/* px_export_flush() {{{
+ * Writes the collected text into the file.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int
+px_export_flush(px_exporter_t *exporter) {
+	if(exporter->error)
+		return -1;
+	if(exporter->used > 0 && fwrite(exporter->buffer, 1, exporter->used, exporter->fp) != exporter->used) {
+		px_error(exporter->pxdoc, PX_RuntimeError, _("Could not write exported records."));
+		exporter->error = 1;
+		return -1;
+	}
+	exporter->used = 0;
+	return 0;
+}
+/* }}} */
+
+/* px_export_reserve() {{{
+ * Makes sure the buffer has room for len more bytes. The buffer of an
+ * exporter without a file grows instead of being written.
+ * Returns a pointer to the free space or NULL in case of an error.
+ */
+static char *
+px_export_reserve(px_exporter_t *exporter, size_t len) {
+	if(exporter->error)
+		return NULL;
+	if(exporter->used + len > exporter->buffersize) {
+		if(exporter->fp) {
+			if(px_export_flush(exporter) < 0)
+				return NULL;
+		} else {
+			pxdoc_t *pxdoc = exporter->pxdoc;
+			size_t size = exporter->buffersize > 0 ? 2*exporter->buffersize : PX_EXPORT_CHUNK_SIZE;
+			char *buffer;
+
+			while(size < exporter->used + len)
+				size *= 2;
+			if(NULL == (buffer = pxdoc->realloc(pxdoc, exporter->buffer, size, _("Allocate memory for exported records.")))) {
+				px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for exported records."));
+				exporter->error = 1;
+				return NULL;
+			}
+			exporter->buffer = buffer;
+			exporter->buffersize = size;
+		}
+	}
+	return(exporter->buffer + exporter->used);
+}
+/* }}} */
+
+/* px_export_scan() {{{
+ * Returns the position of the first character in s which requires
+ * the value to be quoted, or len if there is none.
+ */
+static size_t
+px_export_scan(const char *s, size_t len, char separator, char quote) {
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i sep = _mm_set1_epi8(separator);
+	const __m128i quo = _mm_set1_epi8(quote);
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+
+	for(; i+16 <= len; i+=16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s+i));
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sep), _mm_cmpeq_epi8(v, quo)),
+		                         _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		int mask = _mm_movemask_epi8(m);
+		if(mask)
+			return(i + __builtin_ctz(mask));
+	}
+#endif
+	for(; i<len; i++) {
+		if(s[i] == separator || s[i] == quote || s[i] == '\r' || s[i] == '\n')
+			return(i);
+	}
+	return(len);
+}
+/* }}} */
+
+/* px_export_text() {{{
+ * Appends a string. Quotes within a quoted string are doubled.
+ */
+static void
+px_export_text(px_exporter_t *exporter, const char *s, size_t len, int quote) {
+	char q = exporter->options.quote;
+	char *ptr;
+
+	if(NULL == (ptr = px_export_reserve(exporter, 2*len+2)))
+		return;
+
+	if(quote == PX_EXPORT_QUOTE_NEVER ||
+	   (quote == PX_EXPORT_QUOTE_IF_NEEDED && px_export_scan(s, len, exporter->options.separator, q) == len)) {
+		memcpy(ptr, s, len);
+		exporter->used += len;
+		return;
+	}
+
+	*ptr++ = q;
+	while(len > 0) {
+		const char *end = memchr(s, q, len);
+		size_t n = end ? (size_t) (end-s) + 1 : len;
+		memcpy(ptr, s, n);
+		ptr += n;
+		if(end)
+			*ptr++ = q;
+		s += n;
+		len -= n;
+	}
+	*ptr++ = q;
+	exporter->used = ptr - exporter->buffer;
+}
+/* }}} */
+
+/* px_export_null() {{{
+ */
+static void
+px_export_null(px_exporter_t *exporter) {
+	char *ptr;
+
+	if(NULL == (ptr = px_export_reserve(exporter, exporter->nulllen)))
+		return;
+	memcpy(ptr, exporter->options.null, exporter->nulllen);
+	exporter->used += exporter->nulllen;
+}
+/* }}} */
+
+/* px_export_alpha() {{{
+ */
+static void
+px_export_alpha(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value) {
+	const char *s = value->value.str.val;
+	size_t len = (size_t) value->value.str.len;
+
+	if(exporter->options.trim) {
+		while(len > 0 && (s[len-1] == ' ' || s[len-1] == '\0' || (s[len-1] >= '\t' && s[len-1] <= '\r')))
+			len--;
+	}
+	px_export_text(exporter, s, len, column->quote);
+}
+/* }}} */
+
+/* px_export_long() {{{
+ * Integers never need quotes, unless all values are quoted.
+ */
+static void
+px_export_long(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value) {
+	char digits[24];
+	char *ptr;
+	unsigned long u;
+	int n = 0;
+
+	if(NULL == (ptr = px_export_reserve(exporter, sizeof(digits)+2)))
+		return;
+	if(column->quote == PX_EXPORT_QUOTE_ALWAYS)
+		*ptr++ = exporter->options.quote;
+	if(value->value.lval < 0) {
+		*ptr++ = '-';
+		u = 0UL - (unsigned long) value->value.lval;
+	} else {
+		u = (unsigned long) value->value.lval;
+	}
+	do {
+		digits[n++] = (char) ('0' + u % 10);
+		u /= 10;
+	} while(u);
+	while(n > 0)
+		*ptr++ = digits[--n];
+	if(column->quote == PX_EXPORT_QUOTE_ALWAYS)
+		*ptr++ = exporter->options.quote;
+	exporter->used = ptr - exporter->buffer;
+}
+/* }}} */
+
+/* px_export_double() {{{
+ * Used for numbers and currencies. Without a number of decimals the
+ * value is written with the fewest digits which read back as the same
+ * value. The decimal point is always '.', whatever the locale is.
+ */
+static void
+px_export_double(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value) {
+	int len, precision;
+	char *point;
+
+	if(column->decimals < 0) {
+		for(precision=15; ; precision++) {
+			len = snprintf(exporter->scratch, exporter->scratchsize, "%.*g", precision, value->value.dval);
+			if(precision == 17 || len < 0 || (size_t) len >= exporter->scratchsize ||
+			   strtod(exporter->scratch, NULL) == value->value.dval)
+				break;
+		}
+	} else {
+		len = snprintf(exporter->scratch, exporter->scratchsize, "%.*f", column->decimals, value->value.dval);
+	}
+	if(len < 0 || (size_t) len >= exporter->scratchsize) {
+		px_export_null(exporter);
+		return;
+	}
+	if(exporter->decimalpointlen > 0 && NULL != (point = strstr(exporter->scratch, exporter->decimalpoint))) {
+		*point = '.';
+		memmove(point+1, point+exporter->decimalpointlen, (size_t) len - (point-exporter->scratch) - exporter->decimalpointlen + 1);
+		len -= (int) exporter->decimalpointlen - 1;
+	}
+	px_export_text(exporter, exporter->scratch, (size_t) len, column->quote);
+}
+/* }}} */
+
+/* px_export_bcd() {{{
+ * BCD numbers are decoded into strings with the decimal point of the
+ * locale, which is replaced by '.' like for other numbers.
+ */
+static void
+px_export_bcd(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value) {
+	size_t len = (size_t) value->value.str.len;
+	char *point;
+
+	if(len >= exporter->scratchsize) {
+		px_export_null(exporter);
+		return;
+	}
+	memcpy(exporter->scratch, value->value.str.val, len);
+	if(exporter->decimalpointlen > 0 && NULL != (point = memchr(exporter->scratch, exporter->decimalpoint[0], len)))
+		*point = '.';
+	px_export_text(exporter, exporter->scratch, len, column->quote);
+}
+/* }}} */
+
+/* px_export_logical() {{{
+ */
+static void
+px_export_logical(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value) {
+	const char *s = value->value.lval ? exporter->options.truestring : exporter->options.falsestring;
+
+	px_export_text(exporter, s, strlen(s), column->quote);
+}
+/* }}} */
+
+/* px_export_date() {{{
+ */
+static void
+px_export_date(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value) {
+	int len = PX_dateformat_date(column->dateformat, value->value.lval, exporter->scratch, (int) exporter->scratchsize);
+
+	if(len < 0)
+		px_export_null(exporter);
+	else
+		px_export_text(exporter, exporter->scratch, (size_t) len, column->quote);
+}
+/* }}} */
+
+/* px_export_time() {{{
+ */
+static void
+px_export_time(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value) {
+	int len = PX_dateformat_time(column->dateformat, value->value.lval, exporter->scratch, (int) exporter->scratchsize);
+
+	if(len < 0)
+		px_export_null(exporter);
+	else
+		px_export_text(exporter, exporter->scratch, (size_t) len, column->quote);
+}
+/* }}} */
+
+/* px_export_timestamp() {{{
+ */
+static void
+px_export_timestamp(px_exporter_t *exporter, const px_exportcolumn_t *column, const pxval_t *value) {
+	int len = PX_dateformat_timestamp(column->dateformat, value->value.dval, exporter->scratch, (int) exporter->scratchsize);
+
+	if(len < 0)
+		px_export_null(exporter);
+	else
+		px_export_text(exporter, exporter->scratch, (size_t) len, column->quote);
+}
+/* }}} */
+
+/* px_exporter_init() {{{
+ * Prepares the exporter for writing records of the database into fp.
+ * If fp is NULL the text is only collected in the buffer.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int
+px_exporter_init(px_exporter_t *exporter, pxdoc_t *pxdoc, const pxexportoptions_t *options, FILE *fp) {
+	pxhead_t *pxh = pxdoc->px_head;
+	int i, numeric, strings;
+
+	memset(exporter, 0, sizeof(px_exporter_t));
+	exporter->pxdoc = pxdoc;
+	exporter->fp = fp;
+	if(options)
+		exporter->options = *options;
+	else
+		PX_export_options_init(&exporter->options);
+	if(exporter->options.null == NULL)
+		exporter->options.null = "";
+	if(exporter->options.eol == NULL)
+		exporter->options.eol = "\n";
+	if(exporter->options.truestring == NULL)
+		exporter->options.truestring = "true";
+	if(exporter->options.falsestring == NULL)
+		exporter->options.falsestring = "false";
+	exporter->nulllen = strlen(exporter->options.null);
+	exporter->eollen = strlen(exporter->options.eol);
+	/* Only a decimal point other than '.' is remembered */
+#if HAVE_LOCALE_H
+	{
+		struct lconv *lc = localeconv();
+		if(lc && lc->decimal_point && strcmp(lc->decimal_point, ".") &&
+		   strlen(lc->decimal_point) < sizeof(exporter->decimalpoint)) {
+			strcpy(exporter->decimalpoint, lc->decimal_point);
+			exporter->decimalpointlen = strlen(exporter->decimalpoint);
+		}
+	}
+#endif
+
+	/* Numbers are only quoted if all values are. Everything else is
+	 * quoted if needed or, depending on the options, always. */
+	if(exporter->options.quote == '\0') {
+		numeric = strings = PX_EXPORT_QUOTE_NEVER;
+	} else if(exporter->options.quoting == PX_EXPORT_QUOTE_ALL) {
+		numeric = strings = PX_EXPORT_QUOTE_ALWAYS;
+	} else if(exporter->options.quoting == PX_EXPORT_QUOTE_STRINGS) {
+		numeric = PX_EXPORT_QUOTE_NEVER;
+		strings = PX_EXPORT_QUOTE_ALWAYS;
+	} else {
+		numeric = PX_EXPORT_QUOTE_NEVER;
+		strings = PX_EXPORT_QUOTE_IF_NEEDED;
+	}
+
+	exporter->dateformat = PX_dateformat_new(pxdoc, exporter->options.dateformat ? exporter->options.dateformat : "Y-m-d");
+	exporter->timeformat = PX_dateformat_new(pxdoc, exporter->options.timeformat ? exporter->options.timeformat : "H:i:s");
+	exporter->timestampformat = PX_dateformat_new(pxdoc, exporter->options.timestampformat ? exporter->options.timestampformat : "Y-m-d H:i:s");
+	if(!exporter->dateformat || !exporter->timeformat || !exporter->timestampformat)
+		return -1;
+	exporter->scratchsize = PX_EXPORT_NUMBER_SIZE;
+	if(exporter->scratchsize <= (size_t) exporter->dateformat->maxlen)
+		exporter->scratchsize = exporter->dateformat->maxlen+1;
+	if(exporter->scratchsize <= (size_t) exporter->timeformat->maxlen)
+		exporter->scratchsize = exporter->timeformat->maxlen+1;
+	if(exporter->scratchsize <= (size_t) exporter->timestampformat->maxlen)
+		exporter->scratchsize = exporter->timestampformat->maxlen+1;
+
+	if(NULL == (exporter->scratch = pxdoc->malloc(pxdoc, exporter->scratchsize, _("Allocate memory for formatting exported values.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for formatting exported values."));
+		return -1;
+	}
+	if(fp) {
+		if(NULL == (exporter->buffer = pxdoc->malloc(pxdoc, PX_EXPORT_BUFFER_SIZE, _("Allocate memory for exported records.")))) {
+			px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for exported records."));
+			return -1;
+		}
+		exporter->buffersize = PX_EXPORT_BUFFER_SIZE;
+	}
+	exporter->numcolumns = pxh->px_numfields;
+	if(NULL == (exporter->columns = pxdoc->malloc(pxdoc, exporter->numcolumns*sizeof(px_exportcolumn_t), _("Allocate memory for exported columns.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for exported columns."));
+		return -1;
+	}
+
+	for(i=0; i<exporter->numcolumns; i++) {
+		px_exportcolumn_t *column = &exporter->columns[i];
+		memset(column, 0, sizeof(px_exportcolumn_t));
+		column->quote = strings;
+		switch(pxh->px_fields[i].px_ftype) {
+			case pxfAlpha:
+				column->format = px_export_alpha;
+				break;
+			case pxfBCD:
+				column->format = px_export_bcd;
+				column->quote = numeric;
+				break;
+			case pxfShort:
+			case pxfLong:
+			case pxfAutoInc:
+				column->format = px_export_long;
+				column->quote = numeric;
+				break;
+			case pxfNumber:
+				column->format = px_export_double;
+				column->decimals = exporter->options.numberdecimals;
+				column->quote = numeric;
+				break;
+			case pxfCurrency:
+				column->format = px_export_double;
+				column->decimals = exporter->options.currencydecimals;
+				column->quote = numeric;
+				break;
+			case pxfLogical:
+				column->format = px_export_logical;
+				break;
+			case pxfDate:
+				column->format = px_export_date;
+				column->dateformat = exporter->dateformat;
+				break;
+			case pxfTime:
+				column->format = px_export_time;
+				column->dateformat = exporter->timeformat;
+				break;
+			case pxfTimestamp:
+				column->format = px_export_timestamp;
+				column->dateformat = exporter->timestampformat;
+				break;
+			default:
+				/* Blobs and bytes are written like null values */
+				column->format = NULL;
+				break;
+		}
+	}
+	return 0;
+}
+/* }}} */
+
+/* px_exporter_free() {{{
+ */
+static void
+px_exporter_free(px_exporter_t *exporter) {
+	pxdoc_t *pxdoc = exporter->pxdoc;
+
+	PX_dateformat_delete(exporter->dateformat);
+	PX_dateformat_delete(exporter->timeformat);
+	PX_dateformat_delete(exporter->timestampformat);
+	if(exporter->scratch)
+		pxdoc->free(pxdoc, exporter->scratch);
+	if(exporter->buffer)
+		pxdoc->free(pxdoc, exporter->buffer);
+	if(exporter->columns)
+		pxdoc->free(pxdoc, exporter->columns);
+}
+/* }}} */
+
+/* px_export_header() {{{
+ * Appends a line with the names of the fields.
+ */
+static void
+px_export_header(px_exporter_t *exporter) {
+	pxhead_t *pxh = exporter->pxdoc->px_head;
+	int i, quote;
+	char *ptr;
+
+	if(exporter->options.quote == '\0')
+		quote = PX_EXPORT_QUOTE_NEVER;
+	else if(exporter->options.quoting == PX_EXPORT_QUOTE_NEEDED)
+		quote = PX_EXPORT_QUOTE_IF_NEEDED;
+	else
+		quote = PX_EXPORT_QUOTE_ALWAYS;
+
+	for(i=0; i<exporter->numcolumns; i++) {
+		const char *name = pxh->px_fields[i].px_fname ? pxh->px_fields[i].px_fname : "";
+		if(i > 0) {
+			if(NULL == (ptr = px_export_reserve(exporter, 1)))
+				return;
+			*ptr = exporter->options.separator;
+			exporter->used++;
+		}
+		px_export_text(exporter, name, strlen(name), quote);
+	}
+	if(NULL == (ptr = px_export_reserve(exporter, exporter->eollen)))
+		return;
+	memcpy(ptr, exporter->options.eol, exporter->eollen);
+	exporter->used += exporter->eollen;
+}
+/* }}} */
+
+/* px_export_record() {{{
+ * Appends a line with the values of a record.
+ */
+static void
+px_export_record(px_exporter_t *exporter, pxval_t **values) {
+	int i;
+	char *ptr;
+
+	for(i=0; i<exporter->numcolumns; i++) {
+		const px_exportcolumn_t *column = &exporter->columns[i];
+		if(i > 0) {
+			if(NULL == (ptr = px_export_reserve(exporter, 1)))
+				return;
+			*ptr = exporter->options.separator;
+			exporter->used++;
+		}
+		if(column->format == NULL || values[i]->isnull ||
+		   ((column->format == px_export_alpha) && values[i]->value.str.val == NULL))
+			px_export_null(exporter);
+		else
+			column->format(exporter, column, values[i]);
+	}
+	if(NULL == (ptr = px_export_reserve(exporter, exporter->eollen)))
+		return;
+	memcpy(ptr, exporter->options.eol, exporter->eollen);
+	exporter->used += exporter->eollen;
+}
+/* }}} */
+
+/* px_export_sequential() {{{
+ * Appends all records read by a cursor in the order of the block chain.
+ * Returns the number of records or -1 in case of an error.
+ */
+static int
+px_export_sequential(px_exporter_t *exporter) {
+	pxdoc_t *pxdoc = exporter->pxdoc;
+	pxcursor_t *cursor;
+	pxrecord_t *record;
+	pxval_t **values;
+	int count = 0;
+	char *data;
+
+	if(NULL == (cursor = PX_cursor_open(pxdoc, 0)))
+		return -1;
+	if(NULL == (record = PX_record_new(pxdoc))) {
+		PX_cursor_close(cursor);
+		return -1;
+	}
+	while(!exporter->error && (data = PX_cursor_next(cursor, NULL))) {
+		if(NULL == (values = PX_record_decode(record, data))) {
+			count = -1;
+			break;
+		}
+		px_export_record(exporter, values);
+		count++;
+	}
+	/* The cursor also stops if a data block could not be read */
+	if(cursor->error)
+		count = -1;
+	PX_record_delete(record);
+	PX_cursor_close(cursor);
+	return(exporter->error ? -1 : count);
+}
+/* }}} */
+
+#if HAVE_PTHREAD
+/* Several threads export a database by splitting the chain of data
+ * blocks into chunks of adjacent blocks as listed in the block
+ * directory. Each thread takes the next chunk, reads its blocks with
+ * pread() and formats the records into the buffer of a slot. The
+ * calling thread writes the slots into the file in the order of the
+ * chunks. There are twice as many slots as threads, which limits the
+ * memory used for text not written yet.
+ */
+
+/* Raw data of the blocks in a chunk */
+#define PX_EXPORT_CHUNK_DATA (256*1024)
+
+/* States of a slot */
+#define PX_EXPORT_SLOT_FREE 0
+#define PX_EXPORT_SLOT_DONE 1
+#define PX_EXPORT_SLOT_FAILED 2
+
+typedef struct px_exportslot px_exportslot_t;
+typedef struct px_exportjob px_exportjob_t;
+typedef struct px_exportworker px_exportworker_t;
+
+struct px_exportslot {
+	int state;                 /* One of PX_EXPORT_SLOT_* */
+	char *buffer;              /* Text of the chunk */
+	size_t size;               /* Allocated size of buffer */
+	size_t used;               /* Length of the text */
+	int numrecords;            /* Number of records in the chunk */
+	int blocknumber;           /* Block which could not be read */
+};
+
+struct px_exportjob {
+	pxdoc_t *pxdoc;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;       /* Signaled whenever a slot changes */
+	px_exportslot_t *slots;
+	int numslots;
+	int numchunks;
+	int blocksperchunk;
+	int nextchunk;             /* Chunk taken next by a thread */
+	int written;               /* Number of chunks written so far */
+	int error;                 /* Set if a thread failed */
+	int reported;              /* Set if the failure has been reported */
+};
+
+struct px_exportworker {
+	px_exportjob_t *job;
+	pthread_t thread;
+	px_exporter_t exporter;
+	pxrecord_t *record;
+	char *block;               /* Memory for a data block */
+};
+
+/* px_export_parallel_possible() {{{
+ * Checks whether the records can be exported by several threads with
+ * the same result as by px_export_sequential(). The file must be
+ * readable at an offset without going through the block cache, the
+ * block directory must cover the whole chain of blocks and strings
+ * must not be converted by iconv or recode, whose state is shared.
+ */
+static int
+px_export_parallel_possible(px_exporter_t *exporter) {
+	pxdoc_t *pxdoc = exporter->pxdoc;
+	pxhead_t *pxh = pxdoc->px_head;
+	int i;
+
+	if(pxdoc->px_stream == NULL || pxdoc->px_stream->pread == NULL ||
+	   pxdoc->px_cachedirty > 0 || pxdoc->px_prefetchsize > 0)
+		return 0;
+	if(pxdoc->px_blockdir == NULL || pxdoc->px_blockdirlen < 2)
+		return 0;
+	if(pxdoc->px_blockdir[pxdoc->px_blockdirlen-1].next > 0 &&
+	   pxdoc->px_blockdirlen < (int) pxh->px_fileblocks)
+		return 0;
+	if(pxdoc->targetencoding != NULL && pxdoc->px_cptable == NULL)
+		return 0;
+	/* Blobs are read from a stream shared by all threads */
+	for(i=0; i<exporter->numcolumns; i++) {
+		if(exporter->columns[i].format == NULL &&
+		   (pxdoc->px_projection == NULL || pxdoc->px_projection[i]))
+			return 0;
+	}
+	return 1;
+}
+/* }}} */
+
+/* px_export_chunk() {{{
+ * Formats the records of a chunk into the buffer of its slot.
+ * Returns 0 on success or -1 in case of an error.
+ */
+static int
+px_export_chunk(px_exportworker_t *worker, int chunk, px_exportslot_t *slot) {
+	px_exportjob_t *job = worker->job;
+	px_exporter_t *exporter = &worker->exporter;
+	pxdoc_t *pxdoc = job->pxdoc;
+	pxhead_t *pxh = pxdoc->px_head;
+	int blocksize = pxh->px_maxtablesize*0x400;
+	int pos, first, last, ret = 0;
+
+	first = chunk*job->blocksperchunk;
+	last = first+job->blocksperchunk;
+	if(last > pxdoc->px_blockdirlen)
+		last = pxdoc->px_blockdirlen;
+
+	exporter->buffer = slot->buffer;
+	exporter->buffersize = slot->size;
+	exporter->used = 0;
+	slot->numrecords = 0;
+	for(pos=first; pos<last && ret == 0; pos++) {
+		int blocknumber = pxdoc->px_blockdir[pos].blocknumber;
+		long blockpos = pxh->px_headersize+(long)(blocknumber-1)*blocksize;
+		int datasize, validrecords, recno;
+		char *block;
+
+		/* Read the block just like PX_cursor_next() does */
+		if(NULL == (block = (char *) px_stream_mapping(pxdoc, blockpos, blocksize))) {
+			block = worker->block;
+			if(pxdoc->pread(pxdoc, pxdoc->px_stream, blockpos, blocksize, block) < 1) {
+				slot->blocknumber = blocknumber;
+				ret = -1;
+				break;
+			}
+		}
+		datasize = get_short_le((const char *) &((TDataBlock *) block)->addDataSize);
+		if(datasize > blocksize-(int)sizeof(TDataBlock)-pxh->px_recordsize)
+			validrecords = 0;
+		else
+			validrecords = datasize/pxh->px_recordsize+1;
+
+		for(recno=0; recno<validrecords; recno++) {
+			pxval_t **values;
+			if(NULL == (values = PX_record_decode(worker->record, block+sizeof(TDataBlock)+recno*pxh->px_recordsize))) {
+				ret = -1;
+				break;
+			}
+			px_export_record(exporter, values);
+		}
+		slot->numrecords += validrecords;
+		if(exporter->error)
+			ret = -1;
+	}
+	slot->buffer = exporter->buffer;
+	slot->size = exporter->buffersize;
+	slot->used = exporter->used;
+	exporter->buffer = NULL;
+	exporter->buffersize = 0;
+	return(ret);
+}
+/* }}} */
+
+/* px_export_worker() {{{
+ * Main function of a thread exporting chunks.
+ */
+static void *
+px_export_worker(void *arg) {
+	px_exportworker_t *worker = (px_exportworker_t *) arg;
+	px_exportjob_t *job = worker->job;
+
+	pthread_mutex_lock(&job->mutex);
+	for(;;) {
+		px_exportslot_t *slot;
+		int chunk, ret;
+
+		/* Wait until the slot of the next chunk has been written */
+		while(!job->error && job->nextchunk < job->numchunks &&
+		      job->nextchunk-job->written >= job->numslots)
+			pthread_cond_wait(&job->cond, &job->mutex);
+		if(job->error || job->nextchunk >= job->numchunks)
+			break;
+		chunk = job->nextchunk++;
+		slot = &job->slots[chunk % job->numslots];
+		pthread_mutex_unlock(&job->mutex);
+
+		ret = px_export_chunk(worker, chunk, slot);
+
+		pthread_mutex_lock(&job->mutex);
+		if(ret < 0) {
+			slot->state = PX_EXPORT_SLOT_FAILED;
+			job->error = 1;
+			/* Only blocks which could not be read have not been reported */
+			if(slot->blocknumber == 0)
+				job->reported = 1;
+		} else {
+			slot->state = PX_EXPORT_SLOT_DONE;
+		}
+		pthread_cond_broadcast(&job->cond);
+	}
+	pthread_mutex_unlock(&job->mutex);
+	return NULL;
+}
+/* }}} */
+
+/* px_export_parallel() {{{
+ * Appends all records using the given number of threads. The text
+ * collected so far by the exporter is written first.
+ * Returns the number of records, -1 in case of an error or -2 if no
+ * thread could be started, in which case nothing has been written.
+ */
+static int
+px_export_parallel(px_exporter_t *exporter, int numthreads) {
+	pxdoc_t *pxdoc = exporter->pxdoc;
+	pxhead_t *pxh = pxdoc->px_head;
+	px_exportjob_t job;
+	px_exportworker_t *workers;
+	int blocksize = pxh->px_maxtablesize*0x400;
+	int i, chunk, started = 0, count = 0, failedblock = 0;
+
+	memset(&job, 0, sizeof(px_exportjob_t));
+	job.pxdoc = pxdoc;
+	/* Make chunks small enough to give each thread several of them */
+	job.blocksperchunk = PX_EXPORT_CHUNK_DATA/blocksize;
+	if(job.blocksperchunk > (pxdoc->px_blockdirlen+4*numthreads-1)/(4*numthreads))
+		job.blocksperchunk = (pxdoc->px_blockdirlen+4*numthreads-1)/(4*numthreads);
+	if(job.blocksperchunk < 1)
+		job.blocksperchunk = 1;
+	job.numchunks = (pxdoc->px_blockdirlen+job.blocksperchunk-1)/job.blocksperchunk;
+	if(numthreads > job.numchunks)
+		numthreads = job.numchunks;
+	job.numslots = 2*numthreads;
+
+	if(NULL == (workers = pxdoc->malloc(pxdoc, numthreads*sizeof(px_exportworker_t), _("Allocate memory for export threads.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for export threads."));
+		return -1;
+	}
+	memset(workers, 0, numthreads*sizeof(px_exportworker_t));
+	if(NULL == (job.slots = pxdoc->malloc(pxdoc, job.numslots*sizeof(px_exportslot_t), _("Allocate memory for exported chunks.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for exported chunks."));
+		pxdoc->free(pxdoc, workers);
+		return -1;
+	}
+	memset(job.slots, 0, job.numslots*sizeof(px_exportslot_t));
+	pthread_mutex_init(&job.mutex, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	for(i=0; i<numthreads; i++) {
+		px_exportworker_t *worker = &workers[i];
+		worker->job = &job;
+		if(0 > px_exporter_init(&worker->exporter, pxdoc, &exporter->options, NULL))
+			break;
+		if(NULL == (worker->record = PX_record_new(pxdoc)))
+			break;
+		if(NULL == (worker->block = pxdoc->malloc(pxdoc, blocksize, _("Allocate memory for data block of export thread.")))) {
+			px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for data block of export thread."));
+			break;
+		}
+		if(0 != pthread_create(&worker->thread, NULL, px_export_worker, worker))
+			break;
+		started++;
+	}
+
+	if(started == 0) {
+		count = -2;
+	} else if(0 > px_export_flush(exporter)) {
+		pthread_mutex_lock(&job.mutex);
+		job.error = 1;
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock(&job.mutex);
+		count = -1;
+	} else {
+		/* Write the chunks in order as soon as they are formatted */
+		for(chunk=0; chunk<job.numchunks; chunk++) {
+			px_exportslot_t *slot = &job.slots[chunk % job.numslots];
+
+			pthread_mutex_lock(&job.mutex);
+			while(slot->state == PX_EXPORT_SLOT_FREE && !job.error)
+				pthread_cond_wait(&job.cond, &job.mutex);
+			if(slot->state != PX_EXPORT_SLOT_DONE) {
+				job.error = 1;
+				pthread_mutex_unlock(&job.mutex);
+				break;
+			}
+			pthread_mutex_unlock(&job.mutex);
+
+			if(slot->used > 0 && fwrite(slot->buffer, 1, slot->used, exporter->fp) != slot->used) {
+				px_error(pxdoc, PX_RuntimeError, _("Could not write exported records."));
+				pthread_mutex_lock(&job.mutex);
+				job.error = 1;
+				job.reported = 1;
+				pthread_cond_broadcast(&job.cond);
+				pthread_mutex_unlock(&job.mutex);
+				break;
+			}
+			count += slot->numrecords;
+
+			pthread_mutex_lock(&job.mutex);
+			slot->state = PX_EXPORT_SLOT_FREE;
+			job.written++;
+			pthread_cond_broadcast(&job.cond);
+			pthread_mutex_unlock(&job.mutex);
+		}
+	}
+
+	for(i=0; i<started; i++)
+		pthread_join(workers[i].thread, NULL);
+	if(job.error && count >= 0) {
+		for(i=0; i<job.numslots; i++) {
+			if(job.slots[i].blocknumber > 0)
+				failedblock = job.slots[i].blocknumber;
+		}
+		if(failedblock > 0)
+			px_error(pxdoc, PX_RuntimeError, _("Could not read data block nr. %d."), failedblock);
+		else if(!job.reported)
+			px_error(pxdoc, PX_RuntimeError, _("Could not export records."));
+		count = -1;
+	}
+
+	for(i=0; i<numthreads; i++) {
+		if(workers[i].record)
+			PX_record_delete(workers[i].record);
+		if(workers[i].block)
+			pxdoc->free(pxdoc, workers[i].block);
+		if(workers[i].exporter.pxdoc)
+			px_exporter_free(&workers[i].exporter);
+	}
+	for(i=0; i<job.numslots; i++) {
+		if(job.slots[i].buffer)
+			pxdoc->free(pxdoc, job.slots[i].buffer);
+	}
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.mutex);
+	pxdoc->free(pxdoc, job.slots);
+	pxdoc->free(pxdoc, workers);
+	return(count);
+}
+/* }}} */
+#endif
+
+/* PX_export_csv() {{{
+ * Writes all records of the database into fp as delimited text, one
+ * record per line. options controls the separator, quoting and the
+ * formatting of values. If options is NULL the defaults set by
+ * PX_export_options_init() are used. Blobs and bytes are written like
+ * null values and are not read. Fields not contained in a projection
+ * set by PX_set_projection() are written as null values as well.
+ * If options->threads is larger than 1, the records are formatted by
+ * that many threads, each taking a range of data blocks. The result is
+ * the same as with a single thread.
+ * Returns the number of records written or -1 in case of an error.
+ */
+PXLIB_API int PXLIB_CALL
+PX_export_csv(pxdoc_t *pxdoc, FILE *fp, const pxexportoptions_t *options) {
+	pxhead_t *pxh;
+	px_exporter_t exporter;
+	int *fields = NULL;
+	int i, numfields, numthreads, count = -1;
+
+	if(pxdoc == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a paradox database."));
+		return -1;
+	}
+
+	if(pxdoc->px_head == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("File has no header."));
+		return -1;
+	}
+	pxh = pxdoc->px_head;
+
+	if(fp == NULL) {
+		px_error(pxdoc, PX_RuntimeError, _("Did not pass a file for exporting records."));
+		return -1;
+	}
+
+	if(0 > px_exporter_init(&exporter, pxdoc, options, fp))
+		goto cleanup;
+
+	/* Fields which are not written need not be decoded. Without a
+	 * projection of the application, one is set for the time of the
+	 * export which leaves out blobs and bytes. */
+	if(pxdoc->px_projection == NULL) {
+		if(NULL == (fields = pxdoc->malloc(pxdoc, pxh->px_numfields*sizeof(int), _("Allocate memory for exported fields.")))) {
+			px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for exported fields."));
+			goto cleanup;
+		}
+		numfields = 0;
+		for(i=0; i<pxh->px_numfields; i++) {
+			if(exporter.columns[i].format != NULL)
+				fields[numfields++] = i;
+		}
+		if(numfields == pxh->px_numfields || numfields == 0) {
+			pxdoc->free(pxdoc, fields);
+			fields = NULL;
+		} else if(0 > PX_set_projection(pxdoc, fields, numfields)) {
+			goto cleanup;
+		}
+	}
+
+	if(exporter.options.header)
+		px_export_header(&exporter);
+
+	numthreads = exporter.options.threads;
+#if HAVE_UNISTD_H && defined(_SC_NPROCESSORS_ONLN)
+	if(numthreads == 0)
+		numthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	count = -2;
+#if HAVE_PTHREAD
+	if(numthreads > 1 && px_export_parallel_possible(&exporter))
+		count = px_export_parallel(&exporter, numthreads);
+#endif
+	if(count == -2)
+		count = px_export_sequential(&exporter);
+	if(0 > px_export_flush(&exporter))
+		count = -1;
+
+cleanup:
+	if(fields) {
+		PX_set_projection(pxdoc, NULL, 0);
+		pxdoc->free(pxdoc, fields);
+	}
+	px_exporter_free(&exporter);
+	return(count);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker noet
+ * vim<600: sw=4 ts=4
+ */
@@ -470,11 +470,9 @@ int put_px_head(pxdoc_t *pxdoc, pxhead_t *pxh, pxstream_t *pxs) {
 	}
 
 	/* write zeros to fill space for tablename */
-	for(i=0; i<tablenamelen-len; i++) {
-		if(pxdoc->write(pxdoc, pxs, 1, &nullint) < 1) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not write tablename."));
-			return -1;
-		}
+	if(pxdoc->extend(pxdoc, pxs, tablenamelen-len) < tablenamelen-len) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not write tablename."));
+		return -1;
 	}
 
 	if(!isindex) {
@@ -523,6 +521,30 @@ int put_px_head(pxdoc_t *pxdoc, pxhead_t *pxh, pxstream_t *pxs) {
 			
 	}
 	
+	pxdoc->px_headdirty = 0;
+	return 0;
+}
+/* }}} */
+
+/* px_head_flush() {{{
+ * Writes the header if it was modified since it was written last.
+ */
+int px_head_flush(pxdoc_t *pxdoc) {
+	if(pxdoc->px_headdirty == 0 || pxdoc->px_head == NULL)
+		return 0;
+	return(put_px_head(pxdoc, pxdoc->px_head, pxdoc->px_stream));
+}
+/* }}} */
+
+/* px_head_modified() {{{
+ * Notes a modification of the header in memory. The header is written
+ * by px_head_flush() or as soon as px_headbatch modifications have been
+ * made.
+ */
+int px_head_modified(pxdoc_t *pxdoc) {
+	pxdoc->px_headdirty++;
+	if(pxdoc->px_headbatch > 0 && pxdoc->px_headdirty >= pxdoc->px_headbatch)
+		return(px_head_flush(pxdoc));
 	return 0;
 }
 /* }}} */
@@ -536,11 +558,7 @@ int get_datablock_head(pxdoc_t *pxdoc, pxstream_t *pxs, int datablocknr, TDataBl
 
 	pxh = pxdoc->px_head;
 	position = pxh->px_headersize+(datablocknr-1)*pxh->px_maxtablesize*0x400;
-	if((ret = pxdoc->seek(pxdoc, pxs, position, SEEK_SET)) < 0) {
-		return -1;
-	}
-
-	if((ret = (int)pxdoc->read(pxdoc, pxs, sizeof(TDataBlock), datablockhead)) < 0) {
+	if((ret = (int)pxdoc->pread(pxdoc, pxs, position, sizeof(TDataBlock), datablockhead)) < 0) {
 		return -1;
 	}
 
@@ -579,7 +597,7 @@ int put_datablock_head(pxdoc_t *pxdoc, pxstream_t *pxs, int datablocknr, TDataBl
  */
 int put_px_datablock(pxdoc_t *pxdoc, pxhead_t *pxh, int after, pxstream_t *pxs) {
 	TDataBlock newdatablockhead, prevdatablockhead, nextdatablockhead;
-	int i, next, ret, nullint = 0;
+	int next, ret;
 
 	if(after > (int)pxh->px_fileblocks) {
 		px_error(pxdoc, PX_RuntimeError, _("Trying to insert data block after block number %d, but file has only %d blocks."), after, pxh->px_fileblocks);
@@ -626,11 +644,9 @@ int put_px_datablock(pxdoc_t *pxdoc, pxhead_t *pxh, int after, pxstream_t *pxs)
 	}
 
 	/* write an empty block. File pointer is still at right position. */
-	for(i=0; i<pxh->px_maxtablesize*0x400-(int)sizeof(TDataBlock); i++) {
-		if(pxdoc->write(pxdoc, pxs, 1, &nullint) < 1) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not write empty data block."));
-			return -1;
-		}
+	if(pxdoc->extend(pxdoc, pxs, pxh->px_maxtablesize*0x400-sizeof(TDataBlock)) < pxh->px_maxtablesize*0x400-(int)sizeof(TDataBlock)) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not write empty data block."));
+		return -1;
 	}
 
 	/* Update the block before the new one */
@@ -657,7 +673,7 @@ int put_px_datablock(pxdoc_t *pxdoc, pxhead_t *pxh, int after, pxstream_t *pxs)
 		pxh->px_firstblock = pxh->px_fileblocks;
 	if(next == 0)
 		pxh->px_lastblock = pxh->px_fileblocks;
-	if(put_px_head(pxdoc, pxh, pxs) < 0) {
+	if(px_head_modified(pxdoc) < 0) {
 		px_error(pxdoc, PX_RuntimeError, _("Unable to write file header."));
 		return -1;
 	}
@@ -770,7 +786,6 @@ int px_add_data_to_block(pxdoc_t *pxdoc, pxhead_t *pxh, int datablocknr, int rec
  */
 int _put_px_datablock(pxdoc_t *pxdoc, pxhead_t *pxh, int prev, int next, int recnos, pxstream_t *pxs) {
 	TDataBlock newdatablockhead;
-	int i, nullint = 0;
 
 	if(next > (int)pxh->px_fileblocks) {
 		px_error(pxdoc, PX_RuntimeError, _("Trying to insert data block after block number %d, but file has only %d blocks."), next, pxh->px_fileblocks);
@@ -797,11 +812,9 @@ int _put_px_datablock(pxdoc_t *pxdoc, pxhead_t *pxh, int prev, int next, int rec
 	}
 
 	/* write an empty block. File pointer is still at right position. */
-	for(i=0; i<pxh->px_maxtablesize*0x400-(int)sizeof(TDataBlock); i++) {
-		if(pxdoc->write(pxdoc, pxs, 1, &nullint) < 1) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not write empty data block."));
-			return -1;
-		}
+	if(pxdoc->extend(pxdoc, pxs, pxh->px_maxtablesize*0x400-sizeof(TDataBlock)) < pxh->px_maxtablesize*0x400-(int)sizeof(TDataBlock)) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not write empty data block."));
+		return -1;
 	}
 
 	/* Update the header */
@@ -810,7 +823,7 @@ int _put_px_datablock(pxdoc_t *pxdoc, pxhead_t *pxh, int prev, int next, int rec
 		pxh->px_firstblock = pxh->px_fileblocks;
 	if(next == 0)
 		pxh->px_lastblock = pxh->px_fileblocks;
-	if(put_px_head(pxdoc, pxh, pxs) < 0) {
+	if(px_head_modified(pxdoc) < 0) {
 		px_error(pxdoc, PX_RuntimeError, _("Unable to write file header."));
 		return -1;
 	}
@@ -1131,7 +1144,6 @@ mbhead_t *get_mb_head(pxblob_t *pxblob, pxstream_t *pxs) {
 int put_mb_head(pxblob_t *pxblob, mbhead_t *mbh, pxstream_t *pxs) {
 	pxdoc_t *pxdoc;
 	TMbHeader mbhead;
-	int nullint = 0, i;
 
 	pxdoc = pxblob->pxdoc;
 	if(NULL == pxdoc) {
@@ -1164,11 +1176,9 @@ int put_mb_head(pxblob_t *pxblob, mbhead_t *mbh, pxstream_t *pxs) {
 	}
 
 	/* write zeros to fill space of first block */
-	for(i=0; i<4096-sizeof(TMbHeader); i++) {
-		if(pxblob->write(pxblob, pxs, 1, &nullint) < 1) {
-			px_error(pxdoc, PX_RuntimeError, _("Could not write remaining blob file header."));
-			return -1;
-		}
+	if(pxblob->extend(pxblob, pxs, 4096-sizeof(TMbHeader)) < (ssize_t) (4096-sizeof(TMbHeader))) {
+		px_error(pxdoc, PX_RuntimeError, _("Could not write remaining blob file header."));
+		return -1;
 	}
 	return 0;
 }
@@ -6,11 +6,26 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#if HAVE_SYS_MMAN_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if HAVE_POSIX_FADVISE
+#include <fcntl.h>
+#endif
 #include "px_intern.h"
 #include "paradox-gsf.h"
 #include "px_error.h"
 #include "px_crypt.h"
 #include "px_io.h"
+#include "px_misc.h"
 
 /* px_stream_new() {{{
  *
@@ -27,6 +42,7 @@ pxstream_t *px_stream_new(pxdoc_t *pxdoc) {
 		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for io stream."));
 		return NULL;
 	}
+	memset(pxs, 0, sizeof(pxstream_t));
 	
 	return(pxs);
 }
@@ -76,11 +92,851 @@ pxstream_t *px_stream_new_file(pxdoc_t *pxdoc, int mode, int close, FILE *fp) {
 	pxs->seek = px_fseek;
 	pxs->tell = px_ftell;
 	pxs->write = px_fwrite;
+#if HAVE_PREAD
+	pxs->pread = px_fpread;
+#endif
+	return(pxs);
+}
+/* }}} */
+
+#if HAVE_SYS_MMAN_H
+/* px_stream_new_mmap() {{{
+ *
+ * Create a stream which reads from a memory mapped file. The whole
+ * file is mapped read only. The file pointer is kept for closing the
+ * file. Returns NULL without an error message if the file cannot be
+ * mapped.
+ */
+pxstream_t *px_stream_new_mmap(pxdoc_t *pxdoc, int mode, int close, FILE *fp) {
+	pxstream_t *pxs;
+	struct stat st;
+	void *map;
+
+	if(mode & pxfFileWrite) {
+		px_error(pxdoc, PX_RuntimeError, _("Memory mapped files can only be read."));
+		return(NULL);
+	}
+	/* A file which cannot be mapped is not reported, because the caller
+	 * will usually fall back to reading it with stdio */
+	if(fstat(fileno(fp), &st) < 0 || st.st_size == 0) {
+		return(NULL);
+	}
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if(map == MAP_FAILED) {
+		return(NULL);
+	}
+
+	if(NULL == (pxs = px_stream_new(pxdoc))) {
+		munmap(map, (size_t) st.st_size);
+		return(NULL);
+	}
+
+	pxs->type = pxfIOMmap;
+	pxs->mode = mode;
+	pxs->close = close;
+	pxs->s.fp = fp;
+	pxs->mapdata = map;
+	pxs->mapsize = (size_t) st.st_size;
+	pxs->mappos = 0;
+
+	pxs->read = px_mmapread;
+	pxs->seek = px_mmapseek;
+	pxs->tell = px_mmaptell;
+	pxs->write = px_mmapwrite;
+	pxs->pread = px_mmappread;
 	return(pxs);
 }
 /* }}} */
+#endif
+
+/* px_stream_unmap() {{{
+ *
+ * Removes the mapping of a memory mapped file. Does nothing for other
+ * types of streams.
+ */
+void px_stream_unmap(pxdoc_t *pxdoc, pxstream_t *pxs) {
+#if HAVE_SYS_MMAN_H
+	if(pxs && pxs->type == pxfIOMmap && pxs->mapdata) {
+		munmap(pxs->mapdata, pxs->mapsize);
+		pxs->mapdata = NULL;
+		pxs->mapsize = 0;
+	}
+#endif
+}
+/* }}} */
+
+/* px_stream_mapping() {{{
+ *
+ * Returns a pointer to 'len' bytes of data at position 'pos' of the
+ * file, if the file is memory mapped and not encrypted. In any other
+ * case NULL is returned and the data must be read with px_read().
+ */
+unsigned char *px_stream_mapping(pxdoc_t *p, long pos, size_t len) {
+	pxstream_t *pxs = p->px_stream;
+
+	if(pxs == NULL || pxs->type != pxfIOMmap || pxs->mapdata == NULL)
+		return(NULL);
+	if(p->px_head != NULL && p->px_head->px_encryption != 0)
+		return(NULL);
+	if(pos < 0 || (size_t) pos + len > pxs->mapsize)
+		return(NULL);
+	return(pxs->mapdata + pos);
+}
+/* }}} */
+
+/* px_stream_extend() {{{
+ *
+ * Writes len zero bytes at the current position of the stream. The
+ * zeros are written in chunks of 4kB instead of byte by byte.
+ */
+ssize_t px_stream_extend(pxdoc_t *p, pxstream_t *pxs, size_t len) {
+	static char zeros[4096];
+	size_t n, done;
+	ssize_t ret;
+
+	done = 0;
+	while(done < len) {
+		n = len - done;
+		if(n > sizeof(zeros))
+			n = sizeof(zeros);
+		if((ret = pxs->write(p, pxs, n, zeros)) < (ssize_t) n)
+			return(ret < 0 ? ret : (ssize_t) (done + ret));
+		done += n;
+	}
+	return(done);
+}
+/* }}} */
 
 /* Generic file access functions for .db and .px files */
+/* px_cache_write_block() {{{
+ *
+ * Writes a block of the cache into the file. The data in the cache
+ * stays unencrypted, so it can still be used afterwards.
+ */
+static int px_cache_write_block(pxdoc_t *p, pxcacheblock_t *cb) {
+	long blocksize;
+	pxhead_t *pxh;
+	pxstream_t *pxs;
+	unsigned char *data;
+
+	pxh = p->px_head;
+	pxs = p->px_stream;
+	blocksize = pxh->px_maxtablesize * 0x400;
+	data = cb->data;
+	if(pxh->px_encryption != 0) {
+		if(NULL == (data = p->malloc(p, blocksize, _("Allocate memory for encrypted block.")))) {
+			px_error(p, PX_MemoryError, _("Could not allocate memory for encrypted block."));
+			return(-1);
+		}
+//		fprintf(stderr, "Encrypting block %d\n", cb->blocknr);
+		px_encrypt_db_block(cb->data, data, pxh->px_encryption, blocksize, cb->blocknr);
+	}
+	pxs->seek(p, pxs, pxh->px_headersize + ((cb->blocknr-1)*blocksize), SEEK_SET);
+	pxs->write(p, pxs, blocksize, data);
+	if(data != cb->data)
+		p->free(p, data);
+	cb->dirty = px_false;
+	p->px_cachedirty--;
+	return(0);
+}
+/* }}} */
+
+/* px_write_blocks() {{{
+ *
+ * Writes n complete data blocks starting at block number blocknr into
+ * the file without going through the block cache. Copies of the blocks
+ * in the cache are dropped, even if they were modified. This is used
+ * for writing many new blocks, which would otherwise be read into the
+ * cache before being overwritten.
+ */
+int px_write_blocks(pxdoc_t *p, long blocknr, int n, unsigned char *blocks) {
+	long blocksize;
+	pxhead_t *pxh;
+	pxstream_t *pxs;
+	unsigned char *data;
+	int i;
+
+	pxh = p->px_head;
+	pxs = p->px_stream;
+	blocksize = pxh->px_maxtablesize * 0x400;
+	/* Blocks read ahead may become outdated */
+	px_prefetch_stop(p);
+	if(p->px_cache != NULL) {
+		for(i=0; i<p->px_cachesize; i++) {
+			pxcacheblock_t *cb = &p->px_cache[i];
+			if(cb->data != NULL && cb->blocknr >= blocknr && cb->blocknr < blocknr+n) {
+				if(cb->pinned > 0) {
+					px_error(p, PX_RuntimeError, _("Data block nr. %ld cannot be written while it is pinned."), cb->blocknr);
+					return(-1);
+				}
+				if(cb->dirty == px_true)
+					p->px_cachedirty--;
+				cb->dirty = px_false;
+				cb->blocknr = 0;
+			}
+		}
+	}
+
+	data = blocks;
+	if(pxh->px_encryption != 0) {
+		if(NULL == (data = p->malloc(p, n*blocksize, _("Allocate memory for encrypted block.")))) {
+			px_error(p, PX_MemoryError, _("Could not allocate memory for encrypted block."));
+			return(-1);
+		}
+		for(i=0; i<n; i++)
+			px_encrypt_db_block(blocks+i*blocksize, data+i*blocksize, pxh->px_encryption, blocksize, blocknr+i);
+	}
+	if(pxs->seek(p, pxs, pxh->px_headersize + ((blocknr-1)*blocksize), SEEK_SET) < 0 ||
+	   pxs->write(p, pxs, n*blocksize, data) < n*blocksize) {
+		px_error(p, PX_RuntimeError, _("Could not write data block nr. %ld."), blocknr);
+		if(data != blocks)
+			p->free(p, data);
+		return(-1);
+	}
+	if(data != blocks)
+		p->free(p, data);
+	return(0);
+}
+/* }}} */
+
+/* px_read_blocks() {{{
+ *
+ * Reads n complete data blocks starting at block number blocknr with
+ * a single read, without going through the block cache. Modified
+ * blocks in the cache are written before. Encrypted blocks are
+ * decrypted.
+ */
+int px_read_blocks(pxdoc_t *p, long blocknr, int n, unsigned char *blocks) {
+	long blocksize;
+	pxhead_t *pxh;
+	pxstream_t *pxs;
+	int i;
+
+	pxh = p->px_head;
+	pxs = p->px_stream;
+	blocksize = pxh->px_maxtablesize * 0x400;
+	if(p->px_cachedirty > 0 && px_flush(p, pxs) < 0)
+		return(-1);
+
+	if(pxs->seek(p, pxs, pxh->px_headersize + ((blocknr-1)*blocksize), SEEK_SET) < 0 ||
+	   pxs->read(p, pxs, n*blocksize, blocks) < n*blocksize) {
+		px_error(p, PX_RuntimeError, _("Could not read data block nr. %ld."), blocknr);
+		return(-1);
+	}
+	if(pxh->px_encryption != 0) {
+		for(i=0; i<n; i++)
+			px_decrypt_db_block(blocks+i*blocksize, blocks+i*blocksize, pxh->px_encryption, blocksize, blocknr+i);
+	}
+	return(0);
+}
+/* }}} */
+
+/* px_stream_truncate() {{{
+ *
+ * Cuts off the file after size bytes. Only files opened with fopen()
+ * can be truncated.
+ * Returns 0 on success and -1 if the file was not truncated.
+ */
+int px_stream_truncate(pxstream_t *pxs, long size) {
+#if HAVE_UNISTD_H
+	if(pxs->type == pxfIOFile && pxs->s.fp != NULL) {
+		fflush(pxs->s.fp);
+		pxs->dirty = px_false;
+		if(ftruncate(fileno(pxs->s.fp), (off_t) size) == 0)
+			return(0);
+	}
+#endif
+	return(-1);
+}
+/* }}} */
+
+#if HAVE_PTHREAD
+/* Blocks read ahead by the prefetch thread {{{
+ *
+ * The prefetch thread reads the blocks following the block read last
+ * into its own slots and decrypts them. When px_cache_get_block()
+ * needs one of these blocks, the slot's buffer is exchanged with the
+ * buffer of the cache entry. The thread only uses the pread() function
+ * of the stream, which leaves the stream position untouched.
+ */
+#define PX_PREFETCH_FREE    0 /* Slot is unused */
+#define PX_PREFETCH_PENDING 1 /* Block was requested but not read yet */
+#define PX_PREFETCH_LOADING 2 /* Block is being read by the thread */
+#define PX_PREFETCH_READY   3 /* Block has been read and decrypted */
+
+typedef struct px_prefetchslot {
+	long blocknr;
+	int state;
+	unsigned char *data;
+} pxprefetchslot_t;
+
+struct px_prefetch {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;   /* Signals new requests and read blocks */
+	int stop;              /* Set to terminate the thread */
+	int numslots;
+	pxprefetchslot_t *slots;
+	/* Copied from the document, so the thread does not access it */
+	pxdoc_t *pxdoc;
+	pxstream_t *stream;
+	long headersize;
+	long blocksize;
+	unsigned long encryption;
+	/* Blob fields whose data is read ahead from the .MB file */
+	int recordsize;
+	int numblobfields;
+	int *blobleaders;      /* Position of the blob pointer in a record */
+	int mbfd;              /* File descriptor of the .MB file or -1 */
+};
+/* }}} */
+
+/* px_prefetch_blobs() {{{
+ *
+ * Advises the system to read the blob data referenced by the records
+ * of a data block which was just read by the prefetch thread.
+ */
+static void px_prefetch_blobs(pxprefetch_t *pf, unsigned char *block, int mbfd) {
+#if HAVE_POSIX_FADVISE
+	int i, j, numrecords, datasize;
+
+	if(mbfd < 0 || pf->numblobfields == 0)
+		return;
+	datasize = get_short_le_s((const char *) block + 4);
+	if(datasize < 0 || datasize > pf->blocksize - 6 - pf->recordsize)
+		return;
+	numrecords = datasize / pf->recordsize + 1;
+	for(i=0; i<numrecords; i++) {
+		const char *record = (const char *) block + 6 + i*pf->recordsize;
+		for(j=0; j<pf->numblobfields; j++) {
+			long offset = get_long_le(&record[pf->blobleaders[j]]) & 0xffffff00;
+			long size = get_long_le(&record[pf->blobleaders[j]+4]);
+			/* Blobs stored in the record itself have no offset */
+			if(offset > 0 && size > 0)
+				posix_fadvise(mbfd, (off_t) offset, (off_t) size + 17, POSIX_FADV_WILLNEED);
+		}
+	}
+#endif
+}
+/* }}} */
+
+/* px_prefetch_thread() {{{
+ */
+static void *px_prefetch_thread(void *arg) {
+	pxprefetch_t *pf = arg;
+	pxprefetchslot_t *slot;
+	long blocknr;
+	unsigned char *data;
+	ssize_t ret;
+	int i, mbfd;
+
+	pthread_mutex_lock(&pf->mutex);
+	while(!pf->stop) {
+		slot = NULL;
+		for(i=0; i<pf->numslots; i++) {
+			if(pf->slots[i].state == PX_PREFETCH_PENDING) {
+				slot = &pf->slots[i];
+				break;
+			}
+		}
+		if(slot == NULL) {
+			pthread_cond_wait(&pf->cond, &pf->mutex);
+			continue;
+		}
+		slot->state = PX_PREFETCH_LOADING;
+		blocknr = slot->blocknr;
+		data = slot->data;
+		mbfd = pf->mbfd;
+		pthread_mutex_unlock(&pf->mutex);
+
+		ret = pf->stream->pread(pf->pxdoc, pf->stream, pf->headersize + (blocknr-1)*pf->blocksize, pf->blocksize, data);
+		if(ret == pf->blocksize) {
+			if(pf->encryption != 0)
+				px_decrypt_db_block(data, data, pf->encryption, pf->blocksize, blocknr);
+			px_prefetch_blobs(pf, data, mbfd);
+		}
+
+		pthread_mutex_lock(&pf->mutex);
+		slot->state = (ret == pf->blocksize) ? PX_PREFETCH_READY : PX_PREFETCH_FREE;
+		pthread_cond_broadcast(&pf->cond);
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return(NULL);
+}
+/* }}} */
+
+/* px_prefetch_free() {{{
+ *
+ * Frees the memory of a prefetcher whose thread is not running.
+ */
+static void px_prefetch_free(pxdoc_t *p, pxprefetch_t *pf) {
+	int i;
+
+	if(pf->slots) {
+		for(i=0; i<pf->numslots; i++)
+			p->free(p, pf->slots[i].data);
+		p->free(p, pf->slots);
+	}
+	if(pf->blobleaders)
+		p->free(p, pf->blobleaders);
+	p->free(p, pf);
+}
+/* }}} */
+
+/* px_prefetch_start() {{{
+ *
+ * Starts the thread reading blocks ahead. Returns NULL if the stream
+ * cannot be read at an offset or the thread cannot be created.
+ */
+static pxprefetch_t *px_prefetch_start(pxdoc_t *p) {
+	pxhead_t *pxh;
+	pxprefetch_t *pf;
+	int i, offset;
+
+	pxh = p->px_head;
+	if(pxh == NULL || p->px_stream == NULL || p->px_stream->pread == NULL)
+		return(NULL);
+
+	if(NULL == (pf = p->malloc(p, sizeof(pxprefetch_t), _("Allocate memory for prefetching of blocks.")))) {
+		px_error(p, PX_MemoryError, _("Could not allocate memory for prefetching of blocks."));
+		return(NULL);
+	}
+	memset(pf, 0, sizeof(pxprefetch_t));
+	pf->pxdoc = p;
+	pf->stream = p->px_stream;
+	pf->headersize = pxh->px_headersize;
+	pf->blocksize = pxh->px_maxtablesize * 0x400;
+	pf->encryption = pxh->px_encryption;
+	pf->recordsize = pxh->px_recordsize;
+	pf->mbfd = -1;
+
+	pf->numslots = p->px_prefetchsize;
+	if(NULL == (pf->slots = p->malloc(p, pf->numslots*sizeof(pxprefetchslot_t), _("Allocate memory for prefetching of blocks.")))) {
+		px_error(p, PX_MemoryError, _("Could not allocate memory for prefetching of blocks."));
+		p->free(p, pf);
+		return(NULL);
+	}
+	memset(pf->slots, 0, pf->numslots*sizeof(pxprefetchslot_t));
+	for(i=0; i<pf->numslots; i++) {
+		if(NULL == (pf->slots[i].data = p->malloc(p, pf->blocksize, _("Allocate memory for prefetching of blocks.")))) {
+			px_error(p, PX_MemoryError, _("Could not allocate memory for prefetching of blocks."));
+			pf->numslots = i;
+			px_prefetch_free(p, pf);
+			return(NULL);
+		}
+	}
+
+	/* Remember where the pointers to the data of blob fields are */
+	if(pxh->px_fields != NULL) {
+		if(NULL == (pf->blobleaders = p->malloc(p, (pxh->px_numfields+1)*sizeof(int), _("Allocate memory for prefetching of blobs.")))) {
+			px_error(p, PX_MemoryError, _("Could not allocate memory for prefetching of blobs."));
+			px_prefetch_free(p, pf);
+			return(NULL);
+		}
+		offset = 0;
+		for(i=0; i<pxh->px_numfields; i++) {
+			switch(pxh->px_fields[i].px_ftype) {
+				case pxfMemoBLOb:
+				case pxfBLOb:
+				case pxfFmtMemoBLOb:
+				case pxfOLE:
+				case pxfGraphic:
+					pf->blobleaders[pf->numblobfields++] = offset + pxh->px_fields[i].px_flen - 10;
+					break;
+			}
+			offset += pxh->px_fields[i].px_flen;
+		}
+	}
+
+	pthread_mutex_init(&pf->mutex, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+	if(pthread_create(&pf->thread, NULL, px_prefetch_thread, pf) != 0) {
+		px_error(p, PX_RuntimeError, _("Could not start thread for prefetching of blocks."));
+		pthread_mutex_destroy(&pf->mutex);
+		pthread_cond_destroy(&pf->cond);
+		px_prefetch_free(p, pf);
+		return(NULL);
+	}
+	return(pf);
+}
+/* }}} */
+
+/* px_prefetch_schedule() {{{
+ *
+ * Requests the blocks following block 'blocknr' in the chain of data
+ * blocks. Blocks already in the cache are skipped. Blocks read ahead
+ * which are not needed anymore are dropped.
+ */
+static void px_prefetch_schedule(pxdoc_t *p, long blocknr) {
+	pxprefetch_t *pf;
+	long wanted[PX_MAX_PREFETCH];
+	int numwanted, pos, i, j;
+
+	if(p->px_prefetchsize <= 0 || p->px_blockdir == NULL)
+		return;
+	/* Do not read ahead while the file differs from the cache */
+	if(p->px_cachedirty > 0 || p->px_stream->dirty)
+		return;
+
+	/* Follow the chain of blocks starting after blocknr */
+	numwanted = 0;
+	while(numwanted < p->px_prefetchsize && blocknr > 0 && blocknr <= p->px_blockdirsize) {
+		if((pos = p->px_blockdirmap[blocknr-1]) < 0)
+			break;
+		blocknr = p->px_blockdir[pos].next;
+		if(blocknr <= 0)
+			break;
+		for(i=0; i<p->px_cachesize; i++) {
+			if(p->px_cache[i].data != NULL && p->px_cache[i].blocknr == blocknr)
+				break;
+		}
+		if(i == p->px_cachesize)
+			wanted[numwanted] = blocknr;
+		else
+			wanted[numwanted] = 0;
+		numwanted++;
+	}
+
+	if(p->px_prefetch == NULL) {
+		for(i=0; i<numwanted; i++)
+			if(wanted[i] > 0)
+				break;
+		if(i == numwanted)
+			return;
+		if(NULL == (p->px_prefetch = px_prefetch_start(p)))
+			return;
+	}
+	pf = p->px_prefetch;
+
+	pthread_mutex_lock(&pf->mutex);
+	if(p->px_blob && p->px_blob->mb_stream && p->px_blob->mb_stream->type == pxfIOFile)
+		pf->mbfd = fileno(p->px_blob->mb_stream->s.fp);
+	else
+		pf->mbfd = -1;
+	/* Drop blocks which are not wanted anymore */
+	for(j=0; j<pf->numslots; j++) {
+		if(pf->slots[j].state == PX_PREFETCH_PENDING || pf->slots[j].state == PX_PREFETCH_READY) {
+			for(i=0; i<numwanted; i++) {
+				if(wanted[i] == pf->slots[j].blocknr)
+					break;
+			}
+			if(i == numwanted)
+				pf->slots[j].state = PX_PREFETCH_FREE;
+		}
+	}
+	/* Request the blocks which are not already read ahead */
+	for(i=0; i<numwanted; i++) {
+		int freeslot = -1;
+
+		if(wanted[i] == 0)
+			continue;
+		for(j=0; j<pf->numslots; j++) {
+			if(pf->slots[j].state != PX_PREFETCH_FREE && pf->slots[j].blocknr == wanted[i])
+				break;
+			if(freeslot < 0 && pf->slots[j].state == PX_PREFETCH_FREE)
+				freeslot = j;
+		}
+		if(j < pf->numslots)
+			continue;
+		if(freeslot < 0)
+			break;
+		pf->slots[freeslot].blocknr = wanted[i];
+		pf->slots[freeslot].state = PX_PREFETCH_PENDING;
+	}
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+}
+/* }}} */
+
+/* px_prefetch_take() {{{
+ *
+ * Moves a block read ahead into the given cache entry. Waits if the
+ * block is currently being read. Returns 1 if the block was taken,
+ * otherwise 0.
+ */
+static int px_prefetch_take(pxdoc_t *p, long blocknr, pxcacheblock_t *cb) {
+	pxprefetch_t *pf;
+	pxprefetchslot_t *slot;
+	unsigned char *tmp;
+	int i, ret;
+
+	if(NULL == (pf = p->px_prefetch))
+		return(0);
+
+	pthread_mutex_lock(&pf->mutex);
+	slot = NULL;
+	for(i=0; i<pf->numslots; i++) {
+		if(pf->slots[i].state != PX_PREFETCH_FREE && pf->slots[i].blocknr == blocknr) {
+			slot = &pf->slots[i];
+			break;
+		}
+	}
+	ret = 0;
+	if(slot != NULL) {
+		if(slot->state == PX_PREFETCH_PENDING) {
+			/* Not started yet, read it right away */
+			slot->state = PX_PREFETCH_FREE;
+		} else {
+			while(slot->state == PX_PREFETCH_LOADING)
+				pthread_cond_wait(&pf->cond, &pf->mutex);
+			if(slot->state == PX_PREFETCH_READY && slot->blocknr == blocknr) {
+				tmp = cb->data;
+				cb->data = slot->data;
+				slot->data = tmp;
+				slot->state = PX_PREFETCH_FREE;
+				ret = 1;
+			}
+		}
+	}
+	pthread_mutex_unlock(&pf->mutex);
+	return(ret);
+}
+/* }}} */
+#endif
+
+/* px_prefetch_stop() {{{
+ *
+ * Terminates the thread reading blocks ahead and drops all blocks
+ * read by it.
+ */
+void px_prefetch_stop(pxdoc_t *p) {
+#if HAVE_PTHREAD
+	pxprefetch_t *pf;
+
+	if(NULL == (pf = p->px_prefetch))
+		return;
+	pthread_mutex_lock(&pf->mutex);
+	pf->stop = 1;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->mutex);
+	pthread_join(pf->thread, NULL);
+	pthread_mutex_destroy(&pf->mutex);
+	pthread_cond_destroy(&pf->cond);
+	px_prefetch_free(p, pf);
+	p->px_prefetch = NULL;
+#endif
+}
+/* }}} */
+
+/* px_prefetch_resize() {{{
+ *
+ * Sets the number of blocks read ahead. 0 disables reading ahead.
+ */
+int px_prefetch_resize(pxdoc_t *p, int size) {
+#if HAVE_PTHREAD
+	if(size < 0 || size > PX_MAX_PREFETCH) {
+		px_error(p, PX_Warning, _("The number of blocks to read ahead must be between 0 and %d."), PX_MAX_PREFETCH);
+		return(-1);
+	}
+	px_prefetch_stop(p);
+	p->px_prefetchsize = size;
+	return(0);
+#else
+	px_error(p, PX_Warning, _("Reading blocks ahead is not supported without threads."));
+	return(-1);
+#endif
+}
+/* }}} */
+
+/* px_cache_get_block() {{{
+ *
+ * Returns the cache entry for the given block. If the block is not in
+ * the cache, the least recently used entry will be replaced by it.
+ * A modified block is written back into the file before it is
+ * replaced. The block is decrypted once when it is read into the cache.
+ */
+static pxcacheblock_t *px_cache_get_block(pxdoc_t *p, long blocknr) {
+	long blocksize;
+	pxhead_t *pxh;
+	pxstream_t *pxs;
+	pxcacheblock_t *cb;
+	int i, lru;
+
+	pxh = p->px_head;
+	pxs = p->px_stream;
+	blocksize = pxh->px_maxtablesize * 0x400;
+
+	if(p->px_cache == NULL) {
+		if(p->px_cachesize <= 0)
+			p->px_cachesize = PX_DEFAULT_BLOCKCACHE;
+		if(NULL == (p->px_cache = p->malloc(p, p->px_cachesize*sizeof(pxcacheblock_t), _("Allocate memory for block cache.")))) {
+			px_error(p, PX_MemoryError, _("Could not allocate memory for block cache."));
+			return(NULL);
+		}
+		memset(p->px_cache, 0, p->px_cachesize*sizeof(pxcacheblock_t));
+		p->px_cachelast = 0;
+	}
+
+	p->px_cacheclock++;
+
+	/* The block accessed last is the most likely one */
+	cb = &p->px_cache[p->px_cachelast];
+	if(cb->blocknr == blocknr && cb->data != NULL) {
+		cb->lastuse = p->px_cacheclock;
+		return(cb);
+	}
+
+	lru = -1;
+	for(i=0; i<p->px_cachesize; i++) {
+		cb = &p->px_cache[i];
+		if(cb->blocknr == blocknr && cb->data != NULL) {
+			cb->lastuse = p->px_cacheclock;
+			p->px_cachelast = i;
+			return(cb);
+		}
+		if(cb->pinned == 0 && (lru < 0 || cb->lastuse < p->px_cache[lru].lastuse))
+			lru = i;
+	}
+
+	/* Replace the least recently used block which is not pinned */
+	if(lru < 0) {
+		px_error(p, PX_RuntimeError, _("All blocks in the cache are pinned."));
+		return(NULL);
+	}
+	cb = &p->px_cache[lru];
+	if(cb->data == NULL) {
+//		fprintf(stderr, "Allocate memory for cache block.\n");
+		if(NULL == (cb->data = p->malloc(p, blocksize, _("Allocate memory for block cache.")))) {
+			px_error(p, PX_MemoryError, _("Could not allocate memory for block cache."));
+			return(NULL);
+		}
+	} else if(cb->dirty == px_true) {
+//		fprintf(stderr, "Write block %d from cache into file.\n", cb->blocknr);
+		if(px_cache_write_block(p, cb) < 0)
+			return(NULL);
+	}
+
+#if HAVE_PTHREAD
+	if(!px_prefetch_take(p, blocknr, cb)) {
+#endif
+//	fprintf(stderr, "Read block %d into cache.\n", blocknr);
+	memset(cb->data, 0, blocksize);
+	pxs->seek(p, pxs, pxh->px_headersize + ((blocknr-1)*blocksize), SEEK_SET);
+	pxs->read(p, pxs, blocksize, cb->data);
+	if(pxh->px_encryption != 0) {
+//		fprintf(stderr, "Decrypting block %d\n", blocknr);
+		px_decrypt_db_block(cb->data, cb->data, pxh->px_encryption, blocksize, blocknr);
+	}
+#if HAVE_PTHREAD
+	}
+#endif
+	cb->blocknr = blocknr;
+	cb->dirty = px_false;
+	cb->lastuse = p->px_cacheclock;
+	p->px_cachelast = lru;
+#if HAVE_PTHREAD
+	px_prefetch_schedule(p, blocknr);
+#endif
+	return(cb);
+}
+/* }}} */
+
+/* px_cache_resize() {{{
+ *
+ * Sets the number of blocks kept in the cache. All modified blocks
+ * are written into the file before the cache is resized.
+ */
+int px_cache_resize(pxdoc_t *p, int size) {
+	if(size < 1) {
+		px_error(p, PX_Warning, _("The block cache must hold at least one block."));
+		return(-1);
+	}
+	if(p->px_cachepinned > 0) {
+		px_error(p, PX_Warning, _("The block cache cannot be resized while blocks are pinned."));
+		return(-1);
+	}
+	if(px_flush(p, p->px_stream) < 0)
+		return(-1);
+	px_cache_free(p);
+	p->px_cachesize = size;
+	return(0);
+}
+/* }}} */
+
+/* px_cache_free() {{{
+ *
+ * Frees the memory of the cache without writing modified blocks.
+ */
+void px_cache_free(pxdoc_t *p) {
+	int i;
+
+	if(p->px_cache == NULL)
+		return;
+	for(i=0; i<p->px_cachesize; i++) {
+		if(p->px_cache[i].data)
+			p->free(p, p->px_cache[i].data);
+	}
+	p->free(p, p->px_cache);
+	p->px_cache = NULL;
+	p->px_cachedirty = 0;
+	p->px_cachepinned = 0;
+}
+/* }}} */
+
+/* px_cache_pin() {{{
+ *
+ * Returns a pointer to len bytes at the given offset of the file
+ * within the block cache. The block is pinned and will not be removed
+ * from the cache until px_cache_unpin() is called. Unencrypted memory
+ * mapped files are not read into the cache, the pointer points into
+ * the mapping instead.
+ */
+unsigned char *px_cache_pin(pxdoc_t *p, long offset, size_t len) {
+	long blocknr, blockpos, blocksize;
+	pxhead_t *pxh;
+	pxcacheblock_t *cb;
+	unsigned char *data;
+
+	pxh = p->px_head;
+	if(NULL != (data = px_stream_mapping(p, offset, len)))
+		return(data);
+
+	if(pxh == NULL || offset < pxh->px_headersize) {
+		px_error(p, PX_RuntimeError, _("Only data in data blocks can be pinned."));
+		return(NULL);
+	}
+	blocksize = pxh->px_maxtablesize * 0x400;
+	blocknr = ((offset - pxh->px_headersize) / blocksize) + 1;
+	blockpos = (offset - pxh->px_headersize) % blocksize;
+	if(blockpos+len > blocksize) {
+		px_error(p, PX_RuntimeError, _("Trying to read data from file exceeds block boundary."));
+		return(NULL);
+	}
+	if(NULL == (cb = px_cache_get_block(p, blocknr))) {
+		return(NULL);
+	}
+	if(cb->pinned == 0)
+		p->px_cachepinned++;
+	cb->pinned++;
+	return(cb->data+blockpos);
+}
+/* }}} */
+
+/* px_cache_unpin() {{{
+ *
+ * Releases a pointer returned by px_cache_pin(). The block it points
+ * into may be removed from the cache once it is no longer pinned.
+ */
+void px_cache_unpin(pxdoc_t *p, const unsigned char *data) {
+	long blocksize;
+	pxcacheblock_t *cb;
+	int i;
+
+	if(p->px_cache == NULL || p->px_head == NULL || data == NULL)
+		return;
+	blocksize = p->px_head->px_maxtablesize * 0x400;
+	for(i=0; i<p->px_cachesize; i++) {
+		cb = &p->px_cache[i];
+		if(cb->pinned > 0 && data >= cb->data && data < cb->data+blocksize) {
+			cb->pinned--;
+			if(cb->pinned == 0)
+				p->px_cachepinned--;
+			return;
+		}
+	}
+}
+/* }}} */
+
 /* px_read() {{{
  *
  * Generic read function doing decryption if needed.
@@ -92,10 +948,18 @@ ssize_t px_read(pxdoc_t *p, pxstream_t *dummy, size_t len, void *buffer) {
 	long blocknr, blockpos, curpos, blocksize;
 	pxhead_t *pxh;
 	pxstream_t *pxs;
+	pxcacheblock_t *cb;
 
 	pxh = p->px_head;
 	pxs = p->px_stream;
 
+	/* Unencrypted memory mapped files do not need the block cache,
+	 * because the data is just copied from the mapping.
+	 */
+	if(pxs->type == pxfIOMmap && (pxh == NULL || pxh->px_encryption == 0)) {
+		return(pxs->read(p, pxs, len, buffer));
+	}
+
 	curpos = pxs->tell(p, pxs);
 	if(pxh != NULL && curpos >= pxh->px_headersize) {
 		blocksize = pxh->px_maxtablesize * 0x400;
@@ -106,36 +970,10 @@ ssize_t px_read(pxdoc_t *p, pxstream_t *dummy, size_t len, void *buffer) {
 			px_error(p, PX_RuntimeError, _("Trying to read data from file exceeds block boundary."));
 			return(0);
 		}
-		if(p->curblock == NULL) {
-//			fprintf(stderr, "Allocate memory for cache block.\n");
-			p->curblock = p->malloc(p, blocksize, _("Allocate memory for block cache."));
-			if(p->curblock == NULL) {
-				return(0);
-			}
-			
-		}
-		if(p->curblocknr != blocknr) {
-//			fprintf(stderr, "Read block %d into cache.\n", blocknr);
-			if(p->curblockdirty == px_true) {
-				pxs->seek(p, pxs, pxh->px_headersize + ((p->curblocknr-1)*blocksize), SEEK_SET);
-				if(pxh->px_encryption != 0) {
-	//				fprintf(stderr, "Encrypting block %d\n", p->curblocknr);
-					px_encrypt_db_block(p->curblock, p->curblock, pxh->px_encryption, blocksize, p->curblocknr);
-				}
-				pxs->write(p, pxs, blocksize, p->curblock);
-			}
-			memset(p->curblock, 0, blocksize);
-			pxs->seek(p, pxs, pxh->px_headersize + ((blocknr-1)*blocksize), SEEK_SET);
-			pxs->read(p, pxs, blocksize, p->curblock);
-			p->curblocknr = blocknr;
-			if(pxh->px_encryption != 0) {
-//				fprintf(stderr, "Decrypting block %d\n", blocknr);
-				px_decrypt_db_block(p->curblock, p->curblock, pxh->px_encryption, blocksize, blocknr);
-			}
-		} else {
-//			fprintf(stderr, "block %d already in cache.\n", blocknr);
+		if(NULL == (cb = px_cache_get_block(p, blocknr))) {
+			return(0);
 		}
-		memcpy(buffer, p->curblock+blockpos, len);
+		memcpy(buffer, cb->data+blockpos, len);
 		pxs->seek(p, pxs, curpos + (long)len, SEEK_SET);
 		ret = len;
 	} else {
@@ -160,15 +998,22 @@ long px_tell(pxdoc_t *p, pxstream_t *dummy) {
 /* }}} */
 
 /* px_write() {{{
+ *
+ * Generic write function. Data blocks are modified in the cache and
+ * written into the file when they are removed from the cache or
+ * when px_flush() is called.
  */
 ssize_t px_write(pxdoc_t *p, pxstream_t *dummy, size_t len, void *buffer) {
 	size_t ret;
 	long blocknr, blockpos, curpos, blocksize;
 	pxhead_t *pxh;
 	pxstream_t *pxs;
+	pxcacheblock_t *cb;
 
 	pxh = p->px_head;
 	pxs = p->px_stream;
+	/* Blocks read ahead may become outdated */
+	px_prefetch_stop(p);
 	curpos = pxs->tell(p, pxs);
 	if(pxh != NULL && curpos >= pxh->px_headersize) {
 		blocksize = pxh->px_maxtablesize * 0x400;
@@ -179,42 +1024,17 @@ ssize_t px_write(pxdoc_t *p, pxstream_t *dummy, size_t len, void *buffer) {
 			px_error(p, PX_RuntimeError, _("Trying to write data to file exceeds block boundary: %d + %d > %d."), blockpos, len, blocksize);
 			return(0);
 		}
-		if(p->curblock == NULL) {
-//			fprintf(stderr, "Allocate memory for cache block.\n");
-			p->curblock = p->malloc(p, blocksize, _("Allocate memory for block cache."));
-			if(p->curblock == NULL) {
-				return(0);
-			}
-		}
-		/* Write last accessed block to disk if the write operation modifies
-		 * a new block.
-		 * No need to write, if this is the first time a write operation
-		 * modifies a block. Blocks will be written to the file, when
-		 * a new block is accessed.
+		/* The block is read into the cache, just in case it has been in
+		 * the file already.
 		 */
-		if(p->curblocknr != blocknr && p->curblocknr != 0) {
-//			fprintf(stderr, "Write block %d from cache into file.\n", p->curblocknr);
-			if(p->curblockdirty == px_true) {
-				pxs->seek(p, pxs, pxh->px_headersize + ((p->curblocknr-1)*blocksize), SEEK_SET);
-				if(pxh->px_encryption != 0) {
-	//				fprintf(stderr, "Encrypting block %d\n", p->curblocknr);
-					px_encrypt_db_block(p->curblock, p->curblock, pxh->px_encryption, blocksize, p->curblocknr);
-				}
-				pxs->write(p, pxs, blocksize, p->curblock);
-			}
-			memset(p->curblock, 0, blocksize);
-			/* Read the new block, just in case it has been in the file already */
-			pxs->seek(p, pxs, pxh->px_headersize + ((blocknr-1)*blocksize), SEEK_SET);
-			pxs->read(p, pxs, blocksize, p->curblock);
-			if(pxh->px_encryption != 0) {
-				px_decrypt_db_block(p->curblock, p->curblock, pxh->px_encryption, blocksize, blocknr);
-			}
-		} else {
-//			fprintf(stderr, "block %d already in cache.\n", blocknr);
+		if(NULL == (cb = px_cache_get_block(p, blocknr))) {
+			return(0);
+		}
+		if(cb->dirty == px_false) {
+			cb->dirty = px_true;
+			p->px_cachedirty++;
 		}
-		p->curblocknr = blocknr;
-		p->curblockdirty = px_true;
-		memcpy(p->curblock+blockpos, buffer, len);
+		memcpy(cb->data+blockpos, buffer, len);
 		pxs->seek(p, pxs, curpos + (long)len, SEEK_SET);
 		ret = len;
 	} else {
@@ -224,32 +1044,124 @@ ssize_t px_write(pxdoc_t *p, pxstream_t *dummy, size_t len, void *buffer) {
 }
 /* }}} */
 
-/* px_flush() {{{
+/* px_extend() {{{
+ *
+ * Writes len zero bytes at the current position. Data blocks are
+ * cleared in the cache at once instead of writing byte by byte.
  */
-int px_flush(pxdoc_t *p, pxstream_t *dummy) {
-	long blocksize;
+ssize_t px_extend(pxdoc_t *p, pxstream_t *dummy, size_t len) {
+	long blocknr, blockpos, curpos, blocksize;
 	pxhead_t *pxh;
 	pxstream_t *pxs;
+	pxcacheblock_t *cb;
 
 	pxh = p->px_head;
 	pxs = p->px_stream;
-	if(pxh != NULL) {
+	/* Blocks read ahead may become outdated */
+	px_prefetch_stop(p);
+	curpos = pxs->tell(p, pxs);
+	if(pxh != NULL && curpos >= pxh->px_headersize) {
 		blocksize = pxh->px_maxtablesize * 0x400;
-		if(p->curblockdirty) {
-//			fprintf(stderr, "Write block %d from cache into file.\n", p->curblocknr);
-			pxs->seek(p, pxs, pxh->px_headersize + ((p->curblocknr-1)*blocksize), SEEK_SET);
-			if(pxh->px_encryption != 0) {
-//				fprintf(stderr, "Encrypting block %d\n", p->curblocknr);
-				px_encrypt_db_block(p->curblock, p->curblock, pxh->px_encryption, blocksize, p->curblocknr);
+		blocknr = ((curpos - pxh->px_headersize) / blocksize) + 1;
+		blockpos = (curpos - pxh->px_headersize) % blocksize;
+		if(blockpos+len > blocksize) {
+			px_error(p, PX_RuntimeError, _("Trying to write data to file exceeds block boundary: %d + %d > %d."), blockpos, len, blocksize);
+			return(0);
+		}
+		if(NULL == (cb = px_cache_get_block(p, blocknr))) {
+			return(0);
+		}
+		if(cb->dirty == px_false) {
+			cb->dirty = px_true;
+			p->px_cachedirty++;
+		}
+		memset(cb->data+blockpos, 0, len);
+		pxs->seek(p, pxs, curpos + (long)len, SEEK_SET);
+		return(len);
+	}
+	return(px_stream_extend(p, pxs, len));
+}
+/* }}} */
+
+/* px_flush() {{{
+ *
+ * Writes all modified blocks in the cache into the file.
+ */
+int px_flush(pxdoc_t *p, pxstream_t *dummy) {
+	pxhead_t *pxh;
+	int i;
+
+	pxh = p->px_head;
+	if(pxh != NULL && p->px_cache != NULL) {
+		for(i=0; i<p->px_cachesize; i++) {
+			if(p->px_cache[i].data && p->px_cache[i].dirty) {
+//				fprintf(stderr, "Write block %d from cache into file.\n", p->px_cache[i].blocknr);
+				if(px_cache_write_block(p, &p->px_cache[i]) < 0)
+					return(-1);
 			}
-			pxs->write(p, pxs, blocksize, p->curblock);
-			p->curblockdirty = px_false;
 		}
 	}
 	return(0);
 }
 /* }}} */
 
+/* px_pread() {{{
+ *
+ * Reads data at the given offset of the file without using the
+ * current position of the stream and the block cache. This makes
+ * it possible to read from several threads at the same time, as
+ * long as the file is not modified. If the stream cannot read at
+ * an offset, if there are modified blocks in the cache or if blocks
+ * are read ahead, the data is read with px_read() instead.
+ */
+ssize_t px_pread(pxdoc_t *p, pxstream_t *dummy, long offset, size_t len, void *buffer) {
+	long blocknr, blockpos, blocksize, chunkpos, chunklen;
+	pxhead_t *pxh;
+	pxstream_t *pxs;
+	unsigned char *tmpbuf;
+	ssize_t ret;
+
+	pxh = p->px_head;
+	pxs = p->px_stream;
+
+	if(pxs->pread == NULL || p->px_cachedirty > 0 || p->px_prefetchsize > 0) {
+		if(pxs->seek(p, pxs, offset, SEEK_SET) < 0)
+			return(-1);
+		return(px_read(p, pxs, len, buffer));
+	}
+
+	if(pxh == NULL || pxh->px_encryption == 0 || offset < pxh->px_headersize) {
+		return(pxs->pread(p, pxs, offset, len, buffer));
+	}
+
+	/* Encrypted data blocks are decrypted in chunks of 256 bytes. Read
+	 * all chunks containing the requested data into a private buffer.
+	 */
+	blocksize = pxh->px_maxtablesize * 0x400;
+	blocknr = ((offset - pxh->px_headersize) / blocksize) + 1;
+	blockpos = (offset - pxh->px_headersize) % blocksize;
+	if(blockpos+len > blocksize) {
+		px_error(p, PX_RuntimeError, _("Trying to read data from file exceeds block boundary."));
+		return(0);
+	}
+	chunkpos = (blockpos >> 8) << 8;
+	chunklen = (((blockpos + (long) len - chunkpos) + 0xff) >> 8) << 8;
+	if(NULL == (tmpbuf = p->malloc(p, chunklen, _("Allocate memory for encrypted data.")))) {
+		px_error(p, PX_MemoryError, _("Could not allocate memory for encrypted data."));
+		return(-1);
+	}
+	ret = pxs->pread(p, pxs, offset - blockpos + chunkpos, chunklen, tmpbuf);
+	if(ret < chunklen) {
+		p->free(p, tmpbuf);
+		return(ret < 0 ? ret : 0);
+	}
+	px_decrypt_db_chunks(tmpbuf, tmpbuf, pxh->px_encryption, chunkpos, chunklen, blocknr);
+	memcpy(buffer, tmpbuf + (blockpos - chunkpos), len);
+	p->free(p, tmpbuf);
+	return(len);
+}
+/* }}} */
+
 /* Generic file access functions for .mb */
 /* px_mb_read() {{{
  *
@@ -348,6 +1260,58 @@ ssize_t px_mb_read(pxblob_t *p, pxstream_t *dummy, size_t len, void *buffer) {
 }
 /* }}} */
 
+/* px_mb_pread() {{{
+ *
+ * Reads data at the given offset of the blob file without using the
+ * current position of the stream and the block cache of the blob
+ * file. Encrypted data is decrypted in a private buffer.
+ */
+ssize_t px_mb_pread(pxblob_t *p, pxstream_t *dummy, long offset, size_t len, void *buffer) {
+	pxdoc_t *pxdoc;
+	pxhead_t *pxh;
+	pxstream_t *pxs;
+	unsigned char *tmpbuf;
+	long blockoffset, blockslen;
+	ssize_t ret;
+
+	pxdoc = p->pxdoc;
+	pxh = pxdoc->px_head;
+	pxs = p->mb_stream;
+
+	if(pxs->pread == NULL) {
+		if(pxs->seek(pxdoc, pxs, offset, SEEK_SET) < 0)
+			return(-1);
+		return(px_mb_read(p, pxs, len, buffer));
+	}
+
+	if(pxh->px_encryption == 0)
+		return(pxs->pread(pxdoc, pxs, offset, len, buffer));
+
+	blockoffset = (offset >> BLOCKSIZEEXP) << BLOCKSIZEEXP;
+	blockslen = ((offset + (long) len - blockoffset + (1 << BLOCKSIZEEXP) - 1) >> BLOCKSIZEEXP) << BLOCKSIZEEXP;
+	if(NULL == (tmpbuf = pxdoc->malloc(pxdoc, blockslen, _("Allocate memory for encrypted blob data.")))) {
+		px_error(pxdoc, PX_MemoryError, _("Could not allocate memory for encrypted blob data."));
+		return(-1);
+	}
+	ret = pxs->pread(pxdoc, pxs, blockoffset, blockslen, tmpbuf);
+	if(ret <= 0) {
+		pxdoc->free(pxdoc, tmpbuf);
+		return(ret);
+	}
+	px_decrypt_mb_block(tmpbuf, tmpbuf, pxh->px_encryption, blockslen);
+	memcpy(buffer, tmpbuf + (offset - blockoffset), len);
+	pxdoc->free(pxdoc, tmpbuf);
+	return(len);
+}
+/* }}} */
+
+/* px_mb_extend() {{{
+ */
+ssize_t px_mb_extend(pxblob_t *p, pxstream_t *dummy, size_t len) {
+	return(px_stream_extend(p->pxdoc, p->mb_stream, len));
+}
+/* }}} */
+
 /* px_mb_seek() {{{
  */
 int px_mb_seek(pxblob_t *p, pxstream_t *dummy, long offset, int whence) {
@@ -394,10 +1358,100 @@ long px_ftell(pxdoc_t *p, pxstream_t *stream) {
 /* px_fwrite() {{{
  */
 ssize_t px_fwrite(pxdoc_t *p, pxstream_t *stream, size_t len, void *buffer) {
+	stream->dirty = px_true;
 	return(fwrite(buffer, 1, len, stream->s.fp));
 }
 /* }}} */
 
+#if HAVE_PREAD
+/* px_fpread() {{{
+ *
+ * Reads from the file descriptor of the stream at the given offset.
+ * Data still in the buffer of the stream is written into the file
+ * before.
+ */
+ssize_t px_fpread(pxdoc_t *p, pxstream_t *stream, long offset, size_t len, void *buffer) {
+	if(stream->dirty) {
+		fflush(stream->s.fp);
+		stream->dirty = px_false;
+	}
+	return(pread(fileno(stream->s.fp), buffer, len, (off_t) offset));
+}
+/* }}} */
+#endif
+
+/* memory mapped file */
+/* px_mmapread() {{{
+ */
+ssize_t px_mmapread(pxdoc_t *p, pxstream_t *stream, size_t len, void *buffer) {
+	size_t avail;
+
+	if(stream->mappos < 0 || (size_t) stream->mappos >= stream->mapsize)
+		return(0);
+	avail = stream->mapsize - (size_t) stream->mappos;
+	if(len > avail)
+		len = avail;
+	memcpy(buffer, stream->mapdata + stream->mappos, len);
+	stream->mappos += (long) len;
+	return(len);
+}
+/* }}} */
+
+/* px_mmapseek() {{{
+ */
+int px_mmapseek(pxdoc_t *p, pxstream_t *stream, long offset, int whence) {
+	long pos;
+
+	switch(whence) {
+		case SEEK_SET:
+			pos = offset;
+			break;
+		case SEEK_CUR:
+			pos = stream->mappos + offset;
+			break;
+		case SEEK_END:
+			pos = (long) stream->mapsize + offset;
+			break;
+		default:
+			return(-1);
+	}
+	if(pos < 0)
+		return(-1);
+	stream->mappos = pos;
+	return(0);
+}
+/* }}} */
+
+/* px_mmaptell() {{{
+ */
+long px_mmaptell(pxdoc_t *p, pxstream_t *stream) {
+	return(stream->mappos);
+}
+/* }}} */
+
+/* px_mmapwrite() {{{
+ */
+ssize_t px_mmapwrite(pxdoc_t *p, pxstream_t *stream, size_t len, void *buffer) {
+	px_error(p, PX_RuntimeError, _("Memory mapped files can only be read."));
+	return(0);
+}
+/* }}} */
+
+/* px_mmappread() {{{
+ */
+ssize_t px_mmappread(pxdoc_t *p, pxstream_t *stream, long offset, size_t len, void *buffer) {
+	size_t avail;
+
+	if(offset < 0 || (size_t) offset >= stream->mapsize)
+		return(0);
+	avail = stream->mapsize - (size_t) offset;
+	if(len > avail)
+		len = avail;
+	memcpy(buffer, stream->mapdata + offset, len);
+	return(len);
+}
+/* }}} */
+
 /* gsf */
 #if HAVE_GSF
 /* px_gsfread() {{{
@@ -1,26 +1,62 @@
 #ifndef __PX_IO_H__
 #define __PX_IO_H__
+
+/* Number of data blocks kept in the cache unless set otherwise with
+ * PX_set_value(pxdoc, "blockcache", n) */
+#define PX_DEFAULT_BLOCKCACHE 8
+/* Maximum number of data blocks read ahead, set with
+ * PX_set_value(pxdoc, "prefetch", n) */
+#define PX_MAX_PREFETCH 64
+
 pxstream_t *px_stream_new(pxdoc_t *pxdoc);
 #if HAVE_GSF
 pxstream_t *px_stream_new_gsf(pxdoc_t *pxdoc, int mode, int close, GsfInput *gsf);
 #endif
 pxstream_t *px_stream_new_file(pxdoc_t *pxdoc, int mode, int close, FILE *fp);
+#if HAVE_SYS_MMAN_H
+pxstream_t *px_stream_new_mmap(pxdoc_t *pxdoc, int mode, int close, FILE *fp);
+#endif
+void px_stream_unmap(pxdoc_t *pxdoc, pxstream_t *pxs);
+unsigned char *px_stream_mapping(pxdoc_t *p, long pos, size_t len);
+ssize_t px_stream_extend(pxdoc_t *p, pxstream_t *pxs, size_t len);
+int px_stream_truncate(pxstream_t *pxs, long size);
 
 ssize_t px_read(pxdoc_t *p, pxstream_t *dummy, size_t len, void *buffer);
 int px_seek(pxdoc_t *p, pxstream_t *dummy, long offset, int whence);
 long px_tell(pxdoc_t *p, pxstream_t *dummy);
 ssize_t px_write(pxdoc_t *p, pxstream_t *dummy, size_t len, void *buffer);
 int px_flush(pxdoc_t *p, pxstream_t *dummy);
+ssize_t px_pread(pxdoc_t *p, pxstream_t *dummy, long offset, size_t len, void *buffer);
+ssize_t px_extend(pxdoc_t *p, pxstream_t *dummy, size_t len);
+int px_cache_resize(pxdoc_t *p, int size);
+void px_cache_free(pxdoc_t *p);
+unsigned char *px_cache_pin(pxdoc_t *p, long offset, size_t len);
+void px_cache_unpin(pxdoc_t *p, const unsigned char *data);
+int px_write_blocks(pxdoc_t *p, long blocknr, int n, unsigned char *blocks);
+int px_read_blocks(pxdoc_t *p, long blocknr, int n, unsigned char *blocks);
+int px_prefetch_resize(pxdoc_t *p, int size);
+void px_prefetch_stop(pxdoc_t *p);
 
 ssize_t px_mb_read(pxblob_t *p, pxstream_t *dummy, size_t len, void *buffer);
 int px_mb_seek(pxblob_t *p, pxstream_t *dummy, long offset, int whence);
 long px_mb_tell(pxblob_t *p, pxstream_t *dummy);
 ssize_t px_mb_write(pxblob_t *p, pxstream_t *dummy, size_t len, void *buffer);
+ssize_t px_mb_pread(pxblob_t *p, pxstream_t *dummy, long offset, size_t len, void *buffer);
+ssize_t px_mb_extend(pxblob_t *p, pxstream_t *dummy, size_t len);
 
 ssize_t px_fread(pxdoc_t *p, pxstream_t *stream, size_t len, void *buffer);
 int px_fseek(pxdoc_t *p, pxstream_t *stream, long offset, int whence);
 long px_ftell(pxdoc_t *p, pxstream_t *stream);
 ssize_t px_fwrite(pxdoc_t *p, pxstream_t *stream, size_t len, void *buffer);
+#if HAVE_PREAD
+ssize_t px_fpread(pxdoc_t *p, pxstream_t *stream, long offset, size_t len, void *buffer);
+#endif
+
+ssize_t px_mmapread(pxdoc_t *p, pxstream_t *stream, size_t len, void *buffer);
+int px_mmapseek(pxdoc_t *p, pxstream_t *stream, long offset, int whence);
+long px_mmaptell(pxdoc_t *p, pxstream_t *stream);
+ssize_t px_mmapwrite(pxdoc_t *p, pxstream_t *stream, size_t len, void *buffer);
+ssize_t px_mmappread(pxdoc_t *p, pxstream_t *stream, long offset, size_t len, void *buffer);
 
 #ifdef HAVE_GSF
 ssize_t px_gsfread(pxdoc_t *p, pxstream_t *stream, size_t len, void *buffer);